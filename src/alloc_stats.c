@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include "alloc_stats.h"
+#include "config.h"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+typedef struct PhaseCounters {
+	atomic_uint_least64_t allocations;
+	atomic_uint_least64_t bytes;
+	atomic_uint_least64_t frees;
+	atomic_uint_least64_t freed_bytes;
+	atomic_uint_least64_t peak_bytes;
+} phase_counters_t;
+
+static const char* phase_names[ALLOC_PHASE_COUNT] = {
+	"other", "list_load", "fetch", "parse", "export", "insert",
+};
+
+static phase_counters_t phases[ALLOC_PHASE_COUNT];
+/* Signed: memory freed after counting was turned off can take it below what was counted. */
+static atomic_int_least64_t live_bytes;
+static atomic_uint_least64_t peak_bytes;
+static int counting = 1;
+static _Thread_local alloc_phase_t thread_phase;
+
+alloc_phase_t allocPhaseEnter(alloc_phase_t phase) {
+	const alloc_phase_t previous = thread_phase;
+	thread_phase = phase;
+	return previous;
+}
+
+const char* allocPhaseName(alloc_phase_t phase) {
+	return phase_names[phase];
+}
+
+static void raisePeak(atomic_uint_least64_t* peak, uint64_t value) {
+	uint64_t seen = atomic_load_explicit(peak, memory_order_relaxed);
+	while (value > seen && !atomic_compare_exchange_weak_explicit(peak, &seen, value,
+			memory_order_relaxed, memory_order_relaxed)) {
+	}
+}
+
+#ifdef __GLIBC__
+
+/* glibc's allocator under its own names, so the wrappers below can sit in front of it. */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void* __libc_valloc(size_t size);
+extern void* __libc_pvalloc(size_t size);
+extern void __libc_free(void* ptr);
+
+static void countAllocation(void* ptr) {
+	if (!ptr || !counting) {
+		return;
+	}
+	phase_counters_t* phase = &phases[thread_phase];
+	const uint64_t size = malloc_usable_size(ptr);
+	atomic_fetch_add_explicit(&phase->allocations, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&phase->bytes, size, memory_order_relaxed);
+	const int64_t live = atomic_fetch_add_explicit(&live_bytes, (int64_t)size, memory_order_relaxed)
+		+ (int64_t)size;
+	if (live > 0) {
+		raisePeak(&phase->peak_bytes, (uint64_t)live);
+		raisePeak(&peak_bytes, (uint64_t)live);
+	}
+}
+
+static void countFree(void* ptr) {
+	if (!ptr || !counting) {
+		return;
+	}
+	phase_counters_t* phase = &phases[thread_phase];
+	const uint64_t size = malloc_usable_size(ptr);
+	atomic_fetch_add_explicit(&phase->frees, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&phase->freed_bytes, size, memory_order_relaxed);
+	atomic_fetch_sub_explicit(&live_bytes, (int64_t)size, memory_order_relaxed);
+}
+
+void* malloc(size_t size) {
+	void* ptr = __libc_malloc(size);
+	countAllocation(ptr);
+	return ptr;
+}
+
+void* calloc(size_t count, size_t size) {
+	void* ptr = __libc_calloc(count, size);
+	countAllocation(ptr);
+	return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+	/* Counted before the call; once it succeeds the old block may be gone. */
+	const uint64_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+	void* moved = __libc_realloc(ptr, size);
+	if (!counting || (!moved && size > 0)) {
+		return moved;
+	}
+	if (ptr) {
+		phase_counters_t* phase = &phases[thread_phase];
+		atomic_fetch_add_explicit(&phase->frees, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&phase->freed_bytes, old_size, memory_order_relaxed);
+		atomic_fetch_sub_explicit(&live_bytes, (int64_t)old_size, memory_order_relaxed);
+	}
+	countAllocation(moved);
+	return moved;
+}
+
+void* reallocarray(void* ptr, size_t count, size_t size) {
+	size_t bytes;
+	if (__builtin_mul_overflow(count, size, &bytes)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return realloc(ptr, bytes);
+}
+
+void free(void* ptr) {
+	countFree(ptr);
+	__libc_free(ptr);
+}
+
+/* Blocks from the aligned allocators are freed through free() too, so they are counted alike. */
+void* memalign(size_t alignment, size_t size) {
+	void* ptr = __libc_memalign(alignment, size);
+	countAllocation(ptr);
+	return ptr;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+	return memalign(alignment, size);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) {
+	if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+		return EINVAL;
+	}
+	void* ptr = memalign(alignment, size);
+	if (!ptr) {
+		return ENOMEM;
+	}
+	*out = ptr;
+	return 0;
+}
+
+void* valloc(size_t size) {
+	void* ptr = __libc_valloc(size);
+	countAllocation(ptr);
+	return ptr;
+}
+
+void* pvalloc(size_t size) {
+	void* ptr = __libc_pvalloc(size);
+	countAllocation(ptr);
+	return ptr;
+}
+
+int allocStatsAvailable(void) {
+	return counting;
+}
+
+#else
+
+int allocStatsAvailable(void) {
+	return 0;
+}
+
+#endif
+
+void allocStatsConfigure(void) {
+	if (configLong("ZIP_ALLOC_STATS", 1) == 0) {
+		counting = 0;
+	}
+}
+
+void allocStatsSnapshot(alloc_phase_stats_t stats[ALLOC_PHASE_COUNT]) {
+	for (int i = 0; i < ALLOC_PHASE_COUNT; ++i) {
+		stats[i].allocations = atomic_load_explicit(&phases[i].allocations, memory_order_relaxed);
+		stats[i].bytes = atomic_load_explicit(&phases[i].bytes, memory_order_relaxed);
+		stats[i].frees = atomic_load_explicit(&phases[i].frees, memory_order_relaxed);
+		stats[i].freed_bytes = atomic_load_explicit(&phases[i].freed_bytes, memory_order_relaxed);
+		stats[i].peak_bytes = atomic_load_explicit(&phases[i].peak_bytes, memory_order_relaxed);
+	}
+}
+
+uint64_t allocLiveBytes(void) {
+	const int64_t live = atomic_load_explicit(&live_bytes, memory_order_relaxed);
+	return live > 0 ? (uint64_t)live : 0;
+}
+
+uint64_t allocPeakBytes(void) {
+	return atomic_load_explicit(&peak_bytes, memory_order_relaxed);
+}
+
+uint64_t allocPeakRssBytes(void) {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+	return (uint64_t)usage.ru_maxrss * 1024;   /* kilobytes on Linux */
+}
@@ -0,0 +1,52 @@
+#ifndef ZIP_CODES_ALLOC_STATS_H
+#define ZIP_CODES_ALLOC_STATS_H
+
+#include <stdint.h>
+
+/*
+ * The pipeline phases heap allocations are charged to. The phase belongs to
+ * the calling thread, so the fetch loop, replay workers and the database
+ * writer each charge their own work while they run side by side.
+ */
+typedef enum AllocPhase {
+	ALLOC_PHASE_OTHER,       /* startup, teardown and threads that never set a phase */
+	ALLOC_PHASE_LIST_LOAD,   /* reading the input list and the county dictionary */
+	ALLOC_PHASE_FETCH,       /* transfers, the response cache and replayed page reads */
+	ALLOC_PHASE_PARSE,       /* page parsers */
+	ALLOC_PHASE_EXPORT,      /* writing the CSV */
+	ALLOC_PHASE_INSERT,      /* the database writer and the end of the bulk load */
+	ALLOC_PHASE_COUNT
+} alloc_phase_t;
+
+typedef struct AllocPhaseStats {
+	uint64_t allocations;   /* a realloc counts as a free and an allocation */
+	uint64_t bytes;
+	uint64_t frees;
+	uint64_t freed_bytes;   /* bytes freed while in the phase, whoever allocated them */
+	uint64_t peak_bytes;    /* the most heap in use after an allocation in the phase */
+} alloc_phase_stats_t;
+
+/*
+ * Counting allocator hooks: malloc, free and friends are replaced by thin
+ * wrappers around glibc's own allocator that count calls and usable bytes
+ * per phase, with relaxed atomics. They also see the allocations made inside
+ * libcurl and SQLite. ZIP_ALLOC_STATS=0 turns the counting off. On other C
+ * libraries the hooks are left out and only the peak RSS is reported.
+ */
+int allocStatsAvailable(void);
+
+/* Reads ZIP_ALLOC_STATS; counting runs from process start until it is turned off. */
+void allocStatsConfigure(void);
+
+/* Sets the calling thread's phase and returns the one it replaces, to be restored after. */
+alloc_phase_t allocPhaseEnter(alloc_phase_t phase);
+const char* allocPhaseName(alloc_phase_t phase);
+
+void allocStatsSnapshot(alloc_phase_stats_t stats[ALLOC_PHASE_COUNT]);
+uint64_t allocLiveBytes(void);
+uint64_t allocPeakBytes(void);
+
+/* The process's peak resident set from getrusage, in bytes. */
+uint64_t allocPeakRssBytes(void);
+
+#endif
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ALIGNMENT _Alignof(max_align_t)
+#define ARENA_ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+typedef struct ArenaBlock {
+	struct ArenaBlock* next;
+	size_t size;   /* usable bytes after the header */
+	size_t used;
+} arena_block_t;
+
+#define ARENA_BLOCK_HEADER ARENA_ALIGN(sizeof(arena_block_t))
+
+struct Arena {
+	arena_block_t* first;
+	arena_block_t* current;   /* blocks after it are kept from before the last reset */
+	size_t block_size;
+	size_t base;              /* bytes of the first block taken by this header */
+	arena_stats_t stats;
+};
+
+static char* blockData(arena_block_t* block) {
+	return (char*)block + ARENA_BLOCK_HEADER;
+}
+
+static arena_block_t* newBlock(size_t size) {
+	arena_block_t* block = (arena_block_t*)malloc(ARENA_BLOCK_HEADER + size);
+	if (!block) {
+		fprintf(stderr, "Failed to allocate a %zu byte arena block.\n", size);
+		exit(EXIT_FAILURE);
+	}
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+arena_t* arenaCreate(size_t block_size) {
+	if (block_size < ARENA_ALIGN(sizeof(arena_t)) + ARENA_ALIGNMENT) {
+		block_size = ARENA_DEFAULT_BLOCK_SIZE;
+	}
+	arena_block_t* first = newBlock(block_size);
+	arena_t* arena = (arena_t*)blockData(first);
+	memset(arena, 0, sizeof(arena_t));
+	arena->first = first;
+	arena->current = first;
+	arena->block_size = block_size;
+	arena->base = ARENA_ALIGN(sizeof(arena_t));
+	first->used = arena->base;
+	arena->stats.blocks = 1;
+	arena->stats.reserved = block_size;
+	return arena;
+}
+
+/* Moves to the next kept block if it is big enough, else links a new one in after the current block. */
+static arena_block_t* advance(arena_t* arena, size_t size) {
+	arena_block_t* current = arena->current;
+	arena_block_t* next = current->next;
+	if (next && next->size >= size) {
+		next->used = 0;
+		arena->current = next;
+		return next;
+	}
+
+	arena_block_t* block = newBlock(size > arena->block_size ? size : arena->block_size);
+	block->next = next;
+	current->next = block;
+	arena->current = block;
+	arena->stats.blocks++;
+	arena->stats.reserved += block->size;
+	return block;
+}
+
+void* arenaAlloc(arena_t* arena, size_t size) {
+	const size_t aligned = ARENA_ALIGN(size > 0 ? size : 1);
+	arena_block_t* block = arena->current;
+	if (block->size - block->used < aligned) {
+		block = advance(arena, aligned);
+	}
+	void* memory = blockData(block) + block->used;
+	block->used += aligned;
+	arena->stats.allocations++;
+	arena->stats.bytes += size;
+	return memory;
+}
+
+void* arenaCalloc(arena_t* arena, size_t count, size_t size) {
+	if (size > 0 && count > SIZE_MAX / size) {
+		fprintf(stderr, "Arena allocation of %zu x %zu bytes overflows.\n", count, size);
+		exit(EXIT_FAILURE);
+	}
+	void* memory = arenaAlloc(arena, count * size);
+	memset(memory, 0, count * size);
+	return memory;
+}
+
+void arenaReset(arena_t* arena) {
+	arena->current = arena->first;
+	arena->first->used = arena->base;
+	arena->stats.resets++;
+}
+
+void arenaDestroy(arena_t* arena) {
+	if (!arena) {
+		return;
+	}
+	arena_block_t* block = arena->first->next;
+	while (block) {
+		arena_block_t* next = block->next;
+		free(block);
+		block = next;
+	}
+	free(arena->first);
+}
+
+const arena_stats_t* arenaStats(const arena_t* arena) {
+	return &arena->stats;
+}
+
+void arenaStatsAdd(arena_stats_t* total, const arena_stats_t* stats) {
+	total->allocations += stats->allocations;
+	total->blocks += stats->blocks;
+	total->resets += stats->resets;
+	total->bytes += stats->bytes;
+	total->reserved += stats->reserved;
+}
+
+void arenaStatsPrint(const char* name, const arena_stats_t* stats) {
+	fprintf(stderr, "%s: %ld allocations served by %ld mallocs (%.1f KB requested, %.1f KB reserved).\n",
+		name, stats->allocations, stats->blocks, (double)stats->bytes / 1024.0,
+		(double)stats->reserved / 1024.0);
+}
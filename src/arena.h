@@ -0,0 +1,41 @@
+#ifndef ZIP_CODES_ARENA_H
+#define ZIP_CODES_ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_DEFAULT_BLOCK_SIZE 65536
+
+typedef struct ArenaStats {
+	long allocations;   /* arenaAlloc() calls, each a malloc() before the arena */
+	long blocks;        /* malloc() calls the arena actually made */
+	long resets;
+	size_t bytes;       /* requested, before alignment */
+	size_t reserved;    /* block memory obtained from malloc() */
+} arena_stats_t;
+
+typedef struct Arena arena_t;
+
+/*
+ * Region allocator for objects that share a lifetime, such as a run's lists
+ * or the nodes parsed from one page. Allocations are bump-pointer carved from
+ * blocks of block_size bytes and are never freed one at a time: arenaReset()
+ * rewinds in O(1) keeping the blocks for reuse, arenaDestroy() releases them.
+ * The arena's own header lives in its first block. Not thread safe; an arena
+ * may be handed to another thread together with the objects in it.
+ */
+arena_t* arenaCreate(size_t block_size);
+
+/* Returns size bytes aligned for any type; requests larger than a block get a block of their own. */
+void* arenaAlloc(arena_t* arena, size_t size);
+void* arenaCalloc(arena_t* arena, size_t count, size_t size);
+
+void arenaReset(arena_t* arena);
+void arenaDestroy(arena_t* arena);
+
+const arena_stats_t* arenaStats(const arena_t* arena);
+void arenaStatsAdd(arena_stats_t* total, const arena_stats_t* stats);
+
+/* Prints one line comparing the allocations served with the mallocs they cost. */
+void arenaStatsPrint(const char* name, const arena_stats_t* stats);
+
+#endif
@@ -0,0 +1,141 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sqlite3.h>
+#include "zip_code_db.h"
+
+/*
+ * Bulk load benchmark for the zip_codes insert path. Loads the same synthetic
+ * records into a fresh database twice, once by formatting each row into SQL
+ * text for sqlite3_exec (the old path) and once through the prepared insert
+ * statement, and reports rows/sec for each.
+ */
+
+#define DEFAULT_ROW_COUNT 50000
+#define BENCH_DB_NAME "bench_insert.sqlite3"
+
+static double monotonicSeconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static void makeRecords(long count, ZipCodeRecord records[]) {
+	memset(records, 0, (size_t)count * sizeof(ZipCodeRecord));
+	for (long i = 0; i < count; ++i) {
+		records[i].code = (int32_t)(10000 + i);
+		records[i].county_id = 1;
+		records[i].population = (int32_t)(1000 + i % 50000);
+		records[i].population2010 = (int32_t)(900 + i % 40000);
+		records[i].population2000 = (int32_t)(800 + i % 30000);
+		records[i].landArea = (int32_t)(i % 200 * 100 + 25);
+		records[i].foreignBornPopulation = (int32_t)(i % 10000);
+		records[i].medianHouseholdIncome = (int32_t)(30000 + i % 90000);
+		records[i].medianHomePrice = (int32_t)(90000 + i % 400000);
+		records[i].medianResidentAge = (int32_t)((20 + i % 50) * 100 + 50);
+		records[i].whitePopulation = (int32_t)(i % 30000);
+		records[i].hispanicLatinoPopulation = (int32_t)(i % 20000);
+		records[i].blackPopulation = (int32_t)(i % 10000);
+		records[i].asianPopulation = (int32_t)(i % 5000);
+		records[i].americanIndianPopulation = (int32_t)(i % 1000);
+		records[i].highSchool = (int32_t)(i % 10000);
+		records[i].bachelorsDegree = (int32_t)(i % 10000);
+		records[i].graduateDegree = (int32_t)(i % 10000);
+		records[i].malePercent = (int32_t)(i % 10000);
+		records[i].femalePercent = (int32_t)(i % 10000);
+		records[i].averageHouseholdSize = (int32_t)((1 + i % 4) * 100 + 75);
+	}
+}
+
+static sqlite3* openBenchDb(void) {
+	remove(BENCH_DB_NAME);
+	sqlite3* db = NULL;
+	if (sqlite3_open(BENCH_DB_NAME, &db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to open database " BENCH_DB_NAME "\n");
+		exit(EXIT_FAILURE);
+	}
+	sqlite3_exec(db, COUNTIES_CREATE_STMT, NULL, NULL, NULL);
+	sqlite3_exec(db, "INSERT INTO counties VALUES ( 1, 'tx', 'montgomery' );", NULL, NULL, NULL);
+	sqlite3_exec(db, ZIP_CODES_CREATE_STMT, NULL, NULL, NULL);
+	return db;
+}
+
+static void loadWithExec(sqlite3* db, long count, const ZipCodeRecord records[]) {
+	char insert_format[] = "INSERT INTO zip_codes VALUES ("
+		" %d, %d, %d, %d, %d, %s, %s, %d, %d, %s, %d, %d, %d, %d, %d, %s, %s, %s, "
+		"%s, %s, %s );";
+	char insert_stmt[512] = {'\0'};
+	char text[9][ZIP_CODE_NUMBER_TEXT_SIZE];
+
+	sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+	for (long i = 0; i < count; ++i) {
+		const ZipCodeRecord* r = &records[i];
+		zipCodeFormatDecimal(text[0], r->landArea);
+		zipCodeFormatFraction(text[1], r->foreignBornPopulation);
+		zipCodeFormatDecimal(text[2], r->medianResidentAge);
+		zipCodeFormatFraction(text[3], r->highSchool);
+		zipCodeFormatFraction(text[4], r->bachelorsDegree);
+		zipCodeFormatFraction(text[5], r->graduateDegree);
+		zipCodeFormatFraction(text[6], r->malePercent);
+		zipCodeFormatFraction(text[7], r->femalePercent);
+		zipCodeFormatDecimal(text[8], r->averageHouseholdSize);
+		snprintf(insert_stmt, sizeof insert_stmt, insert_format, r->code, r->county_id,
+			r->population, r->population2010, r->population2000, text[0], text[1],
+			r->medianHouseholdIncome, r->medianHomePrice, text[2], r->whitePopulation,
+			r->hispanicLatinoPopulation, r->blackPopulation, r->asianPopulation,
+			r->americanIndianPopulation, text[3], text[4], text[5], text[6], text[7], text[8]);
+
+		char* err = NULL;
+		if (sqlite3_exec(db, insert_stmt, NULL, NULL, &err) != SQLITE_OK) {
+			fprintf(stderr, "Failed to execute insert stmt with error: %s\n", err);
+			sqlite3_free(err);
+		}
+	}
+	sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+}
+
+static void loadWithPrepared(sqlite3* db, long count, const ZipCodeRecord records[]) {
+	sqlite3_stmt* stmt = prepareZipCodeInsert(db);
+	sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+	for (long i = 0; i < count; ++i) {
+		insertZipCodeRecord(stmt, &records[i]);
+	}
+	sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+	sqlite3_finalize(stmt);
+}
+
+static double timeLoad(void (*load)(sqlite3*, long, const ZipCodeRecord[]), long count,
+		const ZipCodeRecord records[]) {
+	sqlite3* db = openBenchDb();
+	const double start = monotonicSeconds();
+	load(db, count, records);
+	const double elapsed = monotonicSeconds() - start;
+	sqlite3_close(db);
+	remove(BENCH_DB_NAME);
+	return elapsed;
+}
+
+int main(int argc, char* argv[]) {
+	const long count = argc > 1 ? atol(argv[1]) : DEFAULT_ROW_COUNT;
+	if (count < 1) {
+		fprintf(stderr, "Usage: %s [row_count]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	ZipCodeRecord* records = (ZipCodeRecord*)malloc((size_t)count * sizeof(ZipCodeRecord));
+	makeRecords(count, records);
+
+	const double exec_seconds = timeLoad(loadWithExec, count, records);
+	const double prepared_seconds = timeLoad(loadWithPrepared, count, records);
+
+	printf("%-22s %10s %12s\n", "insert path", "seconds", "rows/sec");
+	printf("%-22s %10.3f %12.0f\n", "sprintf + sqlite3_exec", exec_seconds, (double)count / exec_seconds);
+	printf("%-22s %10.3f %12.0f\n", "prepared statement", prepared_seconds, (double)count / prepared_seconds);
+	printf("speedup: %.2fx over %ld rows\n", exec_seconds / prepared_seconds, count);
+
+	free(records);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "scan.h"
+#include "zip_page_parser.h"
+
+/*
+ * Parse benchmark for saved zip code pages. Feeds every page through the
+ * streaming parser in network-sized chunks with each label matcher, checks
+ * that both extract the same values and reports ns/page and MB/s. Every row's
+ * MB/s is over the full page size, even though the parser stops once it has
+ * the last field, so the rows compare directly. The legacy row is the label
+ * search the old processLines() did: strtok() over the whole page and one
+ * strstr() per label on every line.
+ */
+
+#define DEFAULT_ITERATIONS 200
+#define CHUNK_SIZE 16384
+
+typedef struct {
+	const char* path;
+	char* data;
+	size_t size;
+} page_t;
+
+static double monotonicSeconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static void loadPage(page_t* page, const char* path) {
+	FILE* fp = fopen(path, "rb");
+	if (!fp) {
+		fprintf(stderr, "File %s not found. Exiting...\n", path);
+		exit(EXIT_FAILURE);
+	}
+	fseek(fp, 0, SEEK_END);
+	const long length = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	page->path = path;
+	page->data = (char*)malloc((size_t)length);
+	page->size = fread(page->data, 1, (size_t)length, fp);
+	fclose(fp);
+}
+
+static void parsePage(zip_page_parser_t* parser, zip_page_matcher_t matcher, const page_t* page) {
+	zipPageParserInit(parser);
+	parser->matcher = matcher;
+	for (size_t offset = 0; offset < page->size; offset += CHUNK_SIZE) {
+		const size_t size = page->size - offset < CHUNK_SIZE ? page->size - offset : CHUNK_SIZE;
+		if (zipPageParserFeed(parser, &page->data[offset], size)) {
+			return;
+		}
+	}
+	zipPageParserFinish(parser);
+}
+
+/* Returns seconds per pass over all pages. */
+static double timeMatcher(zip_page_matcher_t matcher, const page_t pages[], int page_count, long iterations) {
+	static zip_page_parser_t parser;
+	const double start = monotonicSeconds();
+	for (long i = 0; i < iterations; ++i) {
+		for (int p = 0; p < page_count; ++p) {
+			parsePage(&parser, matcher, &pages[p]);
+		}
+	}
+	return (monotonicSeconds() - start) / (double)iterations;
+}
+
+static double timeLegacyScan(const page_t pages[], int page_count, long iterations) {
+	size_t largest = 0;
+	for (int p = 0; p < page_count; ++p) {
+		largest = pages[p].size > largest ? pages[p].size : largest;
+	}
+	char* scratch = (char*)malloc(largest + 1);
+	long hits = 0;
+
+	const double start = monotonicSeconds();
+	for (long i = 0; i < iterations; ++i) {
+		for (int p = 0; p < page_count; ++p) {
+			memcpy(scratch, pages[p].data, pages[p].size);
+			scratch[pages[p].size] = '\0';
+			for (char* line = strtok(scratch, "\n"); line; line = strtok(NULL, "\n")) {
+				for (int field = 0; field < ZIP_FIELD_COUNT; ++field) {
+					hits += strstr(line, zipPageFieldLabel((zip_page_field_t)field)) != NULL;
+				}
+			}
+		}
+	}
+	const double elapsed = (monotonicSeconds() - start) / (double)iterations;
+
+	free(scratch);
+	if (hits < (long)ZIP_FIELD_COUNT * iterations) {
+		fprintf(stderr, "Legacy scan found only %ld labels.\n", hits);
+	}
+	return elapsed;
+}
+
+static int checkMatchersAgree(const page_t pages[], int page_count) {
+	static zip_page_parser_t automaton_parser;
+	static zip_page_parser_t strstr_parser;
+	int agree = 1;
+	for (int p = 0; p < page_count; ++p) {
+		parsePage(&automaton_parser, ZIP_MATCH_AUTOMATON, &pages[p]);
+		parsePage(&strstr_parser, ZIP_MATCH_STRSTR, &pages[p]);
+		if (automaton_parser.found != strstr_parser.found) {
+			fprintf(stderr, "%s: matchers found different fields (%lx vs %lx).\n", pages[p].path,
+				automaton_parser.found, strstr_parser.found);
+			agree = 0;
+			continue;
+		}
+		for (int field = 0; field < ZIP_FIELD_COUNT; ++field) {
+			if ((automaton_parser.found & (1UL << field))
+					&& automaton_parser.values[field] != strstr_parser.values[field]) {
+				fprintf(stderr, "%s: field %d is %d with the automaton, %d with strstr.\n", pages[p].path,
+					field, automaton_parser.values[field], strstr_parser.values[field]);
+				agree = 0;
+			}
+		}
+	}
+	return agree;
+}
+
+int main(int argc, char* argv[]) {
+	long iterations = DEFAULT_ITERATIONS;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n': iterations = atol(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-n iterations] page.html...\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	const int page_count = argc - optind;
+	if (page_count < 1 || iterations < 1) {
+		fprintf(stderr, "Usage: %s [-n iterations] page.html...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	page_t* pages = (page_t*)calloc((size_t)page_count, sizeof(page_t));
+	size_t page_bytes = 0;
+	for (int p = 0; p < page_count; ++p) {
+		loadPage(&pages[p], argv[optind + p]);
+		page_bytes += pages[p].size;
+	}
+	if (!checkMatchersAgree(pages, page_count)) {
+		return EXIT_FAILURE;
+	}
+
+	const double legacy_seconds = timeLegacyScan(pages, page_count, iterations);
+	const double strstr_seconds = timeMatcher(ZIP_MATCH_STRSTR, pages, page_count, iterations);
+
+	printf("%-20s %12s %10s\n", "matcher", "ns/page", "MB/s");
+	printf("%-20s %12.0f %10.1f\n", "legacy strtok", legacy_seconds * 1e9 / page_count,
+		(double)page_bytes / legacy_seconds / 1e6);
+	printf("%-20s %12.0f %10.1f\n", "strstr", strstr_seconds * 1e9 / page_count,
+		(double)page_bytes / strstr_seconds / 1e6);
+
+	/* The automaton once per scan kernel; the last one supported is what the tools use. */
+	const char* const kernels[] = { "scalar", "sse2", "avx2" };
+	double automaton_seconds = 0.0;
+	for (size_t k = 0; k < sizeof kernels / sizeof kernels[0]; ++k) {
+		if (!scanSelect(kernels[k])) {
+			continue;
+		}
+		if (!checkMatchersAgree(pages, page_count)) {
+			return EXIT_FAILURE;
+		}
+		automaton_seconds = timeMatcher(ZIP_MATCH_AUTOMATON, pages, page_count, iterations);
+
+		char name[32];
+		snprintf(name, sizeof name, "aho-corasick/%s", kernels[k]);
+		printf("%-20s %12.0f %10.1f\n", name, automaton_seconds * 1e9 / page_count,
+			(double)page_bytes / automaton_seconds / 1e6);
+	}
+	printf("speedup: %.1fx over strstr, %.1fx over legacy, %d pages, %ld iterations\n",
+		strstr_seconds / automaton_seconds, legacy_seconds / automaton_seconds, page_count, iterations);
+
+	for (int p = 0; p < page_count; ++p) {
+		free(pages[p].data);
+	}
+	free(pages);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,491 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sqlite3.h>
+#include "alloc_stats.h"
+#include "arena.h"
+#include "county_page_parser.h"
+#include "scan.h"
+#include "zip_code_db.h"
+#include "zip_page_parser.h"
+
+/*
+ * Extraction benchmark suite, run by the bench target over fixtures/. Times
+ * each stage of turning a page into rows on its own, away from the network:
+ * the county page scan (get-zip-codes' processChunk), the zip page parser
+ * (read_list's processLines), the number parsing that replaced
+ * removeCommasFromNumber and percentToFraction, and both prepared inserts.
+ * Every benchmark runs a number of samples and reports the mean ns per
+ * operation with its standard deviation, bytes/sec and mallocs per operation,
+ * as a table or as JSON or CSV for comparing runs.
+ */
+
+#define DEFAULT_SAMPLES 10
+#define DEFAULT_SAMPLE_MS 50
+#define CHUNK_SIZE 16384
+#define COUNTY_ARENA_BLOCK_SIZE 8192
+#define MAX_PAGES 256
+
+typedef struct {
+	char name[64];
+	char* data;
+	size_t size;
+} page_t;
+
+typedef struct {
+	page_t* pages;
+	int count;
+	size_t bytes;
+} page_set_t;
+
+typedef struct {
+	const char* name;
+	const char* unit;   /* what one operation is */
+	long ops;           /* operations per iteration */
+	size_t bytes;       /* input bytes per iteration, 0 where bytes mean nothing */
+	void (*run)(void* ctx);
+	void* ctx;
+} bench_t;
+
+typedef struct {
+	long iterations;    /* per sample */
+	int samples;
+	double ns_mean;     /* per operation */
+	double ns_stddev;
+	double ns_min;
+	double bytes_per_sec;
+	double allocs;      /* per operation */
+} bench_result_t;
+
+typedef enum { FORMAT_TEXT, FORMAT_JSON, FORMAT_CSV } output_format_t;
+
+/*
+ * Heap allocations come from alloc_stats' counting wrappers around glibc's
+ * allocator, which see SQLite's too and cover the aligned variants. The
+ * suite runs on one thread in one phase, so the sum over phases will do.
+ */
+static uint64_t countAllocations(void) {
+	alloc_phase_stats_t stats[ALLOC_PHASE_COUNT];
+	allocStatsSnapshot(stats);
+	uint64_t total = 0;
+	for (int i = 0; i < ALLOC_PHASE_COUNT; ++i) {
+		total += stats[i].allocations;
+	}
+	return total;
+}
+
+static double monotonicSeconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static int compareNames(const void* a, const void* b) {
+	return strcmp(((const page_t*)a)->name, ((const page_t*)b)->name);
+}
+
+/* Loads every file in dir ending in suffix, sorted by name so runs are comparable. */
+static void loadPages(page_set_t* set, const char* dir, const char* suffix) {
+	DIR* d = opendir(dir);
+	if (!d) {
+		fprintf(stderr, "Fixture directory %s not found. Exiting...\n", dir);
+		exit(EXIT_FAILURE);
+	}
+	set->pages = (page_t*)calloc(MAX_PAGES, sizeof(page_t));
+	set->count = 0;
+	set->bytes = 0;
+	for (struct dirent* entry; (entry = readdir(d)) != NULL && set->count < MAX_PAGES;) {
+		const size_t length = strlen(entry->d_name);
+		const size_t suffix_length = strlen(suffix);
+		if (length <= suffix_length || length >= sizeof set->pages->name
+				|| strcmp(&entry->d_name[length - suffix_length], suffix) != 0) {
+			continue;
+		}
+		char path[1024];
+		snprintf(path, sizeof path, "%s/%s", dir, entry->d_name);
+		FILE* fp = fopen(path, "rb");
+		if (!fp) {
+			continue;
+		}
+		fseek(fp, 0, SEEK_END);
+		const long size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+
+		page_t* page = &set->pages[set->count++];
+		snprintf(page->name, sizeof page->name, "%s", entry->d_name);
+		page->data = (char*)malloc((size_t)size);
+		page->size = fread(page->data, 1, (size_t)size, fp);
+		set->bytes += page->size;
+		fclose(fp);
+	}
+	closedir(d);
+	if (set->count == 0) {
+		fprintf(stderr, "No *%s fixtures in %s. Exiting...\n", suffix, dir);
+		exit(EXIT_FAILURE);
+	}
+	qsort(set->pages, (size_t)set->count, sizeof(page_t), compareNames);
+}
+
+static void freePages(page_set_t* set) {
+	for (int p = 0; p < set->count; ++p) {
+		free(set->pages[p].data);
+	}
+	free(set->pages);
+}
+
+/* County pages: the scan get-zip-codes runs, building its per-page list in an arena. */
+typedef struct CountyNode {
+	char code[COUNTY_PAGE_CODE_SIZE];
+	struct CountyNode* next;
+} county_node_t;
+
+typedef struct {
+	arena_t* arena;
+	county_node_t* current;
+} county_list_t;
+
+static void appendCountyZip(void* ctx, const char* code) {
+	county_list_t* list = (county_list_t*)ctx;
+	county_node_t* next = (county_node_t*)arenaAlloc(list->arena, sizeof(county_node_t));
+	next->next = NULL;
+	strcpy(list->current->code, code);
+	list->current->next = next;
+	list->current = next;
+}
+
+static void runCountyPages(void* ctx) {
+	const page_set_t* set = (const page_set_t*)ctx;
+	for (int p = 0; p < set->count; ++p) {
+		county_list_t list;
+		list.arena = arenaCreate(COUNTY_ARENA_BLOCK_SIZE);
+		list.current = (county_node_t*)arenaAlloc(list.arena, sizeof(county_node_t));
+		list.current->next = NULL;
+		countyPageParse(set->pages[p].data, set->pages[p].size, appendCountyZip, &list);
+		arenaDestroy(list.arena);
+	}
+}
+
+/* Zip pages: fed to the streaming parser in network-sized chunks, as read_list does. */
+static void parseZipPage(zip_page_parser_t* parser, const page_t* page) {
+	zipPageParserInit(parser);
+	for (size_t offset = 0; offset < page->size; offset += CHUNK_SIZE) {
+		const size_t size = page->size - offset < CHUNK_SIZE ? page->size - offset : CHUNK_SIZE;
+		if (zipPageParserFeed(parser, &page->data[offset], size)) {
+			return;
+		}
+	}
+	zipPageParserFinish(parser);
+}
+
+static void runZipPages(void* ctx) {
+	static zip_page_parser_t parser;
+	const page_set_t* set = (const page_set_t*)ctx;
+	for (int p = 0; p < set->count; ++p) {
+		parseZipPage(&parser, &set->pages[p]);
+	}
+}
+
+/* The parser stops once every field is found, so bytes/sec counts what it consumed. */
+static size_t zipPageBytes(const page_set_t* set) {
+	static zip_page_parser_t parser;
+	size_t bytes = 0;
+	for (int p = 0; p < set->count; ++p) {
+		parseZipPage(&parser, &set->pages[p]);
+		bytes += parser.bytes;
+	}
+	return bytes;
+}
+
+/* Number text as it appears on the pages. */
+typedef struct {
+	const char* const* texts;
+	long count;
+	int decimals;
+} number_set_t;
+
+static volatile int32_t number_sink;   /* keeps the parses from being optimized away */
+
+static const char* const counted_numbers[] = {
+	"11,453", "$52,412", "$187,600", "1,307", "24", "3,091,882", "$1,250,000", "958",
+	"62,037", "$36,906", "7,519", "105", "$249,900", "19,112", "2,406", "$71,250"
+};
+
+static const char* const percentages[] = {
+	"15.4%", "4.9%", "88.2%", "31.0%", "0.7%", "100.0%", "52.3%", "47.7%",
+	"9.15%", "27.8%", "63.1%", "12.0%", "5.5%", "74.6%", "38.9%", "2.25%"
+};
+
+static size_t numberBytes(const number_set_t* set) {
+	size_t bytes = 0;
+	for (long i = 0; i < set->count; ++i) {
+		bytes += strlen(set->texts[i]);
+	}
+	return bytes;
+}
+
+static void runNumbers(void* ctx) {
+	number_set_t* set = (number_set_t*)ctx;
+	for (long i = 0; i < set->count; ++i) {
+		const char* text = set->texts[i];
+		int32_t value = 0;
+		zipCodeParseNumber(text, &text[strlen(text)], set->decimals, &value);
+		number_sink += value;
+	}
+}
+
+/* Inserts: one transaction of rows per iteration into an in-memory database. */
+typedef struct {
+	sqlite3* db;
+	sqlite3_stmt* zip_stmt;
+	sqlite3_stmt* county_stmt;
+	ZipCodeRecord* records;   /* parsed from the zip page fixtures */
+	long count;
+	long next_code;           /* every row gets a fresh key so nothing conflicts */
+} insert_set_t;
+
+static void openInsertDb(insert_set_t* set, const page_set_t* zip_pages) {
+	if (sqlite3_open(":memory:", &set->db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to open an in-memory database.\n");
+		exit(EXIT_FAILURE);
+	}
+	sqlite3_exec(set->db, COUNTIES_CREATE_STMT, NULL, NULL, NULL);
+	sqlite3_exec(set->db, "INSERT INTO counties VALUES ( 1, 'wy', 'laramie' );", NULL, NULL, NULL);
+	sqlite3_exec(set->db, ZIP_CODES_CREATE_STMT, NULL, NULL, NULL);
+	sqlite3_exec(set->db, ZIP_CODES_BY_COUNTY_CREATE_STMT, NULL, NULL, NULL);
+	set->zip_stmt = prepareZipCodeInsert(set->db);
+	set->county_stmt = prepareCountyZipInsert(set->db);
+
+	static zip_page_parser_t parser;
+	set->count = zip_pages->count;
+	set->records = (ZipCodeRecord*)calloc((size_t)set->count, sizeof(ZipCodeRecord));
+	for (long i = 0; i < set->count; ++i) {
+		parseZipPage(&parser, &zip_pages->pages[i]);
+		zipPageParserCopy(&parser, &set->records[i]);
+		set->records[i].county_id = 1;
+	}
+	set->next_code = 1;
+}
+
+static void closeInsertDb(insert_set_t* set) {
+	sqlite3_finalize(set->zip_stmt);
+	sqlite3_finalize(set->county_stmt);
+	sqlite3_close(set->db);
+	free(set->records);
+}
+
+static void runZipInserts(void* ctx) {
+	insert_set_t* set = (insert_set_t*)ctx;
+	sqlite3_exec(set->db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+	for (long i = 0; i < set->count; ++i) {
+		set->records[i].code = (int32_t)set->next_code++;
+		insertZipCodeRecord(set->zip_stmt, &set->records[i]);
+	}
+	sqlite3_exec(set->db, "COMMIT", NULL, NULL, NULL);
+}
+
+static void runCountyInserts(void* ctx) {
+	insert_set_t* set = (insert_set_t*)ctx;
+	sqlite3_exec(set->db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+	for (long i = 0; i < set->count; ++i) {
+		char code[32];
+		snprintf(code, sizeof code, "%ld", set->next_code++);
+		insertCountyZip(set->county_stmt, code, 1);
+	}
+	sqlite3_exec(set->db, "COMMIT", NULL, NULL, NULL);
+}
+
+/* Doubles the iterations per sample until one takes sample_ms, then times samples of that size. */
+static void runBench(const bench_t* bench, int samples, long sample_ms, bench_result_t* result) {
+	long iterations = 1;
+	for (;;) {
+		const double start = monotonicSeconds();
+		for (long i = 0; i < iterations; ++i) {
+			bench->run(bench->ctx);
+		}
+		if ((monotonicSeconds() - start) * 1000.0 >= (double)sample_ms || iterations >= (1L << 30)) {
+			break;
+		}
+		iterations *= 2;
+	}
+
+	double sum = 0.0;
+	double sum_squares = 0.0;
+	double best = 0.0;
+	const uint64_t allocations_before = countAllocations();
+	for (int s = 0; s < samples; ++s) {
+		const double start = monotonicSeconds();
+		for (long i = 0; i < iterations; ++i) {
+			bench->run(bench->ctx);
+		}
+		const double ns = (monotonicSeconds() - start) * 1e9 / (double)(iterations * bench->ops);
+		sum += ns;
+		sum_squares += ns * ns;
+		best = s == 0 || ns < best ? ns : best;
+	}
+	const double total_ops = (double)samples * (double)iterations * (double)bench->ops;
+
+	result->iterations = iterations;
+	result->samples = samples;
+	result->ns_mean = sum / samples;
+	result->ns_stddev = samples > 1
+		? sqrt(fmax(0.0, (sum_squares - sum * sum / samples) / (samples - 1))) : 0.0;
+	result->ns_min = best;
+	result->bytes_per_sec = bench->bytes > 0
+		? (double)bench->bytes / (double)bench->ops / (result->ns_mean / 1e9) : 0.0;
+	result->allocs = allocStatsAvailable()
+		? (double)(countAllocations() - allocations_before) / total_ops : -1.0;
+}
+
+static void printText(FILE* out, const bench_t benches[], const bench_result_t results[], int count) {
+	fprintf(out, "%-22s %-6s %12s %9s %7s %12s %12s\n", "benchmark", "unit", "ns/op", "stddev", "cv%",
+		"MB/s", "allocs/op");
+	for (int b = 0; b < count; ++b) {
+		const bench_result_t* r = &results[b];
+		char mb[32] = "-";
+		char allocs[32] = "-";
+		if (r->bytes_per_sec > 0) {
+			snprintf(mb, sizeof mb, "%.1f", r->bytes_per_sec / 1e6);
+		}
+		if (r->allocs >= 0) {
+			snprintf(allocs, sizeof allocs, "%.2f", r->allocs);
+		}
+		fprintf(out, "%-22s %-6s %12.1f %9.1f %7.2f %12s %12s\n", benches[b].name, benches[b].unit, r->ns_mean,
+			r->ns_stddev, r->ns_mean > 0 ? r->ns_stddev / r->ns_mean * 100.0 : 0.0, mb, allocs);
+	}
+	fprintf(out, "scan kernel %s, %d samples per benchmark\n", scanImplementation(),
+		count > 0 ? results[0].samples : 0);
+}
+
+static void printJson(FILE* out, const bench_t benches[], const bench_result_t results[], int count) {
+	fprintf(out, "{\"scan_kernel\": \"%s\", \"benchmarks\": [", scanImplementation());
+	for (int b = 0; b < count; ++b) {
+		const bench_result_t* r = &results[b];
+		fprintf(out, "%s\n  {\"name\": \"%s\", \"unit\": \"%s\", \"ops_per_iteration\": %ld, \"iterations\": %ld, "
+			"\"samples\": %d, \"ns_per_op\": %.2f, \"ns_stddev\": %.2f, \"ns_variance\": %.2f, \"ns_min\": %.2f, ",
+			b > 0 ? "," : "", benches[b].name, benches[b].unit, benches[b].ops, r->iterations, r->samples,
+			r->ns_mean, r->ns_stddev, r->ns_stddev * r->ns_stddev, r->ns_min);
+		if (r->bytes_per_sec > 0) {
+			fprintf(out, "\"bytes_per_sec\": %.0f, ", r->bytes_per_sec);
+		} else {
+			fprintf(out, "\"bytes_per_sec\": null, ");
+		}
+		if (r->allocs >= 0) {
+			fprintf(out, "\"allocs_per_op\": %.3f}", r->allocs);
+		} else {
+			fprintf(out, "\"allocs_per_op\": null}");
+		}
+	}
+	fprintf(out, "\n]}\n");
+}
+
+static void printCsv(FILE* out, const bench_t benches[], const bench_result_t results[], int count) {
+	fprintf(out, "name,unit,ops_per_iteration,iterations,samples,ns_per_op,ns_stddev,ns_variance,ns_min,"
+		"bytes_per_sec,allocs_per_op\n");
+	for (int b = 0; b < count; ++b) {
+		const bench_result_t* r = &results[b];
+		fprintf(out, "%s,%s,%ld,%ld,%d,%.2f,%.2f,%.2f,%.2f,", benches[b].name, benches[b].unit, benches[b].ops,
+			r->iterations, r->samples, r->ns_mean, r->ns_stddev, r->ns_stddev * r->ns_stddev, r->ns_min);
+		if (r->bytes_per_sec > 0) {
+			fprintf(out, "%.0f", r->bytes_per_sec);
+		}
+		fprintf(out, ",");
+		if (r->allocs >= 0) {
+			fprintf(out, "%.3f", r->allocs);
+		}
+		fprintf(out, "\n");
+	}
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-d fixtures] [-n samples] [-t sample_ms] [-f text|json|csv] [-o file]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[]) {
+	const char* fixtures = "fixtures";
+	const char* output_path = NULL;
+	output_format_t format = FORMAT_TEXT;
+	int samples = DEFAULT_SAMPLES;
+	long sample_ms = DEFAULT_SAMPLE_MS;
+	int opt;
+	while ((opt = getopt(argc, argv, "d:n:t:f:o:")) != -1) {
+		switch (opt) {
+		case 'd': fixtures = optarg; break;
+		case 'n': samples = atoi(optarg); break;
+		case 't': sample_ms = atol(optarg); break;
+		case 'o': output_path = optarg; break;
+		case 'f':
+			if (strcmp(optarg, "text") == 0) {
+				format = FORMAT_TEXT;
+			} else if (strcmp(optarg, "json") == 0) {
+				format = FORMAT_JSON;
+			} else if (strcmp(optarg, "csv") == 0) {
+				format = FORMAT_CSV;
+			} else {
+				usage(argv[0]);
+			}
+			break;
+		default: usage(argv[0]);
+		}
+	}
+	if (samples < 1 || sample_ms < 1 || optind != argc) {
+		usage(argv[0]);
+	}
+	allocStatsConfigure();
+
+	char dir[1024];
+	page_set_t county_pages;
+	page_set_t zip_pages;
+	snprintf(dir, sizeof dir, "%s/county", fixtures);
+	loadPages(&county_pages, dir, ".asp");
+	snprintf(dir, sizeof dir, "%s/city-data", fixtures);
+	loadPages(&zip_pages, dir, ".html");
+
+	number_set_t counts = { counted_numbers, sizeof counted_numbers / sizeof counted_numbers[0], 0 };
+	number_set_t fractions = { percentages, sizeof percentages / sizeof percentages[0], 2 };
+	insert_set_t inserts;
+	openInsertDb(&inserts, &zip_pages);
+
+	const bench_t benches[] = {
+		{ "county_page_scan", "page", county_pages.count, county_pages.bytes, runCountyPages, &county_pages },
+		{ "zip_page_parse", "page", zip_pages.count, zipPageBytes(&zip_pages), runZipPages, &zip_pages },
+		{ "parse_count", "value", counts.count, numberBytes(&counts), runNumbers, &counts },
+		{ "parse_percent", "value", fractions.count, numberBytes(&fractions), runNumbers, &fractions },
+		{ "insert_zip_code", "row", inserts.count, 0, runZipInserts, &inserts },
+		{ "insert_county_zip", "row", inserts.count, 0, runCountyInserts, &inserts },
+	};
+	const int bench_count = (int)(sizeof benches / sizeof benches[0]);
+	bench_result_t results[sizeof benches / sizeof benches[0]];
+	for (int b = 0; b < bench_count; ++b) {
+		runBench(&benches[b], samples, sample_ms, &results[b]);
+	}
+
+	FILE* out = stdout;
+	if (output_path) {
+		/* The table still goes to stdout for whoever ran the target. */
+		printText(stdout, benches, results, bench_count);
+		if (!(out = fopen(output_path, "w"))) {
+			fprintf(stderr, "Failed to open %s for writing.\n", output_path);
+			return EXIT_FAILURE;
+		}
+	}
+	switch (format) {
+	case FORMAT_TEXT: printText(out, benches, results, bench_count); break;
+	case FORMAT_JSON: printJson(out, benches, results, bench_count); break;
+	case FORMAT_CSV: printCsv(out, benches, results, bench_count); break;
+	}
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	closeInsertDb(&inserts);
+	freePages(&county_pages);
+	freePages(&zip_pages);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer_pool.h"
+
+struct BufferPool {
+	fetch_buffer_t* free_buffers;
+	long free_count;
+	long max_buffers;
+	buffer_pool_stats_t stats;
+};
+
+buffer_pool_t* bufferPoolCreate(long max_buffers) {
+	buffer_pool_t* pool = (buffer_pool_t*)calloc(1, sizeof(buffer_pool_t));
+	if (max_buffers < 1) {
+		max_buffers = 1;
+	}
+	if (pool) {
+		pool->free_buffers = (fetch_buffer_t*)calloc((size_t)max_buffers, sizeof(fetch_buffer_t));
+	}
+	if (!pool || !pool->free_buffers) {
+		fprintf(stderr, "Failed to allocate the response buffer pool.\n");
+		exit(EXIT_FAILURE);
+	}
+	pool->max_buffers = max_buffers;
+	return pool;
+}
+
+void bufferPoolDestroy(buffer_pool_t* pool) {
+	for (long i = 0; i < pool->free_count; ++i) {
+		free(pool->free_buffers[i].memory);
+	}
+	free(pool->free_buffers);
+	free(pool);
+}
+
+/* Gives an empty buffer at least capacity bytes without copying anything. */
+static int resizeEmpty(fetch_buffer_t* buffer, size_t capacity) {
+	free(buffer->memory);
+	buffer->memory = (char*)malloc(capacity);
+	buffer->capacity = buffer->memory ? capacity : 0;
+	return buffer->memory != NULL;
+}
+
+void bufferPoolAcquire(buffer_pool_t* pool, fetch_buffer_t* buffer, size_t expected_size) {
+	const int presize = expected_size > 0 && expected_size < BUFFER_POOL_MAX_PRESIZE;
+	const size_t needed = presize ? expected_size + 1 : BUFFER_POOL_INITIAL_CAPACITY;
+	pool->stats.acquired++;
+	pool->stats.presized += presize;
+	memset(buffer, 0, sizeof(fetch_buffer_t));
+
+	if (pool->free_count > 0) {
+		/* The smallest pooled buffer that fits, else the most recently released one. */
+		long pick = pool->free_count - 1;
+		for (long i = 0; i < pool->free_count; ++i) {
+			const size_t capacity = pool->free_buffers[i].capacity;
+			if (capacity >= needed && (pool->free_buffers[pick].capacity < needed
+					|| capacity < pool->free_buffers[pick].capacity)) {
+				pick = i;
+			}
+		}
+		*buffer = pool->free_buffers[pick];
+		pool->free_buffers[pick] = pool->free_buffers[--pool->free_count];
+		/* One too small is replaced below, which is no better than a fresh allocation. */
+		pool->stats.reused += buffer->capacity >= needed;
+	}
+
+	if (buffer->capacity < needed && !resizeEmpty(buffer, needed)) {
+		fprintf(stderr, "Failed to allocate a %zu byte response buffer.\n", needed);
+		exit(EXIT_FAILURE);
+	}
+	buffer->size = 0;
+	buffer->memory[0] = '\0';
+}
+
+int bufferPoolAppend(buffer_pool_t* pool, fetch_buffer_t* buffer, const char* data, size_t size) {
+	if (buffer->size + size + 1 > buffer->capacity) {
+		size_t capacity = buffer->capacity > 0 ? buffer->capacity : BUFFER_POOL_INITIAL_CAPACITY;
+		while (capacity < buffer->size + size + 1) {
+			capacity *= 2;
+		}
+		char* memory = (char*)realloc(buffer->memory, capacity);
+		if (!memory) {
+			fprintf(stderr, "Insufficient memory to grow a response buffer to %zu bytes.\n", capacity);
+			return 0;
+		}
+		buffer->memory = memory;
+		buffer->capacity = capacity;
+		pool->stats.grown++;
+		pool->stats.bytes_copied += buffer->size;
+	}
+
+	memcpy(&buffer->memory[buffer->size], data, size);
+	buffer->size += size;
+	buffer->memory[buffer->size] = '\0';
+	pool->stats.bytes_appended += size;
+	return 1;
+}
+
+void bufferPoolRelease(buffer_pool_t* pool, fetch_buffer_t* buffer) {
+	if (!buffer->memory) {
+		return;
+	}
+	if (pool->free_count < pool->max_buffers && buffer->capacity <= BUFFER_POOL_MAX_RETAINED) {
+		buffer->size = 0;
+		pool->free_buffers[pool->free_count++] = *buffer;
+	} else {
+		free(buffer->memory);
+	}
+	memset(buffer, 0, sizeof(fetch_buffer_t));
+}
+
+void bufferPoolStats(const buffer_pool_t* pool, buffer_pool_stats_t* stats) {
+	*stats = pool->stats;
+}
@@ -0,0 +1,49 @@
+#ifndef ZIP_CODES_BUFFER_POOL_H
+#define ZIP_CODES_BUFFER_POOL_H
+
+#include <stddef.h>
+
+#define BUFFER_POOL_INITIAL_CAPACITY 16384          /* first allocation when the size is unknown */
+#define BUFFER_POOL_MAX_PRESIZE (16 * 1024 * 1024)  /* larger Content-Length hints are not trusted up front */
+#define BUFFER_POOL_MAX_RETAINED (4 * 1024 * 1024)  /* bigger buffers are freed instead of pooled */
+
+/* A response body: memory is NUL terminated at size and has room for capacity bytes. */
+typedef struct FetchBuffer {
+	char* memory;
+	size_t size;
+	size_t capacity;
+} fetch_buffer_t;
+
+typedef struct BufferPoolStats {
+	long acquired;
+	long reused;            /* acquisitions served by a pooled buffer already big enough */
+	long presized;          /* acquisitions sized from the expected length */
+	long grown;             /* reallocations of a buffer already holding data */
+	size_t bytes_appended;
+	size_t bytes_copied;    /* data moved by those reallocations */
+} buffer_pool_stats_t;
+
+typedef struct BufferPool buffer_pool_t;
+
+/*
+ * Keeps up to max_buffers released response buffers for reuse, so pages of
+ * similar size land in memory that is already big enough. When the expected
+ * length is known (Content-Length) a buffer is sized for it once; otherwise
+ * it grows by doubling. Not thread safe: the fetch engine uses it from the
+ * thread running fetchEngineRun().
+ */
+buffer_pool_t* bufferPoolCreate(long max_buffers);
+void bufferPoolDestroy(buffer_pool_t* pool);
+
+/* Hands out an empty buffer with room for expected_size bytes, or any size when that is 0. */
+void bufferPoolAcquire(buffer_pool_t* pool, fetch_buffer_t* buffer, size_t expected_size);
+
+/* Appends data, growing the buffer geometrically; returns 0 when memory runs out. */
+int bufferPoolAppend(buffer_pool_t* pool, fetch_buffer_t* buffer, const char* data, size_t size);
+
+/* Returns the buffer to the pool, or frees it when the pool is full; buffer is left empty. */
+void bufferPoolRelease(buffer_pool_t* pool, fetch_buffer_t* buffer);
+
+void bufferPoolStats(const buffer_pool_t* pool, buffer_pool_stats_t* stats);
+
+#endif
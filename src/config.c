@@ -0,0 +1,43 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "config.h"
+
+long configLong(const char* name, long fallback) {
+	const char* value = getenv(name);
+	if (value == NULL || *value == '\0') {
+		return fallback;
+	}
+
+	char* end = NULL;
+	const long parsed = strtol(value, &end, 10);
+	if (*end != '\0') {
+		fprintf(stderr, "Ignoring invalid value '%s' for %s.\n", value, name);
+		return fallback;
+	}
+	return parsed;
+}
+
+double configDouble(const char* name, double fallback) {
+	const char* value = getenv(name);
+	if (value == NULL || *value == '\0') {
+		return fallback;
+	}
+
+	char* end = NULL;
+	const double parsed = strtod(value, &end);
+	if (*end != '\0') {
+		fprintf(stderr, "Ignoring invalid value '%s' for %s.\n", value, name);
+		return fallback;
+	}
+	return parsed;
+}
+
+const char* configString(const char* name, const char* fallback) {
+	const char* value = getenv(name);
+	if (value == NULL || *value == '\0') {
+		return fallback;
+	}
+	return value;
+}
@@ -0,0 +1,13 @@
+#ifndef ZIP_CODES_CONFIG_H
+#define ZIP_CODES_CONFIG_H
+
+/*
+ * Runtime overrides for the compile-time defaults. Each lookup reads the named
+ * environment variable and falls back to the given default when it is unset or
+ * cannot be parsed.
+ */
+long configLong(const char* name, long fallback);
+double configDouble(const char* name, double fallback);
+const char* configString(const char* name, const char* fallback);
+
+#endif
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "arena.h"
+#include "county_dict.h"
+
+#define COUNTY_DICT_ARENA_BLOCK_SIZE 16384
+#define COUNTY_DICT_INITIAL_SLOTS 256   /* power of two, kept at most half full */
+
+typedef struct CountyEntry {
+	const char* state;   /* NULL for an unused id */
+	const char* county;
+	uint32_t hash;
+} county_entry_t;
+
+struct CountyDict {
+	arena_t* arena;           /* the interned strings */
+	county_entry_t* entries;  /* indexed by id */
+	long entry_capacity;
+	county_id_t* slots;       /* open addressing over ids, 0 is empty */
+	size_t slot_count;
+	long count;
+	county_id_t max_id;
+	county_id_t saved_id;     /* ids above it are not in the counties table yet */
+};
+
+static uint32_t hashPair(const char* state, const char* county) {
+	uint32_t hash = 2166136261u;
+	for (const unsigned char* c = (const unsigned char*)state; *c; ++c) {
+		hash = (hash ^ *c) * 16777619u;
+	}
+	hash = (hash ^ ',') * 16777619u;
+	for (const unsigned char* c = (const unsigned char*)county; *c; ++c) {
+		hash = (hash ^ *c) * 16777619u;
+	}
+	return hash;
+}
+
+static const char* copyString(arena_t* arena, const char* text) {
+	const size_t size = strlen(text) + 1;
+	char* copy = (char*)arenaAlloc(arena, size);
+	memcpy(copy, text, size);
+	return copy;
+}
+
+county_dict_t* countyDictCreate(void) {
+	county_dict_t* dict = (county_dict_t*)calloc(1, sizeof(county_dict_t));
+	if (dict) {
+		dict->slots = (county_id_t*)calloc(COUNTY_DICT_INITIAL_SLOTS, sizeof(county_id_t));
+	}
+	if (!dict || !dict->slots) {
+		fprintf(stderr, "Failed to allocate the county dictionary.\n");
+		exit(EXIT_FAILURE);
+	}
+	dict->slot_count = COUNTY_DICT_INITIAL_SLOTS;
+	dict->arena = arenaCreate(COUNTY_DICT_ARENA_BLOCK_SIZE);
+	return dict;
+}
+
+void countyDictDestroy(county_dict_t* dict) {
+	if (!dict) {
+		return;
+	}
+	arenaDestroy(dict->arena);
+	free(dict->entries);
+	free(dict->slots);
+	free(dict);
+}
+
+static county_id_t* findSlot(const county_dict_t* dict, uint32_t hash, const char* state, const char* county) {
+	const size_t mask = dict->slot_count - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		const county_id_t id = dict->slots[i];
+		if (id == 0) {
+			return &dict->slots[i];
+		}
+		const county_entry_t* entry = &dict->entries[id];
+		if (entry->hash == hash && strcmp(entry->state, state) == 0 && strcmp(entry->county, county) == 0) {
+			return &dict->slots[i];
+		}
+	}
+}
+
+static void growSlots(county_dict_t* dict) {
+	const size_t slot_count = dict->slot_count * 2;
+	county_id_t* slots = (county_id_t*)calloc(slot_count, sizeof(county_id_t));
+	if (!slots) {
+		fprintf(stderr, "Failed to grow the county dictionary to %zu slots.\n", slot_count);
+		exit(EXIT_FAILURE);
+	}
+	free(dict->slots);
+	dict->slots = slots;
+	dict->slot_count = slot_count;
+	for (long id = 1; id <= dict->max_id; ++id) {
+		const county_entry_t* entry = &dict->entries[id];
+		if (entry->state) {
+			*findSlot(dict, entry->hash, entry->state, entry->county) = (county_id_t)id;
+		}
+	}
+}
+
+/* Records (state, county) under id; the caller has checked the pair is new. */
+static void addEntry(county_dict_t* dict, county_id_t id, uint32_t hash, const char* state, const char* county) {
+	if (id >= dict->entry_capacity) {
+		long capacity = dict->entry_capacity > 0 ? dict->entry_capacity : 64;
+		while (capacity <= id) {
+			capacity *= 2;
+		}
+		county_entry_t* entries = (county_entry_t*)realloc(dict->entries, (size_t)capacity * sizeof(county_entry_t));
+		if (!entries) {
+			fprintf(stderr, "Failed to grow the county dictionary to %ld entries.\n", capacity);
+			exit(EXIT_FAILURE);
+		}
+		memset(&entries[dict->entry_capacity], 0, (size_t)(capacity - dict->entry_capacity) * sizeof(county_entry_t));
+		dict->entries = entries;
+		dict->entry_capacity = capacity;
+	}
+
+	county_entry_t* entry = &dict->entries[id];
+	entry->state = copyString(dict->arena, state);
+	entry->county = copyString(dict->arena, county);
+	entry->hash = hash;
+	if (id > dict->max_id) {
+		dict->max_id = id;
+	}
+	dict->count++;
+
+	if ((size_t)dict->count * 2 > dict->slot_count) {
+		growSlots(dict);
+	} else {
+		*findSlot(dict, hash, state, county) = id;
+	}
+}
+
+county_id_t countyDictIntern(county_dict_t* dict, const char* state, const char* county) {
+	const uint32_t hash = hashPair(state, county);
+	const county_id_t* slot = findSlot(dict, hash, state, county);
+	if (*slot != 0) {
+		return *slot;
+	}
+	if (dict->max_id >= COUNTY_DICT_MAX_ID) {
+		fprintf(stderr, "More than %d counties, cannot intern %s, %s.\n", COUNTY_DICT_MAX_ID, state, county);
+		exit(EXIT_FAILURE);
+	}
+	const county_id_t id = (county_id_t)(dict->max_id + 1);
+	addEntry(dict, id, hash, state, county);
+	return id;
+}
+
+county_id_t countyDictFind(const county_dict_t* dict, const char* state, const char* county) {
+	return *findSlot(dict, hashPair(state, county), state, county);
+}
+
+static const county_entry_t* entryFor(const county_dict_t* dict, county_id_t id) {
+	return id > 0 && id <= dict->max_id && dict->entries[id].state ? &dict->entries[id] : NULL;
+}
+
+const char* countyDictState(const county_dict_t* dict, county_id_t id) {
+	const county_entry_t* entry = entryFor(dict, id);
+	return entry ? entry->state : "";
+}
+
+const char* countyDictCounty(const county_dict_t* dict, county_id_t id) {
+	const county_entry_t* entry = entryFor(dict, id);
+	return entry ? entry->county : "";
+}
+
+long countyDictCount(const county_dict_t* dict) {
+	return dict->count;
+}
+
+void countyDictLoad(county_dict_t* dict, sqlite3* db) {
+	const char* sql = "SELECT county_id, state, county FROM counties;";
+	sqlite3_stmt* stmt = NULL;
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare '%s' with error: %s\n", sql, sqlite3_errmsg(db));
+		return;
+	}
+
+	int rc;
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		const sqlite3_int64 id = sqlite3_column_int64(stmt, 0);
+		const char* state = (const char*)sqlite3_column_text(stmt, 1);
+		const char* county = (const char*)sqlite3_column_text(stmt, 2);
+		if (id < 1 || id > COUNTY_DICT_MAX_ID || !state || !county) {
+			fprintf(stderr, "Skipping counties row %lld, its id or names are out of range.\n", (long long)id);
+			continue;
+		}
+		const uint32_t hash = hashPair(state, county);
+		if (*findSlot(dict, hash, state, county) == 0 && !entryFor(dict, (county_id_t)id)) {
+			addEntry(dict, (county_id_t)id, hash, state, county);
+		}
+	}
+	if (rc != SQLITE_DONE) {
+		fprintf(stderr, "Failed to read the counties table with error: %s\n", sqlite3_errmsg(db));
+	}
+	sqlite3_finalize(stmt);
+	dict->saved_id = dict->max_id;
+}
+
+/* A county that cannot be saved would leave zip code rows pointing at no county, so the run stops. */
+static void failSave(sqlite3* db, sqlite3_stmt* stmt) {
+	sqlite3_finalize(stmt);
+	sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+	sqlite3_close(db);
+	exit(EXIT_FAILURE);
+}
+
+void countyDictSave(county_dict_t* dict, sqlite3* db) {
+	if (dict->saved_id >= dict->max_id) {
+		return;
+	}
+	const char* sql = "INSERT INTO counties ( county_id, state, county ) VALUES ( ?, ?, ? );";
+	sqlite3_stmt* stmt = NULL;
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare '%s' with error: %s\n", sql, sqlite3_errmsg(db));
+		failSave(db, stmt);
+	}
+
+	if (sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to BEGIN the counties transaction with error: %s\n", sqlite3_errmsg(db));
+		failSave(db, stmt);
+	}
+	for (long id = dict->saved_id + 1; id <= dict->max_id; ++id) {
+		const county_entry_t* entry = &dict->entries[id];
+		sqlite3_bind_int64(stmt, 1, id);
+		sqlite3_bind_text(stmt, 2, entry->state, -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 3, entry->county, -1, SQLITE_STATIC);
+		if (sqlite3_step(stmt) != SQLITE_DONE) {
+			fprintf(stderr, "Failed to insert county %s, %s with error: %s\n", entry->state, entry->county,
+				sqlite3_errmsg(db));
+			failSave(db, stmt);
+		}
+		sqlite3_reset(stmt);
+	}
+	sqlite3_finalize(stmt);
+	if (sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to COMMIT the counties with error: %s\n", sqlite3_errmsg(db));
+		failSave(db, NULL);
+	}
+	dict->saved_id = dict->max_id;
+}
@@ -0,0 +1,41 @@
+#ifndef ZIP_CODES_COUNTY_DICT_H
+#define ZIP_CODES_COUNTY_DICT_H
+
+#include <sqlite3.h>
+#include "zip_code_record.h"
+
+#define COUNTY_DICT_MAX_ID 65535   /* county_id_t is 16 bits; 0 means no county */
+
+typedef struct CountyDict county_dict_t;
+
+/*
+ * Interns (state, county) pairs as small integer ids, so lists and records
+ * carry a county_id_t instead of their own copies of both strings. Ids are
+ * the county_id keys of the counties table: countyDictLoad() reads the rows
+ * already there and countyDictSave() inserts the pairs interned since. Each
+ * string is stored once, in the dictionary's arena. Build it before starting
+ * worker threads; lookups by id are then safe from any thread.
+ */
+county_dict_t* countyDictCreate(void);
+void countyDictDestroy(county_dict_t* dict);
+
+/* Reads every row of the counties table into dict. */
+void countyDictLoad(county_dict_t* dict, sqlite3* db);
+
+/* Inserts the pairs interned since the last load or save into the counties table; exits if it cannot. */
+void countyDictSave(county_dict_t* dict, sqlite3* db);
+
+/* Returns the id of (state, county), assigning the next free one to a new pair. */
+county_id_t countyDictIntern(county_dict_t* dict, const char* state, const char* county);
+
+/* Returns the id of (state, county), or 0 when it has not been interned. */
+county_id_t countyDictFind(const county_dict_t* dict, const char* state, const char* county);
+
+/* The strings behind id, "" for an id the dictionary does not know. */
+const char* countyDictState(const county_dict_t* dict, county_id_t id);
+const char* countyDictCounty(const county_dict_t* dict, county_id_t id);
+
+/* Number of pairs interned. */
+long countyDictCount(const county_dict_t* dict);
+
+#endif
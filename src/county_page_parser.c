@@ -0,0 +1,31 @@
+#include <string.h>
+#include "county_page_parser.h"
+#include "scan.h"
+
+long countyPageParse(const char* memory, size_t size, county_page_zip_fn fn, void* ctx) {
+	static const char table_marker[] = "class=\"statTable\"";
+	static const char title_marker[] = "title=\"ZIP Code ";
+	const size_t title_length = sizeof title_marker - 1;
+	const char* end = &memory[size];
+	long count = 0;
+
+	for (const char* line = memory; line < end; line++) {
+		const char* lineEnd = scanFindByte(line, end, '\n');
+		const char* zipCodeStr = scanFindString(line, lineEnd, table_marker, sizeof table_marker - 1);
+		const char* zipCodeTitle = NULL;
+
+		if (zipCodeStr != lineEnd) {
+			while ((zipCodeTitle = scanFindString(zipCodeStr, lineEnd, title_marker, title_length)) != lineEnd) {
+				const char* digits = &zipCodeTitle[title_length];
+				char code[COUNTY_PAGE_CODE_SIZE] = {'\0'};
+				memcpy(code, digits, lineEnd - digits < 5 ? (size_t)(lineEnd - digits) : 5);
+				fn(ctx, code);
+				count++;
+
+				zipCodeStr = lineEnd - zipCodeTitle > 21 ? &zipCodeTitle[21] : lineEnd;
+			}
+		}
+		line = lineEnd;
+	}
+	return count;
+}
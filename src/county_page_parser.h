@@ -0,0 +1,18 @@
+#ifndef ZIP_CODES_COUNTY_PAGE_PARSER_H
+#define ZIP_CODES_COUNTY_PAGE_PARSER_H
+
+#include <stddef.h>
+
+#define COUNTY_PAGE_CODE_SIZE 8   /* a five digit zip code with its NUL, padded */
+
+/* Called with each zip code in page order; code is only valid during the call. */
+typedef void (*county_page_zip_fn)(void* ctx, const char* code);
+
+/*
+ * Finds the zip codes listed on a zip-codes.com county page: every
+ * title="ZIP Code NNNNN" after class="statTable" on the table's line. The
+ * page is a complete buffer, not NUL terminated. Returns the codes found.
+ */
+long countyPageParse(const char* memory, size_t size, county_page_zip_fn fn, void* ctx);
+
+#endif
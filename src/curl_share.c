@@ -0,0 +1,61 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "curl_share.h"
+
+static void lockShare(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr) {
+	(void)handle;
+	(void)access;
+	curl_share_t* share = (curl_share_t*)userptr;
+	pthread_mutex_lock(&share->locks[data]);
+}
+
+static void unlockShare(CURL* handle, curl_lock_data data, void* userptr) {
+	(void)handle;
+	curl_share_t* share = (curl_share_t*)userptr;
+	pthread_mutex_unlock(&share->locks[data]);
+}
+
+curl_share_t* curlShareCreate(void) {
+	curl_share_t* share = (curl_share_t*)malloc(sizeof(curl_share_t));
+	if (!share) {
+		fprintf(stderr, "Failed to allocate curl share.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	share->handle = curl_share_init();
+	if (!share->handle) {
+		fprintf(stderr, "Failed to initialize curl share handle.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < CURL_LOCK_DATA_LAST; ++i) {
+		pthread_mutex_init(&share->locks[i], NULL);
+	}
+
+	curl_share_setopt(share->handle, CURLSHOPT_USERDATA, (void*)share);
+	curl_share_setopt(share->handle, CURLSHOPT_LOCKFUNC, lockShare);
+	curl_share_setopt(share->handle, CURLSHOPT_UNLOCKFUNC, unlockShare);
+	curl_share_setopt(share->handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share->handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	curl_share_setopt(share->handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#if LIBCURL_VERSION_NUM >= 0x075800
+	curl_share_setopt(share->handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_HSTS);
+#endif
+	return share;
+}
+
+void curlShareDestroy(curl_share_t* share) {
+	const CURLSHcode rc = curl_share_cleanup(share->handle);
+	if (rc != CURLSHE_OK) {
+		/* Still referenced by an easy handle; leak rather than free locks in use. */
+		fprintf(stderr, "Failed to clean up curl share handle: %s\n", curl_share_strerror(rc));
+		return;
+	}
+
+	for (int i = 0; i < CURL_LOCK_DATA_LAST; ++i) {
+		pthread_mutex_destroy(&share->locks[i]);
+	}
+	free(share);
+}
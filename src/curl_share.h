@@ -0,0 +1,20 @@
+#ifndef ZIP_CODES_CURL_SHARE_H
+#define ZIP_CODES_CURL_SHARE_H
+
+#include <pthread.h>
+#include <curl/curl.h>
+
+/*
+ * A share handle holding the DNS cache, TLS session IDs, HSTS cache and connection pool,
+ * guarded by one mutex per kind of shared data so easy handles on any thread
+ * can use it. Attach handle with CURLOPT_SHARE before duplicating handles.
+ */
+typedef struct CurlShare {
+	CURLSH* handle;
+	pthread_mutex_t locks[CURL_LOCK_DATA_LAST];
+} curl_share_t;
+
+curl_share_t* curlShareCreate(void);
+void curlShareDestroy(curl_share_t* share);
+
+#endif
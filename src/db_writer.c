@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "alloc_stats.h"
+#include "config.h"
+#include "db_writer.h"
+#include "log.h"
+#include "metrics.h"
+#include "trace.h"
+
+struct DbWriter {
+	db_writer_config_t config;
+	sqlite3* db;
+	sqlite3_stmt* stmt;
+	db_write_fn write_row;
+	db_free_fn free_row;
+	void* userdata;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	void** queue;
+	long head;
+	long count;
+	int closing;
+
+	db_writer_stats_t stats;
+	double queue_depth_sum;
+	long pushes;
+};
+
+static double monotonicMs(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1e6;
+}
+
+static void deadlineAfterMs(struct timespec* deadline, double ms) {
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	const long nanos = deadline->tv_nsec + (long)(ms * 1e6);
+	deadline->tv_sec += nanos / 1000000000L;
+	deadline->tv_nsec = nanos % 1000000000L;
+}
+
+static void execOrWarn(sqlite3* db, const char* sql) {
+	char* err = NULL;
+	if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+		logWarn("Failed to %s with error: %s\n", sql, err);
+		sqlite3_free(err);
+	}
+}
+
+void dbWriterConfigInit(db_writer_config_t* config) {
+	config->queue_capacity = DB_WRITER_DEFAULT_QUEUE_CAPACITY;
+	config->batch_rows = DB_WRITER_DEFAULT_BATCH_ROWS;
+	config->batch_ms = DB_WRITER_DEFAULT_BATCH_MS;
+}
+
+void dbWriterConfigFromEnv(db_writer_config_t* config) {
+	config->queue_capacity = configLong("ZIP_DB_QUEUE", config->queue_capacity);
+	config->batch_rows = configLong("ZIP_DB_BATCH_ROWS", config->batch_rows);
+	config->batch_ms = configLong("ZIP_DB_BATCH_MS", config->batch_ms);
+}
+
+/* Waits for the next row; returns NULL once the writer is closing and drained or the deadline passed. */
+static void* popRow(db_writer_t* writer, const struct timespec* deadline) {
+	pthread_mutex_lock(&writer->lock);
+	while (writer->count == 0 && !writer->closing) {
+		if (deadline) {
+			if (pthread_cond_timedwait(&writer->not_empty, &writer->lock, deadline) == ETIMEDOUT) {
+				break;
+			}
+		} else {
+			pthread_cond_wait(&writer->not_empty, &writer->lock);
+		}
+	}
+
+	void* row = NULL;
+	if (writer->count > 0) {
+		row = writer->queue[writer->head];
+		writer->head = (writer->head + 1) % writer->config.queue_capacity;
+		writer->count--;
+		writer->stats.queue_depth = writer->count;
+		pthread_cond_signal(&writer->not_full);
+	}
+	pthread_mutex_unlock(&writer->lock);
+	return row;
+}
+
+static void writeRow(db_writer_t* writer, void* row, long* batch_rows) {
+	const double start = monotonicMs();
+	if (writer->write_row(writer->stmt, row, writer->userdata) != SQLITE_OK) {
+		writer->stats.failed_rows++;
+	}
+	const double end = monotonicMs();
+	metricsRecordSeconds(METRIC_DB_ROW, (end - start) / 1000.0);
+	traceSpan("insert", "db", start / 1000.0, end / 1000.0, NULL);
+	if (writer->free_row) {
+		writer->free_row(row);
+	}
+	(*batch_rows)++;
+}
+
+static void commitBatch(db_writer_t* writer, long batch_rows) {
+	const double start = monotonicMs();
+	execOrWarn(writer->db, "COMMIT");
+	const double elapsed = monotonicMs() - start;
+	metricsRecordSeconds(METRIC_DB_COMMIT, elapsed / 1000.0);
+	traceSpan("commit", "db", start / 1000.0, (start + elapsed) / 1000.0, NULL);
+
+	pthread_mutex_lock(&writer->lock);
+	writer->stats.rows += batch_rows;
+	writer->stats.commits++;
+	writer->stats.total_commit_ms += elapsed;
+	if (elapsed > writer->stats.max_commit_ms) {
+		writer->stats.max_commit_ms = elapsed;
+	}
+	pthread_mutex_unlock(&writer->lock);
+}
+
+static void* runWriter(void* arg) {
+	db_writer_t* writer = (db_writer_t*)arg;
+	traceThreadName("db-writer");
+	allocPhaseEnter(ALLOC_PHASE_INSERT);
+
+	/* Block for the first row of a batch, then fill it until it is full or old enough. */
+	void* row;
+	while ((row = popRow(writer, NULL)) != NULL) {
+		struct timespec deadline;
+		deadlineAfterMs(&deadline, (double)writer->config.batch_ms);
+		long batch_rows = 0;
+		const double batch_start = monotonicMs();
+
+		execOrWarn(writer->db, "BEGIN TRANSACTION");
+		writeRow(writer, row, &batch_rows);
+		while (batch_rows < writer->config.batch_rows && (row = popRow(writer, &deadline)) != NULL) {
+			writeRow(writer, row, &batch_rows);
+		}
+		commitBatch(writer, batch_rows);
+		/* Inserts and the commit nest inside the batch; gaps between batches are the writer idling. */
+		traceSpan("batch", "db", batch_start / 1000.0, monotonicMs() / 1000.0, NULL);
+	}
+	return NULL;
+}
+
+db_writer_t* dbWriterCreate(const db_writer_config_t* config, sqlite3* db, sqlite3_stmt* stmt,
+		db_write_fn write_row, db_free_fn free_row, void* userdata) {
+	db_writer_t* writer = (db_writer_t*)calloc(1, sizeof(db_writer_t));
+	if (!writer) {
+		fprintf(stderr, "Failed to allocate the database writer.\n");
+		exit(EXIT_FAILURE);
+	}
+	writer->config = *config;
+	if (writer->config.queue_capacity < 1) {
+		writer->config.queue_capacity = 1;
+	}
+	if (writer->config.batch_rows < 1) {
+		writer->config.batch_rows = 1;
+	}
+	writer->db = db;
+	writer->stmt = stmt;
+	writer->write_row = write_row;
+	writer->userdata = userdata;
+	writer->free_row = free_row;
+	writer->queue = (void**)malloc((size_t)writer->config.queue_capacity * sizeof(void*));
+	if (!writer->queue) {
+		fprintf(stderr, "Failed to allocate a database writer queue of %ld rows.\n", writer->config.queue_capacity);
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_condattr_t cond_attr;
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&writer->lock, NULL);
+	pthread_cond_init(&writer->not_empty, &cond_attr);
+	pthread_cond_init(&writer->not_full, NULL);
+	pthread_condattr_destroy(&cond_attr);
+
+	if (pthread_create(&writer->thread, NULL, runWriter, writer) != 0) {
+		fputs("Failed to start the database writer thread.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	return writer;
+}
+
+void dbWriterPush(db_writer_t* writer, void* row) {
+	pthread_mutex_lock(&writer->lock);
+	if (writer->count == writer->config.queue_capacity) {
+		writer->stats.producer_waits++;
+		while (writer->count == writer->config.queue_capacity) {
+			pthread_cond_wait(&writer->not_full, &writer->lock);
+		}
+	}
+
+	writer->queue[(writer->head + writer->count) % writer->config.queue_capacity] = row;
+	writer->count++;
+	writer->stats.queue_depth = writer->count;
+	if (writer->count > writer->stats.max_queue_depth) {
+		writer->stats.max_queue_depth = writer->count;
+	}
+	writer->queue_depth_sum += (double)writer->count;
+	writer->pushes++;
+
+	pthread_cond_signal(&writer->not_empty);
+	pthread_mutex_unlock(&writer->lock);
+}
+
+void dbWriterStats(db_writer_t* writer, db_writer_stats_t* stats) {
+	pthread_mutex_lock(&writer->lock);
+	*stats = writer->stats;
+	stats->mean_queue_depth = writer->pushes > 0 ? writer->queue_depth_sum / (double)writer->pushes : 0.0;
+	pthread_mutex_unlock(&writer->lock);
+}
+
+void dbWriterClose(db_writer_t* writer) {
+	pthread_mutex_lock(&writer->lock);
+	writer->closing = 1;
+	pthread_cond_signal(&writer->not_empty);
+	pthread_mutex_unlock(&writer->lock);
+	pthread_join(writer->thread, NULL);
+
+	db_writer_stats_t stats;
+	dbWriterStats(writer, &stats);
+	fprintf(stderr, "Wrote %ld rows (%ld failed) in %ld commits; commit latency mean %.2f ms, max %.2f ms; "
+		"queue depth mean %.1f, max %ld; producers waited on a full queue %ld times.\n",
+		stats.rows, stats.failed_rows, stats.commits,
+		stats.commits > 0 ? stats.total_commit_ms / (double)stats.commits : 0.0, stats.max_commit_ms,
+		stats.mean_queue_depth, stats.max_queue_depth, stats.producer_waits);
+
+	pthread_cond_destroy(&writer->not_full);
+	pthread_cond_destroy(&writer->not_empty);
+	pthread_mutex_destroy(&writer->lock);
+	free(writer->queue);
+	free(writer);
+}
@@ -0,0 +1,60 @@
+#ifndef ZIP_CODES_DB_WRITER_H
+#define ZIP_CODES_DB_WRITER_H
+
+#include <sqlite3.h>
+
+#define DB_WRITER_DEFAULT_QUEUE_CAPACITY 4096
+#define DB_WRITER_DEFAULT_BATCH_ROWS 512     /* rows per group commit */
+#define DB_WRITER_DEFAULT_BATCH_MS 250       /* longest a row waits for its commit */
+
+typedef struct DbWriterConfig {
+	long queue_capacity;   /* rows buffered before producers block */
+	long batch_rows;       /* commit once this many rows are in the open transaction */
+	long batch_ms;         /* or once the oldest uncommitted row is this old */
+} db_writer_config_t;
+
+/*
+ * Binds one queued row to the prepared insert and steps it, inside the
+ * writer's open transaction. userdata is the pointer given to dbWriterCreate().
+ */
+typedef int (*db_write_fn)(sqlite3_stmt* stmt, void* row, void* userdata);
+
+/* Releases a row after it was written, NULL when the caller owns the rows. */
+typedef void (*db_free_fn)(void* row);
+
+typedef struct DbWriterStats {
+	long rows;
+	long failed_rows;
+	long commits;
+	long queue_depth;        /* rows waiting right now */
+	long max_queue_depth;
+	double mean_queue_depth; /* sampled at every push */
+	long producer_waits;     /* pushes that found the queue full */
+	double total_commit_ms;
+	double max_commit_ms;
+} db_writer_stats_t;
+
+typedef struct DbWriter db_writer_t;
+
+void dbWriterConfigInit(db_writer_config_t* config);
+
+/* Applies the ZIP_DB_* environment overrides on top of the caller's defaults. */
+void dbWriterConfigFromEnv(db_writer_config_t* config);
+
+/*
+ * Starts a thread that owns db and stmt until dbWriterClose() returns. Rows
+ * pushed from any thread are written in push order inside group commits, so
+ * producers only wait on the queue, never on fsync.
+ */
+db_writer_t* dbWriterCreate(const db_writer_config_t* config, sqlite3* db, sqlite3_stmt* stmt,
+	db_write_fn write_row, db_free_fn free_row, void* userdata);
+
+/* Queues a row, blocking while the queue is full. */
+void dbWriterPush(db_writer_t* writer, void* row);
+
+void dbWriterStats(db_writer_t* writer, db_writer_stats_t* stats);
+
+/* Commits everything queued, joins the thread, prints the stats and frees the writer. */
+void dbWriterClose(db_writer_t* writer);
+
+#endif
@@ -0,0 +1,859 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "alloc_stats.h"
+#include "config.h"
+#include "curl_share.h"
+#include "fetch_engine.h"
+#include "log.h"
+#include "metrics.h"
+#include "rate_controller.h"
+#include "session_cache.h"
+#include "trace.h"
+
+#define MAX_POLL_WAIT_MS 1000
+
+typedef struct FetchRequest {
+	char* url;
+	void* userdata;
+	long attempts;      /* transfers started, hedges included */
+	long failures;
+	int hedged;
+	int skip_cache;     /* the cached payload was unusable; ask without validators */
+	int active;         /* transfers currently running for this request */
+	double not_before;  /* earliest start of the next attempt after a backoff */
+	double waiting_since;   /* queued or backed off since, for the trace */
+	struct FetchRequest* next;
+} fetch_request_t;
+
+typedef struct FetchTransfer {
+	CURL* curl;
+	fetch_request_t* request;
+	fetch_buffer_t body;      /* taken from the pool at the first body byte */
+	buffer_pool_t* buffers;
+	const fetch_stream_t* stream;
+	void* stream_state;
+	int stream_done;    /* the consumer has everything; an abort after this is a success */
+	int stop_early;
+	int revalidating;   /* sent with the cache entry's validators */
+	double parse_seconds;   /* spent in the stream consumer on this attempt */
+	uint64_t trace_id;
+	struct curl_slist* conditional;
+	double started;
+	struct FetchTransfer* next_free;
+} fetch_transfer_t;
+
+struct FetchEngine {
+	fetch_config_t config;
+	CURLM* multi;
+	curl_share_t* share;
+	CURL* template_handle;
+	fetch_complete_fn on_complete;
+	void* ctx;
+
+	fetch_request_t* queue_head;
+	fetch_request_t* queue_tail;
+	fetch_request_t* backoff;
+
+	fetch_transfer_t* transfers;
+	fetch_transfer_t* free_transfers;
+	long in_flight;
+	long new_connections;
+	long reused_connections;
+	long stopped_early;
+	curl_off_t skipped_bytes;
+
+	fetch_stream_t stream;
+	int streaming;
+	buffer_pool_t* buffers;
+	char empty_body[1];
+	response_cache_t* cache;
+	FILE* timing_log;
+
+	rate_controller_t rate;
+
+	double latencies[FETCH_LATENCY_WINDOW];
+	long latency_count;
+	double hedge_threshold;
+	unsigned int seed;
+	uint64_t trace_ids;
+};
+
+static double monotonicSeconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static size_t streamBody(fetch_transfer_t* transfer, const char* contents, size_t realsize) {
+	long response_code = 0;
+	curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &response_code);
+	if (response_code < 200 || response_code >= 300) {
+		/* Error pages are retried, not parsed. */
+		return realsize;
+	}
+	if (transfer->stream_done) {
+		return realsize;
+	}
+	const double started = monotonicSeconds();
+	const alloc_phase_t phase = allocPhaseEnter(ALLOC_PHASE_PARSE);
+	const int done = transfer->stream->feed(transfer->stream_state, contents, realsize);
+	allocPhaseEnter(phase);
+	const double finished = monotonicSeconds();
+	transfer->parse_seconds += finished - started;
+	traceSpan("parse", "parse", started, finished, transfer->request->url);
+	if (done) {
+		transfer->stream_done = 1;
+		/* On HTTP/1.1 this also closes the connection; HTTP/2 only resets the stream. */
+		return transfer->stop_early ? 0 : realsize;
+	}
+	return realsize;
+}
+
+static size_t writeCallback(void *contents, size_t size, size_t nmemb, void* userp) {
+	size_t realsize = size * nmemb;
+	fetch_transfer_t* transfer = (fetch_transfer_t*)userp;
+	if (transfer->stream) {
+		return streamBody(transfer, (const char*)contents, realsize);
+	}
+	fetch_buffer_t *buffer = &transfer->body;
+
+	if (!buffer->memory) {
+		/* Headers are in by now; a compressed Content-Length only undersizes the buffer. */
+		curl_off_t content_length = -1;
+		curl_easy_getinfo(transfer->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+		bufferPoolAcquire(transfer->buffers, buffer, content_length > 0 ? (size_t)content_length : 0);
+	}
+	return bufferPoolAppend(transfer->buffers, buffer, (const char*)contents, realsize) ? realsize : 0;
+}
+
+void fetchConfigInit(fetch_config_t* config) {
+	memset(config, 0, sizeof(fetch_config_t));
+	config->max_in_flight = 1;
+	config->max_per_host = 1;
+	config->timeout_ms = FETCH_DEFAULT_TIMEOUT_MS;
+	config->max_attempts = FETCH_DEFAULT_MAX_ATTEMPTS;
+	config->backoff_base_ms = FETCH_DEFAULT_BACKOFF_BASE_MS;
+	config->backoff_max_ms = FETCH_DEFAULT_BACKOFF_MAX_MS;
+	config->state_ttl = SESSION_CACHE_DEFAULT_TTL;
+	config->stop_early = 1;
+	config->cache_max_age = RESPONSE_CACHE_DEFAULT_MAX_AGE;
+	config->cache_max_mb = RESPONSE_CACHE_DEFAULT_MAX_MB;
+}
+
+void fetchConfigFromEnv(fetch_config_t* config) {
+	config->max_in_flight = configLong("ZIP_MAX_IN_FLIGHT", config->max_in_flight);
+	config->max_per_host = configLong("ZIP_MAX_PER_HOST", config->max_per_host);
+	config->max_requests_per_sec = configDouble("ZIP_MAX_RPS", config->max_requests_per_sec);
+	config->start_requests_per_sec = configDouble("ZIP_START_RPS", config->start_requests_per_sec);
+	config->multiplex = configLong("ZIP_MULTIPLEX", config->multiplex);
+	config->timeout_ms = configLong("ZIP_TIMEOUT_MS", config->timeout_ms);
+	config->max_attempts = configLong("ZIP_MAX_ATTEMPTS", config->max_attempts);
+	config->backoff_base_ms = configLong("ZIP_BACKOFF_BASE_MS", config->backoff_base_ms);
+	config->backoff_max_ms = configLong("ZIP_BACKOFF_MAX_MS", config->backoff_max_ms);
+	config->hedge = configLong("ZIP_HEDGE", config->hedge);
+	config->state_dir = configString("ZIP_STATE_DIR", config->state_dir);
+	config->state_ttl = configLong("ZIP_STATE_TTL", config->state_ttl);
+	config->stop_early = configLong("ZIP_STOP_EARLY", config->stop_early);
+	if (!configLong("ZIP_PERSIST_STATE", 1)) {
+		config->state_dir = NULL;
+	}
+	config->cache_dir = configString("ZIP_CACHE_DIR", config->cache_dir);
+	config->cache_max_age = configLong("ZIP_CACHE_MAX_AGE", config->cache_max_age);
+	config->cache_max_mb = configLong("ZIP_CACHE_MAX_MB", config->cache_max_mb);
+	if (!configLong("ZIP_CACHE", 1)) {
+		config->cache_dir = NULL;
+	}
+	config->timing_log = configString("ZIP_TIMING_LOG", config->timing_log);
+
+	/* "2" negotiates HTTP/2 through ALPN over https and an h2c upgrade over plain http. */
+	const char* http_version = configString("ZIP_HTTP_VERSION", NULL);
+	if (!http_version) {
+		return;
+	}
+	if (strcmp(http_version, "1.1") == 0) {
+		config->http_version = CURL_HTTP_VERSION_1_1;
+	} else if (strcmp(http_version, "2") == 0) {
+		config->http_version = CURL_HTTP_VERSION_2_0;
+	} else {
+		fprintf(stderr, "Ignoring ZIP_HTTP_VERSION=%s, expected 1.1 or 2.\n", http_version);
+	}
+}
+
+fetch_engine_t* fetchEngineCreate(const fetch_config_t* config, CURL* template_handle,
+		fetch_complete_fn on_complete, void* ctx) {
+	fetch_engine_t* engine = (fetch_engine_t*)calloc(1, sizeof(fetch_engine_t));
+	if (!engine) {
+		fprintf(stderr, "Failed to allocate fetch engine.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	engine->config = *config;
+	if (engine->config.max_in_flight < 1) {
+		engine->config.max_in_flight = 1;
+	}
+	if (engine->config.max_per_host < 1) {
+		engine->config.max_per_host = 1;
+	}
+	if (engine->config.max_attempts < 1) {
+		engine->config.max_attempts = 1;
+	}
+
+	engine->multi = curl_multi_init();
+	if (!engine->multi) {
+		fprintf(stderr, "Failed to initialize curl multi handle.\n");
+		exit(EXIT_FAILURE);
+	}
+	curl_multi_setopt(engine->multi, CURLMOPT_MAX_HOST_CONNECTIONS, engine->config.max_per_host);
+	curl_multi_setopt(engine->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, engine->config.max_in_flight);
+	if (engine->config.multiplex) {
+		/* max_in_flight then bounds the streams sharing each connection. */
+		curl_multi_setopt(engine->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+		curl_multi_setopt(engine->multi, CURLMOPT_MAX_CONCURRENT_STREAMS, engine->config.max_in_flight);
+	} else {
+		curl_multi_setopt(engine->multi, CURLMOPT_PIPELINING, CURLPIPE_NOTHING);
+	}
+
+	/* Every duplicate inherits the share, so DNS, TLS sessions and connections are pooled. */
+	engine->share = curlShareCreate();
+	curl_easy_setopt(template_handle, CURLOPT_SHARE, engine->share->handle);
+	sessionCacheLoad(template_handle, engine->config.state_dir, engine->config.state_ttl);
+	engine->template_handle = template_handle;
+	engine->on_complete = on_complete;
+	engine->ctx = ctx;
+
+	engine->buffers = bufferPoolCreate(engine->config.max_in_flight);
+	if (engine->config.cache_dir) {
+		engine->cache = responseCacheCreate(engine->config.cache_dir, engine->config.cache_max_age,
+			engine->config.cache_max_mb);
+	}
+	if (engine->config.timing_log && !(engine->timing_log = fopen(engine->config.timing_log, "a"))) {
+		fprintf(stderr, "Failed to open timing log '%s': %s\n", engine->config.timing_log, strerror(errno));
+	}
+	engine->transfers = (fetch_transfer_t*)calloc((size_t)engine->config.max_in_flight,
+		sizeof(fetch_transfer_t));
+	if (!engine->transfers) {
+		fprintf(stderr, "Failed to allocate fetch transfer slots.\n");
+		exit(EXIT_FAILURE);
+	}
+	for (long i = engine->config.max_in_flight - 1; i >= 0; --i) {
+		engine->transfers[i].next_free = engine->free_transfers;
+		engine->free_transfers = &engine->transfers[i];
+	}
+
+	rate_controller_config_t rate_config;
+	rate_config.initial_rate = engine->config.start_requests_per_sec;
+	rate_config.max_rate = engine->config.max_requests_per_sec;
+	rate_config.min_rate = RATE_MIN_REQUESTS_PER_SEC;
+	rateControllerInit(&engine->rate, &rate_config, monotonicSeconds());
+
+	engine->seed = (unsigned int)time(NULL) ^ (unsigned int)(size_t)engine;
+	return engine;
+}
+
+void fetchEngineSetStream(fetch_engine_t* engine, const fetch_stream_t* stream) {
+	engine->stream = *stream;
+	engine->streaming = 1;
+	if (!stream->save || !stream->restore) {
+		responseCacheDestroy(engine->cache);
+		engine->cache = NULL;
+	}
+	for (long i = 0; i < engine->config.max_in_flight; ++i) {
+		engine->transfers[i].stream_state = malloc(stream->state_size);
+		if (!engine->transfers[i].stream_state) {
+			fprintf(stderr, "Failed to allocate stream state.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+void fetchEngineAdd(fetch_engine_t* engine, const char* url, void* userdata) {
+	fetch_request_t* request = (fetch_request_t*)calloc(1, sizeof(fetch_request_t));
+	if (!request) {
+		fprintf(stderr, "Failed to allocate fetch request for %s.\n", url);
+		exit(EXIT_FAILURE);
+	}
+	request->url = strdup(url);
+	request->userdata = userdata;
+	request->waiting_since = monotonicSeconds();
+
+	if (engine->queue_tail) {
+		engine->queue_tail->next = request;
+	} else {
+		engine->queue_head = request;
+	}
+	engine->queue_tail = request;
+}
+
+static void freeRequest(fetch_request_t* request) {
+	free(request->url);
+	free(request);
+}
+
+/* If-None-Match and If-Modified-Since echo the validators exactly as the server sent them. */
+static struct curl_slist* conditionalHeaders(const response_cache_validators_t* validators) {
+	struct curl_slist* headers = NULL;
+	char header[RESPONSE_CACHE_VALIDATOR_SIZE + 32];
+	if (validators->etag[0]) {
+		snprintf(header, sizeof header, "If-None-Match: %s", validators->etag);
+		headers = curl_slist_append(headers, header);
+	}
+	if (validators->last_modified[0]) {
+		snprintf(header, sizeof header, "If-Modified-Since: %s", validators->last_modified);
+		struct curl_slist* appended = curl_slist_append(headers, header);
+		if (!appended) {
+			curl_slist_free_all(headers);
+		}
+		headers = appended;
+	}
+	return headers;
+}
+
+static void startTransfer(fetch_engine_t* engine, fetch_request_t* request, double now) {
+	fetch_transfer_t* transfer = engine->free_transfers;
+	engine->free_transfers = transfer->next_free;
+
+	if (!transfer->curl) {
+		transfer->curl = curl_easy_duphandle(engine->template_handle);
+		if (!transfer->curl) {
+			fprintf(stderr, "Failed to duplicate curl handle.\n");
+			exit(EXIT_FAILURE);
+		}
+		if (engine->config.multiplex) {
+			/* Wait for a stream on an existing connection instead of opening another. */
+			curl_easy_setopt(transfer->curl, CURLOPT_PIPEWAIT, 1L);
+		}
+		if (engine->config.timeout_ms > 0) {
+			curl_easy_setopt(transfer->curl, CURLOPT_TIMEOUT_MS, engine->config.timeout_ms);
+		}
+		if (engine->config.http_version > 0) {
+			curl_easy_setopt(transfer->curl, CURLOPT_HTTP_VERSION, engine->config.http_version);
+		}
+		/* Set per handle: duplicating a handle that already has an HSTS file list double-frees it. */
+		sessionCacheAttach(transfer->curl, engine->config.state_dir);
+	}
+
+	if (request->active == 0) {
+		/* Hedges start while the request is already running; only a waiting request has a wait to show. */
+		traceAsyncSpan(request->failures > 0 ? "backoff" : "queued", "queue", ++engine->trace_ids,
+			request->waiting_since, now, request->url);
+	}
+	transfer->request = request;
+	transfer->trace_id = ++engine->trace_ids;
+	transfer->started = now;
+	memset(&transfer->body, 0, sizeof(fetch_buffer_t));
+	transfer->buffers = engine->buffers;
+	transfer->stream = engine->streaming ? &engine->stream : NULL;
+	transfer->stream_done = 0;
+	transfer->parse_seconds = 0.0;
+	transfer->stop_early = engine->config.stop_early != 0;
+	if (transfer->stream) {
+		transfer->stream->begin(transfer->stream_state, request->userdata);
+	}
+
+	curl_slist_free_all(transfer->conditional);
+	transfer->conditional = NULL;
+	transfer->revalidating = 0;
+	response_cache_validators_t validators;
+	if (engine->cache && !request->skip_cache && responseCacheLookup(engine->cache, request->url, &validators)) {
+		transfer->conditional = conditionalHeaders(&validators);
+		transfer->revalidating = transfer->conditional != NULL;
+	}
+	curl_easy_setopt(transfer->curl, CURLOPT_HTTPHEADER, transfer->conditional);
+
+	curl_easy_setopt(transfer->curl, CURLOPT_URL, request->url);
+	curl_easy_setopt(transfer->curl, CURLOPT_WRITEFUNCTION, writeCallback);
+	curl_easy_setopt(transfer->curl, CURLOPT_WRITEDATA, (void*)transfer);
+	curl_easy_setopt(transfer->curl, CURLOPT_PRIVATE, (void*)transfer);
+
+	logDebug("Fetching url %s\n", request->url);
+	curl_multi_add_handle(engine->multi, transfer->curl);
+	engine->in_flight++;
+	request->active++;
+	request->attempts++;
+}
+
+static void releaseTransfer(fetch_engine_t* engine, fetch_transfer_t* transfer) {
+	curl_multi_remove_handle(engine->multi, transfer->curl);
+	engine->in_flight--;
+	transfer->request->active--;
+
+	bufferPoolRelease(engine->buffers, &transfer->body);
+	transfer->request = NULL;
+
+	transfer->next_free = engine->free_transfers;
+	engine->free_transfers = transfer;
+}
+
+/* Moves requests whose backoff has expired to the front of the queue. */
+static void promoteRetries(fetch_engine_t* engine, double now) {
+	fetch_request_t** link = &engine->backoff;
+	while (*link) {
+		fetch_request_t* request = *link;
+		if (request->not_before > now) {
+			link = &request->next;
+			continue;
+		}
+		*link = request->next;
+		request->next = engine->queue_head;
+		engine->queue_head = request;
+		if (!engine->queue_tail) {
+			engine->queue_tail = request;
+		}
+	}
+}
+
+static void startTransfers(fetch_engine_t* engine) {
+	const double now = monotonicSeconds();
+	promoteRetries(engine, now);
+	while (engine->queue_head && engine->free_transfers && rateControllerTryAcquire(&engine->rate, now)) {
+		fetch_request_t* request = engine->queue_head;
+		engine->queue_head = request->next;
+		if (!engine->queue_head) {
+			engine->queue_tail = NULL;
+		}
+		request->next = NULL;
+		startTransfer(engine, request, now);
+	}
+}
+
+static int compareDoubles(const void* a, const void* b) {
+	const double x = *(const double*)a;
+	const double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void recordLatency(fetch_engine_t* engine, double seconds) {
+	engine->latencies[engine->latency_count % FETCH_LATENCY_WINDOW] = seconds;
+	engine->latency_count++;
+	if (!engine->config.hedge || engine->latency_count < FETCH_HEDGE_MIN_SAMPLES) {
+		return;
+	}
+
+	const long samples = engine->latency_count < FETCH_LATENCY_WINDOW
+		? engine->latency_count : FETCH_LATENCY_WINDOW;
+	double sorted[FETCH_LATENCY_WINDOW];
+	memcpy(sorted, engine->latencies, (size_t)samples * sizeof(double));
+	qsort(sorted, (size_t)samples, sizeof(double), compareDoubles);
+	engine->hedge_threshold = sorted[(long)(FETCH_HEDGE_PERCENTILE * (double)(samples - 1))];
+}
+
+/* Starts a duplicate of any lone transfer that has outlived the p95 latency. */
+static void startHedges(fetch_engine_t* engine) {
+	if (!engine->config.hedge || engine->hedge_threshold <= 0) {
+		return;
+	}
+
+	const double now = monotonicSeconds();
+	for (long i = 0; i < engine->config.max_in_flight && engine->free_transfers; ++i) {
+		fetch_transfer_t* transfer = &engine->transfers[i];
+		fetch_request_t* request = transfer->request;
+		if (!request || request->hedged || request->active > 1) {
+			continue;
+		}
+		if (now - transfer->started < engine->hedge_threshold) {
+			continue;
+		}
+		if (!rateControllerTryAcquire(&engine->rate, now)) {
+			return;
+		}
+		logInfo("Hedging %s after %.0f ms.\n", request->url, (now - transfer->started) * 1000.0);
+		request->hedged = 1;
+		startTransfer(engine, request, now);
+	}
+}
+
+static long msUntilHedge(fetch_engine_t* engine, double now) {
+	long wait_ms = MAX_POLL_WAIT_MS;
+	if (!engine->config.hedge || engine->hedge_threshold <= 0 || !engine->free_transfers) {
+		return wait_ms;
+	}
+	for (long i = 0; i < engine->config.max_in_flight; ++i) {
+		fetch_transfer_t* transfer = &engine->transfers[i];
+		if (!transfer->request || transfer->request->hedged) {
+			continue;
+		}
+		const long ms = (long)((transfer->started + engine->hedge_threshold - now) * 1000.0) + 1;
+		if (ms < wait_ms) {
+			wait_ms = ms < 0 ? 0 : ms;
+		}
+	}
+	return wait_ms;
+}
+
+static int isRetryable(CURLcode code, long response_code) {
+	if (code != CURLE_OK) {
+		return 1;
+	}
+	return response_code == 408 || response_code == 429 || response_code >= 500;
+}
+
+static long backoffMs(fetch_engine_t* engine, long failures, long retry_after) {
+	long ceiling = engine->config.backoff_base_ms;
+	for (long i = 1; i < failures && ceiling < engine->config.backoff_max_ms; ++i) {
+		ceiling *= 2;
+	}
+	if (ceiling > engine->config.backoff_max_ms) {
+		ceiling = engine->config.backoff_max_ms;
+	}
+
+	long delay = ceiling > 0 ? (long)(rand_r(&engine->seed) % (ceiling + 1)) : 0;
+	if (retry_after * 1000 > delay) {
+		delay = retry_after * 1000;
+	}
+	return delay;
+}
+
+static void deliver(fetch_engine_t* engine, fetch_transfer_t* transfer, fetch_result_t* result) {
+	result->url = transfer->request->url;
+	result->attempts = transfer->request->attempts;
+	/* Bodies that never received a byte, streamed ones included, are handed over as "". */
+	fetch_buffer_t empty = { engine->empty_body, 0, 0 };
+	engine->empty_body[0] = '\0';
+	result->body = transfer->body.memory ? &transfer->body : &empty;
+	result->stream_state = transfer->stream ? transfer->stream_state : NULL;
+	result->userdata = transfer->request->userdata;
+	if (engine->timing_log) {
+		fprintf(engine->timing_log, "%.6f %ld %d %s\n", result->total_time, result->response_code,
+			result->success, result->url);
+	}
+	engine->on_complete(result, engine->ctx);
+}
+
+static void headerValue(CURL* curl, const char* name, char* value, size_t size) {
+	value[0] = '\0';
+#if LIBCURL_VERSION_NUM >= 0x075400
+	struct curl_header* header = NULL;
+	if (curl_easy_header(curl, name, 0, CURLH_HEADER, -1, &header) == CURLHE_OK) {
+		snprintf(value, size, "%s", header->value);
+	}
+#else
+	(void)curl;
+	(void)name;
+	(void)size;
+#endif
+}
+
+/* Keeps a successful response's body, or its stream's saved state, for the next run to revalidate. */
+static void storeInCache(fetch_engine_t* engine, fetch_transfer_t* transfer) {
+	response_cache_validators_t validators;
+	headerValue(transfer->curl, "ETag", validators.etag, sizeof validators.etag);
+	headerValue(transfer->curl, "Last-Modified", validators.last_modified, sizeof validators.last_modified);
+	const char* url = transfer->request->url;
+	if (!transfer->stream) {
+		responseCacheStore(engine->cache, url, &validators,
+			transfer->body.memory ? transfer->body.memory : "", transfer->body.size);
+		return;
+	}
+
+	char saved[FETCH_STREAM_SAVE_MAX];
+	const size_t size = transfer->stream->save(transfer->stream_state, saved, sizeof saved);
+	if (size > 0 && size <= sizeof saved) {
+		responseCacheStore(engine->cache, url, &validators, saved, size);
+	}
+}
+
+/* Answers a 304 with the body, or the stream state, of the entry whose validators were sent. */
+static int loadFromCache(fetch_engine_t* engine, fetch_transfer_t* transfer) {
+	const char* url = transfer->request->url;
+	bufferPoolRelease(engine->buffers, &transfer->body);
+	if (!transfer->stream) {
+		return responseCacheRead(engine->cache, url, engine->buffers, &transfer->body);
+	}
+
+	fetch_buffer_t saved;
+	if (!responseCacheRead(engine->cache, url, engine->buffers, &saved)) {
+		return 0;
+	}
+	const int restored = transfer->stream->restore(transfer->stream_state, saved.memory, saved.size);
+	bufferPoolRelease(engine->buffers, &saved);
+	return restored;
+}
+
+/*
+ * curl's phase times are cumulative from the start of the transfer; each
+ * histogram gets the time of its own phase. Reused connections report no
+ * lookup or connect, so those phases are only recorded when one was opened.
+ */
+static void recordTimings(CURL* curl, CURLcode code, long response_code, long num_connects) {
+	curl_off_t lookup = 0;
+	curl_off_t connect = 0;
+	curl_off_t tls = 0;
+	curl_off_t pretransfer = 0;
+	curl_off_t first_byte = 0;
+	curl_off_t total = 0;
+	curl_off_t downloaded = 0;
+	curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &lookup);
+	curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+	curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+	curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+	curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+	curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+	curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+
+	if (num_connects > 0 && connect > 0) {
+		metricsRecord(METRIC_DNS, (uint64_t)lookup);
+		metricsRecord(METRIC_CONNECT, (uint64_t)(connect - lookup));
+		if (tls > connect) {
+			metricsRecord(METRIC_TLS, (uint64_t)(tls - connect));
+		}
+	}
+	if (first_byte > 0) {
+		metricsRecord(METRIC_FIRST_BYTE, (uint64_t)first_byte);
+		metricsRecord(METRIC_SERVER_WAIT, (uint64_t)(first_byte > pretransfer ? first_byte - pretransfer : 0));
+	}
+	metricsRecord(METRIC_TOTAL, (uint64_t)total);
+	metricsRecord(METRIC_RESPONSE_BYTES, (uint64_t)downloaded);
+	metricsRecordStatus(code == CURLE_OK || response_code > 0 ? response_code : 0);
+}
+
+static void finishTransfer(fetch_engine_t* engine, CURL* curl, CURLcode code) {
+	fetch_transfer_t* transfer = NULL;
+	curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**)&transfer);
+	fetch_request_t* request = transfer->request;
+	const double now = monotonicSeconds();
+
+	if (code == CURLE_WRITE_ERROR && transfer->stream_done && transfer->stop_early) {
+		/* The stream consumer had what it needed; the rest of the body was never downloaded. */
+		code = CURLE_OK;
+		engine->stopped_early++;
+		curl_off_t content_length = -1;
+		curl_off_t downloaded = 0;
+		curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+		curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+		if (content_length > downloaded) {
+			engine->skipped_bytes += content_length - downloaded;
+		}
+	}
+
+	fetch_result_t result;
+	memset(&result, 0, sizeof(result));
+	result.result = code;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &result.response_code);
+	curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &result.total_time);
+	curl_off_t retry_after = 0;
+	if (curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retry_after) == CURLE_OK) {
+		result.retry_after = (long)retry_after;
+	}
+	long num_connects = 0;
+	curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &num_connects);
+	if (num_connects > 0) {
+		engine->new_connections += num_connects;
+	} else if (code == CURLE_OK) {
+		engine->reused_connections++;
+	}
+	recordTimings(curl, code, result.response_code, num_connects);
+	traceAsyncSpan(request->active > 1 ? "fetch (hedged)" : "fetch", "fetch", transfer->trace_id,
+		transfer->started, now, request->url);
+	result.success = code == CURLE_OK && result.response_code >= 200 && result.response_code < 300;
+	if (code == CURLE_OK && result.response_code == 304 && transfer->revalidating) {
+		if (!loadFromCache(engine, transfer)) {
+			logWarn("Cached copy of %s is unusable, fetching it again in full.\n", request->url);
+			responseCacheRemove(engine->cache, request->url);
+			request->skip_cache = 1;
+			request->waiting_since = now;
+			releaseTransfer(engine, transfer);
+			if (request->active == 0) {
+				request->next = engine->queue_head;
+				engine->queue_head = request;
+				if (!engine->queue_tail) {
+					engine->queue_tail = request;
+				}
+			}
+			return;
+		}
+		result.success = 1;
+		result.not_modified = 1;
+	}
+
+	rateControllerOnResponse(&engine->rate, code, result.response_code, result.total_time,
+		result.retry_after, now);
+
+	if (result.success) {
+		recordLatency(engine, result.total_time);
+
+		/* First answer wins; drop any hedge still running for the same request. */
+		for (long i = 0; i < engine->config.max_in_flight && request->active > 1; ++i) {
+			if (&engine->transfers[i] != transfer && engine->transfers[i].request == request) {
+				releaseTransfer(engine, &engine->transfers[i]);
+			}
+		}
+
+		if (transfer->stream && !transfer->stream_done && !result.not_modified) {
+			const double started = monotonicSeconds();
+			const alloc_phase_t phase = allocPhaseEnter(ALLOC_PHASE_PARSE);
+			transfer->stream->end(transfer->stream_state);
+			allocPhaseEnter(phase);
+			const double finished = monotonicSeconds();
+			transfer->parse_seconds += finished - started;
+			traceSpan("parse", "parse", started, finished, request->url);
+		}
+		if (transfer->stream && !result.not_modified) {
+			metricsRecordSeconds(METRIC_PARSE, transfer->parse_seconds);
+		}
+		if (engine->cache && !result.not_modified) {
+			storeInCache(engine, transfer);
+		}
+		deliver(engine, transfer, &result);
+		releaseTransfer(engine, transfer);
+		freeRequest(request);
+		return;
+	}
+
+	if (code != CURLE_OK) {
+		logWarn("curl transfer of %s failed: %s\n", request->url, curl_easy_strerror(code));
+	} else {
+		logWarn("HTTP %ld from %s\n", result.response_code, request->url);
+	}
+
+	if (request->active > 1) {
+		/* A hedge for this request is still running and may yet succeed. */
+		releaseTransfer(engine, transfer);
+		return;
+	}
+
+	request->failures++;
+	if (isRetryable(code, result.response_code) && request->failures < engine->config.max_attempts) {
+		const long delay_ms = backoffMs(engine, request->failures, result.retry_after);
+		logWarn("Retrying %s in %ld ms (attempt %ld of %ld).\n", request->url, delay_ms,
+			request->failures + 1, engine->config.max_attempts);
+
+		releaseTransfer(engine, transfer);
+		request->hedged = 0;
+		request->not_before = now + (double)delay_ms / 1000.0;
+		request->waiting_since = now;
+		request->next = engine->backoff;
+		engine->backoff = request;
+		return;
+	}
+
+	logError("Giving up on %s after %ld attempts.\n", request->url, request->attempts);
+	deliver(engine, transfer, &result);
+	releaseTransfer(engine, transfer);
+	freeRequest(request);
+}
+
+static long msUntilRetry(fetch_engine_t* engine, double now) {
+	long wait_ms = MAX_POLL_WAIT_MS;
+	for (fetch_request_t* request = engine->backoff; request != NULL; request = request->next) {
+		const long ms = (long)((request->not_before - now) * 1000.0) + 1;
+		if (ms < wait_ms) {
+			wait_ms = ms < 0 ? 0 : ms;
+		}
+	}
+	return wait_ms;
+}
+
+void fetchEngineRun(fetch_engine_t* engine) {
+	int running = 0;
+	while (engine->queue_head || engine->backoff || engine->in_flight > 0) {
+		startTransfers(engine);
+		startHedges(engine);
+
+		CURLMcode mc = curl_multi_perform(engine->multi, &running);
+		if (mc != CURLM_OK) {
+			fprintf(stderr, "curl_multi_perform() failed: %s\n", curl_multi_strerror(mc));
+			break;
+		}
+
+		CURLMsg* msg;
+		int msgs_left = 0;
+		while ((msg = curl_multi_info_read(engine->multi, &msgs_left))) {
+			if (msg->msg == CURLMSG_DONE) {
+				finishTransfer(engine, msg->easy_handle, msg->data.result);
+			}
+		}
+
+		if (!engine->queue_head && !engine->backoff && engine->in_flight == 0) {
+			break;   /* the last transfer just finished; polling now would only sit out the timeout */
+		}
+
+		/* Wake up for socket activity, curl's own timers, the next rate token, a retry or a hedge. */
+		const double now = monotonicSeconds();
+		long wait_ms = msUntilRetry(engine, now);
+		if (engine->queue_head && engine->free_transfers) {
+			const long token_ms = rateControllerWaitMs(&engine->rate, now);
+			if (token_ms < wait_ms) {
+				wait_ms = token_ms;
+			}
+		}
+		const long hedge_ms = msUntilHedge(engine, now);
+		if (hedge_ms < wait_ms) {
+			wait_ms = hedge_ms;
+		}
+		if (engine->in_flight == 0 && wait_ms == 0) {
+			continue;
+		}
+
+		mc = curl_multi_poll(engine->multi, NULL, 0, (int)wait_ms, NULL);
+		if (mc != CURLM_OK) {
+			fprintf(stderr, "curl_multi_poll() failed: %s\n", curl_multi_strerror(mc));
+			break;
+		}
+	}
+
+	const long transfers = engine->new_connections + engine->reused_connections;
+	fprintf(stderr, "Opened %ld connections; %ld of %ld transfers reused one (%.1f%%).\n",
+		engine->new_connections, engine->reused_connections, transfers,
+		transfers > 0 ? 100.0 * (double)engine->reused_connections / (double)transfers : 0.0);
+	if (engine->streaming) {
+		fprintf(stderr, "Stopped %ld transfers early once their fields were parsed, skipping %ld bytes.\n",
+			engine->stopped_early, (long)engine->skipped_bytes);
+	}
+
+	buffer_pool_stats_t buffers;
+	bufferPoolStats(engine->buffers, &buffers);
+	if (buffers.acquired > 0) {
+		fprintf(stderr, "Response buffers: %ld of %ld reused from the pool (%.1f%%), %ld sized from "
+			"Content-Length, %ld grown copying %zu of %zu bytes received.\n",
+			buffers.reused, buffers.acquired, 100.0 * (double)buffers.reused / (double)buffers.acquired,
+			buffers.presized, buffers.grown, buffers.bytes_copied, buffers.bytes_appended);
+	}
+
+	if (engine->cache) {
+		responseCacheTrim(engine->cache);
+		response_cache_stats_t cache;
+		responseCacheStats(engine->cache, &cache);
+		fprintf(stderr, "Response cache: %ld of %ld requests revalidated with a 304 (%.1f%%) from %zu cached bytes, "
+			"%ld entries changed, %ld stored, %ld evicted.\n", cache.revalidated, cache.lookups,
+			cache.lookups > 0 ? 100.0 * (double)cache.revalidated / (double)cache.lookups : 0.0,
+			cache.bytes_served, cache.changed, cache.stored, cache.evicted);
+	}
+}
+
+static void freeRequestList(fetch_request_t* request) {
+	while (request != NULL) {
+		fetch_request_t* next = request->next;
+		freeRequest(request);
+		request = next;
+	}
+}
+
+void fetchEngineDestroy(fetch_engine_t* engine) {
+	for (long i = 0; i < engine->config.max_in_flight; ++i) {
+		if (engine->transfers[i].curl) {
+			curl_easy_cleanup(engine->transfers[i].curl);
+		}
+		free(engine->transfers[i].stream_state);
+		curl_slist_free_all(engine->transfers[i].conditional);
+	}
+	free(engine->transfers);
+	bufferPoolDestroy(engine->buffers);
+	responseCacheDestroy(engine->cache);
+	if (engine->timing_log) {
+		fclose(engine->timing_log);
+	}
+
+	freeRequestList(engine->queue_head);
+	freeRequestList(engine->backoff);
+
+	curl_multi_cleanup(engine->multi);
+	sessionCacheSave(engine->template_handle, engine->config.state_dir);
+	curl_easy_cleanup(engine->template_handle);
+	curlShareDestroy(engine->share);
+	free(engine);
+}
@@ -0,0 +1,104 @@
+#ifndef ZIP_CODES_FETCH_ENGINE_H
+#define ZIP_CODES_FETCH_ENGINE_H
+
+#include <curl/curl.h>
+#include "buffer_pool.h"
+#include "response_cache.h"
+
+#define FETCH_DEFAULT_TIMEOUT_MS 30000
+#define FETCH_DEFAULT_MAX_ATTEMPTS 4
+#define FETCH_DEFAULT_BACKOFF_BASE_MS 500
+#define FETCH_DEFAULT_BACKOFF_MAX_MS 30000
+#define FETCH_HEDGE_PERCENTILE 0.95
+#define FETCH_HEDGE_MIN_SAMPLES 20
+#define FETCH_LATENCY_WINDOW 256
+#define FETCH_STREAM_SAVE_MAX 4096   /* largest stream state kept in the response cache */
+
+typedef struct FetchResult {
+	const char* url;
+	int success;            /* transfer completed with a 2xx response, or a 304 served from the cache */
+	int not_modified;       /* the body or stream state came from the response cache */
+	CURLcode result;
+	long response_code;
+	double total_time;
+	long retry_after;
+	long attempts;
+	fetch_buffer_t* body;   /* empty when the engine streams bodies, see fetch_stream_t */
+	void* stream_state;
+	void* userdata;
+} fetch_result_t;
+
+/*
+ * Called on the thread running fetchEngineRun() once per request, either with
+ * the first successful response or after the retry budget is spent. The body
+ * buffer is owned by the engine and is only valid during the call, after which
+ * it goes back to the engine's buffer pool; its memory is NUL terminated and
+ * may be modified in place.
+ */
+typedef void (*fetch_complete_fn)(fetch_result_t* result, void* ctx);
+
+/*
+ * Optional incremental body consumer. Every transfer owns state_size bytes of
+ * consumer state: begin() resets it when an attempt starts, feed() receives
+ * 2xx body bytes as they arrive and returns nonzero once it has everything it
+ * needs, which stops the download early, and end() flushes any partial input
+ * once the whole body has arrived. The winning attempt's state is handed to
+ * the completion callback as result->stream_state.
+ *
+ * A streamed body is usually cut short, so the response cache cannot keep it.
+ * When save() and restore() are given the cache keeps the parsed state instead:
+ * save() writes what a later run needs into out and returns its size, or 0 to
+ * keep nothing, and restore() rebuilds the state from those bytes on a 304,
+ * returning 0 if it cannot. Without them a streaming engine does not cache.
+ */
+typedef struct FetchStream {
+	size_t state_size;
+	void (*begin)(void* state, void* userdata);
+	int (*feed)(void* state, const char* data, size_t size);
+	void (*end)(void* state);
+	size_t (*save)(const void* state, char* out, size_t capacity);
+	int (*restore)(void* state, const char* data, size_t size);
+} fetch_stream_t;
+
+typedef struct FetchConfig {
+	long max_in_flight;           /* transfers handed to curl at any one time */
+	long max_per_host;            /* connections per host, one transfer each unless multiplexed */
+	double max_requests_per_sec;  /* ceiling for the adaptive start rate, <= 0 for unlimited */
+	double start_requests_per_sec;
+	long multiplex;               /* run transfers as HTTP/2 streams on shared connections */
+	long timeout_ms;              /* per-attempt deadline, CURLOPT_TIMEOUT_MS */
+	long max_attempts;            /* attempts per request before giving up */
+	long backoff_base_ms;         /* first retry delay, doubled per failure, with full jitter */
+	long backoff_max_ms;
+	long hedge;                   /* duplicate requests that outlive the p95 latency */
+	const char* state_dir;        /* TLS session, alt-svc and HSTS cache kept between runs */
+	long state_ttl;               /* seconds a saved TLS session is reused for */
+	long stop_early;              /* abort a streamed body once its consumer is done */
+	const char* cache_dir;        /* response cache revalidated with ETag/Last-Modified, NULL for none */
+	long cache_max_age;           /* seconds an entry is trusted without a 304 confirming it */
+	long cache_max_mb;            /* the cache is trimmed to this size after each run */
+	long http_version;            /* CURL_HTTP_VERSION_* for every transfer, 0 keeps the template's */
+	const char* timing_log;       /* appends "seconds status success url" per delivered request, or NULL */
+} fetch_config_t;
+
+typedef struct FetchEngine fetch_engine_t;
+
+/* Fills the retry policy defaults; callers then set the fields they care about. */
+void fetchConfigInit(fetch_config_t* config);
+
+/* Applies the ZIP_* environment overrides on top of the caller's defaults. */
+void fetchConfigFromEnv(fetch_config_t* config);
+
+/*
+ * Every transfer runs on a duplicate of template_handle, so callers configure
+ * user agent, TLS and protocol options once. The engine takes ownership of it.
+ */
+fetch_engine_t* fetchEngineCreate(const fetch_config_t* config, CURL* template_handle,
+	fetch_complete_fn on_complete, void* ctx);
+/* Switches the engine to streaming bodies through stream; call before fetchEngineRun(). */
+void fetchEngineSetStream(fetch_engine_t* engine, const fetch_stream_t* stream);
+void fetchEngineAdd(fetch_engine_t* engine, const char* url, void* userdata);
+void fetchEngineRun(fetch_engine_t* engine);
+void fetchEngineDestroy(fetch_engine_t* engine);
+
+#endif
@@ -6,30 +6,84 @@
 #include <string.h>
 #include <unistd.h>
 #include <sqlite3.h>
+#include "alloc_stats.h"
+#include "arena.h"
+#include "config.h"
+#include "county_dict.h"
+#include "county_page_parser.h"
+#include "db_writer.h"
+#include "fetch_engine.h"
+#include "log.h"
+#include "metrics.h"
+#include "progress.h"
+#include "replay.h"
+#include "trace.h"
+#include "zip_code_db.h"
 
 #define INPUT_FILE_NAME "../data/county-list.csv"
 #define OUTPUT_FILE_NAME "../data/zip-codes-list.csv"
+#define FETCH_STATE_DIR "../data/.fetch-state"
+#define HTTP_CACHE_DIR "../data/.http-cache"
+#define METRICS_PREFIX "../data/get-zip-codes-metrics"
 #define SQLITE3_DB_NAME "../data/zip_codes_db.sqlite3"
 #define BASE_URL "https://www.zip-codes.com/county/"
 #define URL_SUFFIX ".asp"
 
+/* County pages are fetched as HTTP/2 streams over a single connection. */
+#define DEFAULT_MULTIPLEX 1
+#define DEFAULT_MAX_STREAMS 16
+#define DEFAULT_MAX_CONNECTIONS 1
+#define DEFAULT_START_REQUESTS_PER_SEC 1.0
+#define DEFAULT_MAX_REQUESTS_PER_SEC 10.0
+
+#define COUNTY_ARENA_BLOCK_SIZE 65536
+#define PAGE_ARENA_BLOCK_SIZE 16384   /* a county page rarely lists more than 150 zip codes */
+#define DEFAULT_RESUME 1   /* skip the counties an earlier run finished */
+
 typedef struct CountyNode {
-	char state[8];
-	char county[64];
+	county_id_t county_id;
 	struct CountyNode* next;
 } county_node_t;
 
+typedef struct ZipCodeNode zip_code_node_t;
+
+/*
+ * One county of the input list. Pages finish in whatever order the responses
+ * arrive, so each is held in its slot until every county before it has been
+ * written, which keeps the CSV in input order.
+ */
+typedef struct CountySlot {
+	county_id_t county_id;
+	char* stored_csv;         /* the CSV rows of a county an earlier run finished */
+	zip_code_node_t* page;    /* the parsed page's list head, NULL when there is none */
+	int finished;             /* fetched, failed, stored or missing: ready to write in turn */
+} county_slot_t;
+
 typedef struct {
-  char *memory;
-  size_t size;
-} memory_t;
-
-typedef struct ZipCodeNode {
-	char state[8];
-	char county[64];
-	char code[8];
+	db_writer_t* writer;
+	FILE* output_file;
+	const county_dict_t* counties;   /* complete before the first fetch, read only after */
+	arena_stats_t page_arenas;   /* summed on the writer thread as pages are released */
+	county_slot_t* slots;        /* every county in input order */
+	long slot_count;
+	long next_slot;              /* the first county not yet written */
+} county_sink_t;
+
+/* The zip code nodes parsed from one county page, and the arena they live in. */
+typedef struct CountyPage {
+	arena_t* arena;
+	long pending;   /* nodes queued for the writer; only the writer thread changes it after the pushes */
+	county_sink_t* sink;
+	county_id_t county_id;
+	int failed;     /* the fetch failed; the page only carries that to the progress table */
+} county_page_t;
+
+struct ZipCodeNode {
+	county_id_t county_id;
+	char code[COUNTY_PAGE_CODE_SIZE];
+	county_page_t* page;
 	struct ZipCodeNode* next;
-} zip_code_node_t;
+};
 
 static FILE* openInputFile() {
 	FILE* input_file = fopen(INPUT_FILE_NAME, "r");
@@ -78,13 +132,18 @@ static void commitTransaction(sqlite3** db) {
 }
 
 static void initDb(sqlite3** db) {
+	char *error_message = NULL;
+	if (sqlite3_exec(*db, COUNTIES_CREATE_STMT, NULL, NULL, &error_message) != SQLITE_OK) {
+		fprintf(stderr, "Failed to create the counties table: %s\n", error_message);
+		sqlite3_free(error_message);
+		sqlite3_close(*db);
+		exit( EXIT_FAILURE );
+	}
+	dbMigrateCountyColumns(*db, "zip_codes_by_county", ZIP_CODES_BY_COUNTY_CREATE_STMT);
+
 	beginTransaction(db);
 	fprintf(stderr, "About to create the table named 'zip_codes'.\n");
-	char *error_message = NULL;
-	const char *create_stmt = "CREATE TABLE IF NOT EXISTS zip_codes_by_county ( "
-		"zip_code INTEGER PRIMARY KEY, "
-		"state TEXT, "
-		"county TEXT );";
+	const char *create_stmt = ZIP_CODES_BY_COUNTY_CREATE_STMT;
 	const int rc = sqlite3_exec(*db, create_stmt, NULL, NULL, &error_message);
 	if (rc != SQLITE_OK ) {
 		fputs("Failed to create table.\n", stderr);
@@ -98,31 +157,34 @@ static void initDb(sqlite3** db) {
 	}
 }
 
-static void doInsert(sqlite3** db, char stmt[]) {
-	char* err = NULL;
-	fprintf(stderr, "running insert statement = '%s'\n", stmt);
-	const int rc = sqlite3_exec(*db, stmt, NULL, NULL, &err);
-	if ( rc != SQLITE_OK ) {
-		fprintf(stderr, "Failed to exec insert stmt '%s' with error: %s.\n", stmt, err);
-		sqlite3_free(err);
-	}
-}
-
-static void loadLinkedList(FILE* input_file, county_node_t *head) {
+/*
+ * Counties are interned in the form their URL uses, spaces as dashes, which
+ * is how zip_codes_by_county has always stored them.
+ */
+static void loadLinkedList(FILE* input_file, arena_t* arena, county_dict_t* counties, county_node_t *head) {
 	char buf[128];
-	memset(head->state, 0, sizeof head->state);
-	memset(head->county, 0, sizeof head->county);
+	head->county_id = 0;
+	head->next = NULL;
 
 	for (county_node_t *current = head; fgets(buf, sizeof buf, input_file) != NULL;) {
+		char state[ZIP_CODE_STATE_SIZE] = {'\0'};
+		char county[ZIP_CODE_COUNTY_SIZE] = {'\0'};
 		char* comma_start = strstr(buf, ",");
-		strncpy(current->county, &comma_start[1], strlen(&comma_start[1]) - 1);
-		strncpy(current->state, buf, strlen(buf) - strlen(comma_start));
-		county_node_t *next = (county_node_t*)malloc(sizeof(county_node_t));
-                next->next = NULL;
-		memset(next->state, 0, sizeof next->state);
-		memset(next->county, 0, sizeof next->county);
+		if (comma_start && comma_start - buf < ZIP_CODE_STATE_SIZE) {
+			memcpy(state, buf, (size_t)(comma_start - buf));
+			snprintf(county, sizeof county, "%.*s", (int)strcspn(&comma_start[1], "\r\n"), &comma_start[1]);
+			for (char* c = county; *c; ++c) {
+				*c = *c == ' ' ? '-' : *c;
+			}
+		}
+		if (state[0] && county[0]) {
+			current->county_id = countyDictIntern(counties, state, county);
+		}
+		county_node_t *next = (county_node_t*)arenaAlloc(arena, sizeof(county_node_t));
+		next->county_id = 0;
+		next->next = NULL;
 
-		fprintf(stderr, "state, county = %s, %s\n", current->state, current->county);
+		logDebug("state, county = %s, %s\n", state, county);
 
 		current->next = next;
 		memset(buf, 0, sizeof buf);
@@ -130,49 +192,16 @@ static void loadLinkedList(FILE* input_file, county_node_t *head) {
 	}
 }
 
-static void freeLinkedList(county_node_t *head) {
-	county_node_t *next;
-        county_node_t *current = head;
-	for (; current->next != NULL; current = next) {
-		next = current->next;
-		free(current);
-	}
-        free(current);
-}
-
-static char* buildUrl(char* state, char* county) {
-	char *dest = (char*)calloc(128, sizeof(char));
-	strcpy(dest, BASE_URL);
+static char* buildUrl(const char* base_url, const char* state, const char* county) {
+	char *dest = (char*)calloc(strlen(base_url) + 128, sizeof(char));
+	strcpy(dest, base_url);
 	strcat(dest, state);
 	strcat(dest, "-");
-
-	for (size_t i = 0; i < strlen(county); ++i) {
-		if (county[i] == ' ') {
-			county[i] = '-';
-		}
-	}
 	strcat(dest, county);
 	strcat(dest, URL_SUFFIX);
 	return dest;
 }
 
-static size_t writeCallback(void *contents, size_t size, size_t nmemb, void* userp) {
-	size_t realsize = size * nmemb;
-	memory_t *memory = (memory_t*)userp;
-
-	char *ptr = realloc(memory->memory, memory->size + realsize + 1);
-	if (ptr == NULL) {
-		fprintf(stderr, "Insufficient memory to reallocate. realloc() returned NULL.\n");
-		return 0;
-	}
-
-	memory->memory = ptr;
-	memcpy(&(memory->memory[memory->size]), contents, realsize);
-	memory->size += realsize;
-	memory->memory[memory->size] = 0;
-	return realsize;
-}
-
 static CURL* initCurl() {
 	curl_global_init(CURL_GLOBAL_ALL);
 	CURL* curl = curl_easy_init();
@@ -190,133 +219,366 @@ static CURL* initCurl() {
     curl_easy_setopt(curl, CURLOPT_TCP_FASTOPEN, 1L);
     curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 0);
     curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2_0);
+
+#ifdef SKIP_PEER_VERIFICATION
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+#endif
+#ifdef SKIP_HOSTNAME_VERIFICATION
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+#endif
 	return curl;
 }
 
-static void initZipCodeNode(zip_code_node_t *node) {
+static void initZipCodeNode(zip_code_node_t *node, county_page_t* page) {
+	node->page = page;
 	node->next = NULL;
-	memset(node->state, 0, sizeof node->state);
-	memset(node->county, 0, sizeof node->county);
+	node->county_id = 0;
 	memset(node->code, 0, sizeof node->code);
 }
 
-static void processChunk(char* memory, char state[], char county[], zip_code_node_t *zipHead) {
-	char* token;
-	char* rest = memory;
+typedef struct CountyPageList {
+	county_id_t county_id;
+	county_page_t* page;
+	zip_code_node_t* current;
+} county_page_list_t;
+
+static void appendZipCode(void* ctx, const char* code) {
+	county_page_list_t* list = (county_page_list_t*)ctx;
+	list->current->county_id = list->county_id;
+	strcpy(list->current->code, code);
+
+	zip_code_node_t *next = (zip_code_node_t*)arenaAlloc(list->page->arena, sizeof(zip_code_node_t));
+	initZipCodeNode(next, list->page);
+	list->current->next = next;
+	list->current = next;
+}
 
-	zip_code_node_t *current = zipHead;
+static void processChunk(const char* memory, size_t size, county_id_t county_id, county_page_t* page,
+		zip_code_node_t *zipHead) {
+	county_page_list_t list;
+	list.county_id = county_id;
+	list.page = page;
+	list.current = zipHead;
+	countyPageParse(memory, size, appendZipCode, &list);
+}
 
-	while ((token = strtok_r(rest, "\n", &rest))) {
-		char* zipCodeStr = strstr(token, "class=\"statTable\"");
-		char* zipCodeTitle = NULL;
+/*
+ * The last node written for a page also records its county's progress, in the
+ * same transaction. A page with no zip codes queues just its empty head node
+ * so that it is recorded too.
+ */
+static int insertZipCodeNode(sqlite3_stmt* stmt, void* row, void* userdata) {
+	zip_code_node_t *node = (zip_code_node_t*)row;
+	county_page_t* page = node->page;
+	int rc = SQLITE_OK;
+	if (node->code[0] != '\0') {
+		rc = insertCountyZip(stmt, node->code, node->county_id);
+	}
+	if (page->pending == 1 && rc == SQLITE_OK) {
+		rc = progressMark((progress_t*)userdata, page->county_id, page->failed ? PROGRESS_FAILED : PROGRESS_DONE);
+	}
+	return rc;
+}
 
-		if (zipCodeStr != NULL) {
-			while((zipCodeTitle = strstr(zipCodeStr, "title=\"ZIP Code "))) {
-				char code[8] = {'\0'};
-				strncpy(code, &zipCodeTitle[16], 5);
-				strcpy(current->state, state);
-				strcpy(current->county, county);
-				strcpy(current->code, code);
+static void releasePage(county_page_t* page) {
+	county_sink_t* sink = page->sink;
+	arenaStatsAdd(&sink->page_arenas, arenaStats(page->arena));
+	arenaDestroy(page->arena);
+}
+
+/* Called by the writer once a node is inserted; the last node of a page frees the whole page. */
+static void releaseZipCodeNode(void* row) {
+	county_page_t* page = ((zip_code_node_t*)row)->page;
+	if (--page->pending == 0) {
+		releasePage(page);
+	}
+}
 
-				zip_code_node_t *next = (zip_code_node_t*)malloc(sizeof(zip_code_node_t));
-				initZipCodeNode(next);
-				current->next = next;
-				current = next;
+/*
+ * Nodes with a code are handed to the database writer, or the empty head
+ * alone when the page has none. Once the last one is pushed the page may be
+ * gone, so nothing in it is touched after that push.
+ */
+static void writeZipCodes(county_sink_t* sink, county_page_t* page, zip_code_node_t *zipCodesHead) {
+	const double started = traceClock();
+	const alloc_phase_t phase = allocPhaseEnter(ALLOC_PHASE_EXPORT);
+	const county_id_t county_id = zipCodesHead->county_id;
+	long count = 0;
+	for (zip_code_node_t *curZip = zipCodesHead; curZip != NULL; curZip = curZip->next) {
+		count += curZip->code[0] != '\0';
+	}
+	if (count == 0) {
+		page->pending = 1;
+		dbWriterPush(sink->writer, zipCodesHead);
+		allocPhaseEnter(phase);
+		return;
+	}
 
-				zipCodeStr = &zipCodeTitle[21];
-			}
+	page->pending = count;
+	for (zip_code_node_t *curZip = zipCodesHead; count > 0;) {
+		zip_code_node_t *next = curZip->next;
+		if (curZip->code[0] != '\0') {
+			fprintf(sink->output_file, "\"%s\",\"%s\",\"%s\"\n", countyDictState(sink->counties, curZip->county_id),
+				countyDictCounty(sink->counties, curZip->county_id), curZip->code);
+			count--;
+			dbWriterPush(sink->writer, curZip);
 		}
+		curZip = next;
 	}
+	traceSpan("write csv", "csv", started, traceClock(), countyDictCounty(sink->counties, county_id));
+	allocPhaseEnter(phase);
 }
 
-static void getUrl(CURL* curl, const char* url, char state[], char county[], zip_code_node_t *zipHead) {
-	CURLcode res;
-	memory_t *chunk = (memory_t*)malloc(sizeof(memory_t));
-	chunk->memory = (char*)malloc(1);
-	chunk->size = 0;
-	curl_easy_setopt(curl, CURLOPT_URL, url);
+/* A county page in an arena of its own, with the empty head node of its zip code list. */
+static zip_code_node_t* newCountyPage(county_sink_t* sink, county_id_t county_id) {
+	arena_t* arena = arenaCreate(PAGE_ARENA_BLOCK_SIZE);
+	county_page_t* page = (county_page_t*)arenaAlloc(arena, sizeof(county_page_t));
+	page->arena = arena;
+	page->pending = 0;
+	page->sink = sink;
+	page->county_id = county_id;
+	page->failed = 0;
+
+	zip_code_node_t *zipCodesHead = (zip_code_node_t*)arenaAlloc(arena, sizeof(zip_code_node_t));
+	initZipCodeNode(zipCodesHead, page);
+	return zipCodesHead;
+}
 
-#ifdef SKIP_PEER_VERIFICATION
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-#endif
-#ifdef SKIP_HOSTNAME_VERIFICATION
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-#endif
+/*
+ * A county finished by an earlier run is written to the CSV from the database
+ * instead of fetched again. Its rows are read before the database writer
+ * starts and kept until the county's turn comes.
+ */
+static char* loadStoredZipCodes(county_sink_t* sink, sqlite3_stmt* select_stmt, county_id_t county_id) {
+	char* csv = NULL;
+	size_t size = 0;
+	FILE* out = open_memstream(&csv, &size);
+	if (!out) {
+		fprintf(stderr, "Failed to buffer the stored zip codes of county %s.\n",
+			countyDictCounty(sink->counties, county_id));
+		exit(EXIT_FAILURE);
+	}
+	sqlite3_bind_int64(select_stmt, 1, county_id);
+	while (sqlite3_step(select_stmt) == SQLITE_ROW) {
+		fprintf(out, "\"%s\",\"%s\",\"%05lld\"\n", countyDictState(sink->counties, county_id),
+			countyDictCounty(sink->counties, county_id), (long long)sqlite3_column_int64(select_stmt, 0));
+	}
+	sqlite3_reset(select_stmt);
+	fclose(out);
+	return csv;
+}
 
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)chunk);
+/* Writes every finished county at the front of the input order; the rest wait for the ones before them. */
+static void writeFinishedCounties(county_sink_t* sink) {
+	for (; sink->next_slot < sink->slot_count && sink->slots[sink->next_slot].finished; sink->next_slot++) {
+		county_slot_t* slot = &sink->slots[sink->next_slot];
+		if (slot->stored_csv) {
+			fputs(slot->stored_csv, sink->output_file);
+			free(slot->stored_csv);
+			slot->stored_csv = NULL;
+		} else if (slot->page) {
+			writeZipCodes(sink, slot->page->page, slot->page);
+			slot->page = NULL;
+		}
+	}
+}
 
-	res = curl_easy_perform(curl);
-	if (res != CURLE_OK) {
-		fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+/* Parses one county page into a zip code list in an arena of its own and returns the list's head. */
+static zip_code_node_t* parseCountyPage(county_sink_t* sink, county_id_t county_id, const char* memory,
+		size_t size) {
+	const double started = metricsClock();
+	const alloc_phase_t phase = allocPhaseEnter(ALLOC_PHASE_PARSE);
+	zip_code_node_t *zipCodesHead = newCountyPage(sink, county_id);
+	county_page_t* page = zipCodesHead->page;
+	processChunk(memory, size, county_id, page, zipCodesHead);
+	const double finished = metricsClock();
+	metricsRecordSeconds(METRIC_PARSE, finished - started);
+	traceSpan("parse", "parse", started, finished, countyDictCounty(sink->counties, county_id));
+	allocPhaseEnter(phase);
+	return zipCodesHead;
+}
+
+/* Pages are parsed as they complete but written in input order. */
+static void onCountyFetched(fetch_result_t* result, void* ctx) {
+	county_slot_t* slot = (county_slot_t*)result->userdata;
+	county_sink_t* sink = (county_sink_t*)ctx;
+	if (!result->success) {
+		logError("Failed to fetch county %s, %s after %ld attempts.\n",
+			countyDictState(sink->counties, slot->county_id), countyDictCounty(sink->counties, slot->county_id),
+			result->attempts);
+		zip_code_node_t *marker = newCountyPage(sink, slot->county_id);
+		marker->page->failed = 1;
+		marker->page->pending = 1;
+		dbWriterPush(sink->writer, marker);
+	} else {
+		slot->page = parseCountyPage(sink, slot->county_id, result->body->memory, result->body->size);
 	}
+	slot->finished = 1;
+	writeFinishedCounties(sink);
+}
 
-	processChunk(chunk->memory, state, county, zipHead);
+typedef struct CountyReplay {
+	county_sink_t* sink;
+	county_slot_t** slots;
+} county_replay_t;
 
-	free(chunk->memory);
-	free(chunk);
+/* Runs on a replay thread; the lists are written in county order once all pages are parsed. */
+static void replayCountyPage(void* ctx, long index, const char* data, size_t size) {
+	county_replay_t* replay = (county_replay_t*)ctx;
+	county_slot_t* slot = replay->slots[index];
+	slot->page = parseCountyPage(replay->sink, slot->county_id, data, size);
+}
+
+static void replayCountyPages(const char* path, county_sink_t* sink, const char* const* urls,
+		county_slot_t** slots, long count) {
+	replay_corpus_t* corpus = replayCorpusOpen(path);
+	if (!corpus) {
+		exit(EXIT_FAILURE);
+	}
+	county_replay_t replay;
+	replay.sink = sink;
+	replay.slots = slots;
+
+	replay_stats_t stats;
+	replayRun(corpus, urls, count, configLong("ZIP_REPLAY_THREADS", 0), replayCountyPage, &replay, &stats);
+	replayStatsPrint(&stats);
+	for (long i = 0; i < count; ++i) {
+		slots[i]->finished = 1;
+	}
+	writeFinishedCounties(sink);
+	replayCorpusClose(corpus);
 }
 
 int main(void) {
+	metricsStart("get-zip-codes", METRICS_PREFIX);
+	traceStart();
+	logStart();
 	FILE * input_file = openInputFile();
 	FILE * output_file = openOutputFile();
 	sqlite3* db = NULL;
 	openDb(&db);
 	initDb(&db);
 
-	county_node_t *head = (county_node_t*)malloc(sizeof(county_node_t));
-	loadLinkedList(input_file, head);
+	db_bulk_load_config_t bulk_config;
+	db_durable_settings_t durable_settings;
+	dbBulkLoadConfigInit(&bulk_config);
+	dbBulkLoadConfigFromEnv(&bulk_config);
+	dbBeginBulkLoad(db, &bulk_config, "zip_codes_by_county", &durable_settings);
+
+	/* Counties live for the whole run; each county page's zip codes get an arena of their own. */
+	allocPhaseEnter(ALLOC_PHASE_LIST_LOAD);
+	arena_t* county_arena = arenaCreate(COUNTY_ARENA_BLOCK_SIZE);
+	county_dict_t* counties = countyDictCreate();
+	countyDictLoad(counties, db);
+	county_node_t *head = (county_node_t*)arenaAlloc(county_arena, sizeof(county_node_t));
+	loadLinkedList(input_file, county_arena, counties, head);
+	countyDictSave(counties, db);
+	fprintf(stderr, "%ld counties in the dictionary.\n", countyDictCount(counties));
 	CURL* curl = initCurl();
 
-	for (county_node_t *current = head; current->next != NULL; current = current->next) {
-		zip_code_node_t *zipCodesHead = (zip_code_node_t*)malloc(sizeof(zip_code_node_t));
-		initZipCodeNode(zipCodesHead);
+	sqlite3_stmt* insert_stmt = prepareCountyZipInsert(db);
+	db_writer_config_t writer_config;
+	dbWriterConfigInit(&writer_config);
+	dbWriterConfigFromEnv(&writer_config);
 
-		fprintf(stderr, "state = \"%s\"\n", current->state);
-		fprintf(stderr, "county = \"%s\"\n", current->county);
+	county_sink_t sink;
+	memset(&sink, 0, sizeof sink);
+	sink.output_file = output_file;
+	sink.counties = counties;
 
-                if (strlen(current->state) < 1 || strlen(current->county) < 1) {
-                    printf("breaking out of the loop\n");
-                    break;
-                }
-
-		char* url = buildUrl(current->state, current->county);
-		getUrl(curl, url, current->state, current->county, zipCodesHead);
-		free(url);
+	/* ZIP_RESUME=0 forgets the progress of earlier runs and fetches every county again. */
+	progress_t* progress = progressOpen(db, "county", configLong("ZIP_RESUME", DEFAULT_RESUME) != 0);
+	sqlite3_stmt* select_stmt = prepareCountyZipSelect(db);
+	long resumed = 0;
 
-		beginTransaction(&db);
-		const char insert_fmt[] = "INSERT INTO zip_codes_by_county VALUES ( %s, \"%s\", \"%s\" );";
+	long county_count = 0;
+	for (county_node_t *current = head; current->next != NULL; current = current->next) {
+		county_count++;
+	}
+	const char** urls = (const char**)arenaAlloc(county_arena, (size_t)county_count * sizeof(const char*));
+	county_slot_t** fetch_slots = (county_slot_t**)arenaAlloc(county_arena,
+		(size_t)county_count * sizeof(county_slot_t*));
+	sink.slots = (county_slot_t*)arenaAlloc(county_arena, (size_t)county_count * sizeof(county_slot_t));
+	memset(sink.slots, 0, (size_t)county_count * sizeof(county_slot_t));
+
+	const char* base_url = configString("ZIP_BASE_URL", BASE_URL);
+	county_count = 0;
+	for (county_node_t *current = head; current->next != NULL; current = current->next) {
+		const char* state = countyDictState(counties, current->county_id);
+		const char* county = countyDictCounty(counties, current->county_id);
+		logDebug("state = \"%s\"\n", state);
+		logDebug("county = \"%s\"\n", county);
 
-		zip_code_node_t *curZip;
-		for (curZip = zipCodesHead; curZip != NULL;) {
-			if (strlen(curZip->code) > 0) {
-				fprintf(output_file, "\"%s\",\"%s\",\"%s\"\n",
-					curZip->state, curZip->county, curZip->code);
+                if (current->county_id == 0) {
+                    logDebug("breaking out of the loop\n");
+                    break;
+                }
 
-                                char insert_stmt[64] = {'\0'};
-				sprintf(insert_stmt, insert_fmt, curZip->code, curZip->state, curZip->county );
-				doInsert(&db, insert_stmt);
-			}
-			zip_code_node_t *last = curZip;
-			curZip = curZip->next;
-			free(last);
+		county_slot_t* slot = &sink.slots[sink.slot_count++];
+		slot->county_id = current->county_id;
+		if (progressIsDone(progress, current->county_id)) {
+			slot->stored_csv = loadStoredZipCodes(&sink, select_stmt, current->county_id);
+			slot->finished = 1;
+			resumed++;
+			continue;
 		}
 
-		free(curZip);
-		commitTransaction(&db);
-
-		if (current->next->next == NULL) {
-			break;
+		char* url = buildUrl(base_url, state, county);
+		char* kept = (char*)arenaAlloc(county_arena, strlen(url) + 1);
+		strcpy(kept, url);
+		free(url);
+		urls[county_count] = kept;
+		fetch_slots[county_count] = slot;
+		county_count++;
+	}
+	sqlite3_finalize(select_stmt);
+	if (resumed > 0) {
+		fprintf(stderr, "Resuming: %ld counties were finished by an earlier run.\n", resumed);
+	}
+	sink.writer = dbWriterCreate(&writer_config, db, insert_stmt, insertZipCodeNode, releaseZipCodeNode, progress);
+	writeFinishedCounties(&sink);
+
+	/* ZIP_REPLAY parses saved county pages from a directory or tar instead of the site. */
+	allocPhaseEnter(ALLOC_PHASE_FETCH);
+	const char* replay_path = configString("ZIP_REPLAY", NULL);
+	if (replay_path) {
+		replayCountyPages(replay_path, &sink, urls, fetch_slots, county_count);
+		curl_easy_cleanup(curl);
+	} else {
+		fetch_config_t fetch_config;
+		fetchConfigInit(&fetch_config);
+		fetch_config.multiplex = DEFAULT_MULTIPLEX;
+		fetch_config.max_in_flight = DEFAULT_MAX_STREAMS;
+		fetch_config.max_per_host = DEFAULT_MAX_CONNECTIONS;
+		fetch_config.max_requests_per_sec = DEFAULT_MAX_REQUESTS_PER_SEC;
+		fetch_config.start_requests_per_sec = DEFAULT_START_REQUESTS_PER_SEC;
+		fetch_config.state_dir = FETCH_STATE_DIR;
+		fetch_config.cache_dir = HTTP_CACHE_DIR;
+		fetchConfigFromEnv(&fetch_config);
+		fetch_engine_t* engine = fetchEngineCreate(&fetch_config, curl, onCountyFetched, &sink);
+		for (long i = 0; i < county_count; ++i) {
+			fetchEngineAdd(engine, urls[i], fetch_slots[i]);
 		}
-
-		usleep(1000000);
+		fetchEngineRun(engine);
+		fetchEngineDestroy(engine);
+		writeFinishedCounties(&sink);
 	}
-
-	curl_easy_cleanup(curl);
 	curl_global_cleanup();
-	freeLinkedList(head);
 
+	allocPhaseEnter(ALLOC_PHASE_INSERT);
+	dbWriterClose(sink.writer);
+	arenaStatsPrint("County list", arenaStats(county_arena));
+	arenaStatsPrint("Zip code pages", &sink.page_arenas);
+	arenaDestroy(county_arena);
+	countyDictDestroy(counties);
+	dbEndBulkLoad(db, &bulk_config, "zip_codes_by_county", &durable_settings);
+	sqlite3_finalize(insert_stmt);
+	progressClose(progress);
 	sqlite3_close(db);
+	allocPhaseEnter(ALLOC_PHASE_OTHER);
 	fclose(input_file);
 	fclose(output_file);
+	metricsStop();
+	traceStop();
+	logStop();
 }
@@ -0,0 +1,608 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*
+ * End-to-end load harness. Starts two mock-servers, one serving generated
+ * county pages and one serving the city-data fixtures, then runs
+ * get-zip-codes and read_list against them once per concurrency setting. Each
+ * run gets a fresh working directory: get-zip-codes fills its database from
+ * the county pages and read_list then fetches every zip code it found. For
+ * each tool and setting the harness reports zips/sec, p50/p99 page latency
+ * from the fetch engine's timing log, CPU time and peak RSS.
+ */
+
+#define DEFAULT_CONCURRENCY "1,2,4,8,16,32"
+#define DEFAULT_COUNTIES 40
+#define DEFAULT_ZIPS_PER_COUNTY 25
+#define DEFAULT_PORT 18080
+#define DEFAULT_FIXTURES "../fixtures"
+#define COUNTY_TEMPLATE "county/wy-laramie.asp"
+#define ZIP_FALLBACK "82001.html"
+#define FIRST_ZIP_CODE 10000
+/* read_list insists on its legacy input list even though it reads the zip codes from the database. */
+#define ZIP_LIST_FILE "zip_code_list_ca_el_dorado.txt"
+#define MAX_SWEEP 32
+#define SERVER_START_MS 5000
+
+typedef struct {
+	const char* bin_dir;
+	const char* fixtures;
+	const char* work_dir;
+	long concurrency[MAX_SWEEP];
+	int sweep_count;
+	long counties;
+	long zips_per_county;
+	int port;
+	const char* http_version;   /* "1.1" or "2" */
+	double max_rps;             /* client rate limit, 0 for none */
+	const char* county_url;     /* overrides: skip starting that mock-server */
+	const char* zip_url;
+	const char* server_args[24];   /* passed through to both mock-servers */
+	int server_arg_count;
+	int json;
+	int keep;
+} harness_config_t;
+
+typedef struct {
+	const char* tool;
+	long concurrency;
+	long pages;        /* delivered successfully */
+	long failed;
+	long zips;
+	double seconds;
+	double p50_ms;
+	double p99_ms;
+	double cpu_seconds;
+	double peak_rss_mb;
+} run_result_t;
+
+static pid_t servers[2];
+static int server_count;
+static const char* temp_work_dir;   /* removed at exit; NULL with -K or -w */
+
+static double monotonicSeconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static void stopServers(void) {
+	for (int i = 0; i < server_count; ++i) {
+		kill(servers[i], SIGTERM);
+		waitpid(servers[i], NULL, 0);
+	}
+	server_count = 0;
+}
+
+static void removeWorkDir(void) {
+	if (!temp_work_dir) {
+		return;
+	}
+	char command[1100];
+	snprintf(command, sizeof command, "rm -rf '%s'", temp_work_dir);
+	if (system(command) != 0) {
+		fprintf(stderr, "Failed to remove %s.\n", temp_work_dir);
+	}
+	temp_work_dir = NULL;
+}
+
+static void usage(const char* program) {
+	fprintf(stderr, "Usage: %s [-c 1,2,4,...] [-n counties] [-k zips_per_county] [-H 1.1|2] [-R max_rps]\n"
+		"\t[-l latency_ms] [-j jitter_ms] [-D uniform|exponential|pareto] [-e error_rate] [-E error_status]\n"
+		"\t[-r retry_after] [-t throttle_rps] [-u zip_base_url] [-U county_base_url] [-b bin_dir]\n"
+		"\t[-x fixtures_dir] [-w work_dir] [-p port] [-f text|json] [-K]\n", program);
+	exit(EXIT_FAILURE);
+}
+
+static void addServerArg(harness_config_t* config, const char* flag, const char* value) {
+	if (config->server_arg_count + 2 >= (int)(sizeof config->server_args / sizeof config->server_args[0])) {
+		return;
+	}
+	config->server_args[config->server_arg_count++] = flag;
+	config->server_args[config->server_arg_count++] = value;
+}
+
+static void parseSweep(harness_config_t* config, const char* list, const char* program) {
+	config->sweep_count = 0;
+	for (const char* c = list; *c && config->sweep_count < MAX_SWEEP;) {
+		char* end = NULL;
+		const long value = strtol(c, &end, 10);
+		if (end == c || value < 1) {
+			usage(program);
+		}
+		config->concurrency[config->sweep_count++] = value;
+		c = *end == ',' ? &end[1] : end;
+	}
+}
+
+static void parseArgs(int argc, char* argv[], harness_config_t* config) {
+	static char bin_dir[1024];
+	memset(config, 0, sizeof(harness_config_t));
+	snprintf(bin_dir, sizeof bin_dir, "%s", argv[0]);
+	char* slash = strrchr(bin_dir, '/');
+	if (slash) {
+		*slash = '\0';
+	} else {
+		snprintf(bin_dir, sizeof bin_dir, ".");
+	}
+	config->bin_dir = bin_dir;
+	config->fixtures = DEFAULT_FIXTURES;
+	config->counties = DEFAULT_COUNTIES;
+	config->zips_per_county = DEFAULT_ZIPS_PER_COUNTY;
+	config->port = DEFAULT_PORT;
+	config->http_version = "1.1";
+	parseSweep(config, DEFAULT_CONCURRENCY, argv[0]);
+
+	int opt;
+	while ((opt = getopt(argc, argv, "c:n:k:H:R:l:j:D:e:E:r:t:u:U:b:x:w:p:f:K")) != -1) {
+		switch (opt) {
+		case 'c': parseSweep(config, optarg, argv[0]); break;
+		case 'n': config->counties = atol(optarg); break;
+		case 'k': config->zips_per_county = atol(optarg); break;
+		case 'H': config->http_version = optarg; break;
+		case 'R': config->max_rps = atof(optarg); break;
+		case 'l': addServerArg(config, "-l", optarg); break;
+		case 'j': addServerArg(config, "-j", optarg); break;
+		case 'D': addServerArg(config, "-D", optarg); break;
+		case 'e': addServerArg(config, "-e", optarg); break;
+		case 'E': addServerArg(config, "-E", optarg); break;
+		case 'r': addServerArg(config, "-r", optarg); break;
+		case 't': addServerArg(config, "-t", optarg); break;
+		case 'u': config->zip_url = optarg; break;
+		case 'U': config->county_url = optarg; break;
+		case 'b': config->bin_dir = optarg; break;
+		case 'x': config->fixtures = optarg; break;
+		case 'w': config->work_dir = optarg; break;
+		case 'p': config->port = atoi(optarg); break;
+		case 'f': config->json = strcmp(optarg, "json") == 0; break;
+		case 'K': config->keep = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (strcmp(config->http_version, "1.1") != 0 && strcmp(config->http_version, "2") != 0) {
+		usage(argv[0]);
+	}
+	if (config->counties < 1 || config->zips_per_county < 1
+			|| FIRST_ZIP_CODE + config->counties * config->zips_per_county > 99999) {
+		fprintf(stderr, "Counties times zips per county must stay below %d.\n", 99999 - FIRST_ZIP_CODE);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static char* readFile(const char* path, size_t* size) {
+	FILE* fp = fopen(path, "rb");
+	if (!fp) {
+		fprintf(stderr, "File %s not found. Exiting...\n", path);
+		exit(EXIT_FAILURE);
+	}
+	fseek(fp, 0, SEEK_END);
+	const long length = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	char* data = (char*)malloc((size_t)length + 1);
+	*size = fread(data, 1, (size_t)length, fp);
+	data[*size] = '\0';
+	fclose(fp);
+	return data;
+}
+
+static void makeDir(const char* path) {
+	if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*
+ * Writes one page per county from the template fixture, its zip code table
+ * replaced by zips_per_county codes no other county has, the county list
+ * get-zip-codes reads and the zip code list read_list reads.
+ */
+static void writeCountyPages(const harness_config_t* config) {
+	char path[1024];
+	size_t size = 0;
+	snprintf(path, sizeof path, "%s/" COUNTY_TEMPLATE, config->fixtures);
+	char* template_page = readFile(path, &size);
+	char* table = strstr(template_page, "class=\"statTable\"");
+	if (!table) {
+		fprintf(stderr, "%s has no zip code table.\n", path);
+		exit(EXIT_FAILURE);
+	}
+	while (table > template_page && table[-1] != '\n') {
+		table--;
+	}
+	const char* after = strchr(table, '\n');
+	after = after ? &after[1] : &template_page[size];
+
+	snprintf(path, sizeof path, "%s/counties", config->work_dir);
+	makeDir(path);
+	snprintf(path, sizeof path, "%s/county-list.csv", config->work_dir);
+	FILE* list = fopen(path, "w");
+	if (!list) {
+		fprintf(stderr, "Failed to write %s.\n", path);
+		exit(EXIT_FAILURE);
+	}
+	snprintf(path, sizeof path, "%s/" ZIP_LIST_FILE, config->work_dir);
+	FILE* zip_list = fopen(path, "w");
+	if (!zip_list) {
+		fprintf(stderr, "Failed to write %s.\n", path);
+		exit(EXIT_FAILURE);
+	}
+	long code = FIRST_ZIP_CODE;
+	for (long county = 0; county < config->counties; ++county) {
+		fprintf(list, "wy,harness-%ld\n", county);
+		snprintf(path, sizeof path, "%s/counties/wy-harness-%ld.asp", config->work_dir, county);
+		FILE* page = fopen(path, "wb");
+		if (!page) {
+			fprintf(stderr, "Failed to write %s.\n", path);
+			exit(EXIT_FAILURE);
+		}
+		fwrite(template_page, 1, (size_t)(table - template_page), page);
+		fprintf(page, "<table class=\"statTable\" cellspacing=\"0\"><tr><th>ZIP Code</th><th>City</th></tr>");
+		for (long i = 0; i < config->zips_per_county; ++i, ++code) {
+			fprintf(page, "<tr><td><a href=\"/zip-code/%05ld/zip-code-%05ld.asp\" title=\"ZIP Code %05ld\">"
+				"ZIP Code %05ld</a></td><td>Harness</td></tr>", code, code, code, code);
+			fprintf(zip_list, "%05ld\n", code);
+		}
+		fprintf(page, "</table>\r\n");
+		fwrite(after, 1, (size_t)(&template_page[size] - after), page);
+		fclose(page);
+	}
+	fclose(list);
+	fclose(zip_list);
+	free(template_page);
+}
+
+static int portOpen(int port) {
+	const int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof address);
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons((unsigned short)port);
+	const int connected = fd >= 0 && connect(fd, (struct sockaddr*)&address, sizeof address) == 0;
+	if (fd >= 0) {
+		close(fd);
+	}
+	return connected;
+}
+
+static void startServer(const harness_config_t* config, int port, const char* root, const char* fallback,
+		const char* log_path) {
+	char program[1024];
+	char port_text[16];
+	snprintf(program, sizeof program, "%s/mock-server", config->bin_dir);
+	snprintf(port_text, sizeof port_text, "%d", port);
+	if (portOpen(port)) {
+		fprintf(stderr, "Port %d is already in use; pick another base port with -p.\n", port);
+		exit(EXIT_FAILURE);
+	}
+
+	const char* args[40];
+	int count = 0;
+	args[count++] = program;
+	args[count++] = "-p";
+	args[count++] = port_text;
+	args[count++] = "-d";
+	args[count++] = root;
+	if (fallback) {
+		args[count++] = "-f";
+		args[count++] = fallback;
+	}
+	for (int i = 0; i < config->server_arg_count; ++i) {
+		args[count++] = config->server_args[i];
+	}
+	args[count] = NULL;
+
+	const pid_t pid = fork();
+	if (pid == 0) {
+		const int log = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (log >= 0) {
+			dup2(log, STDERR_FILENO);
+			dup2(log, STDOUT_FILENO);
+		}
+		execv(program, (char* const*)args);
+		fprintf(stderr, "Failed to run %s: %s\n", program, strerror(errno));
+		_exit(127);
+	}
+	if (pid < 0) {
+		fprintf(stderr, "fork() failed: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	servers[server_count++] = pid;
+
+	for (double waited = 0; !portOpen(port); waited += 10) {
+		if (waited >= SERVER_START_MS || waitpid(pid, NULL, WNOHANG) == pid) {
+			fprintf(stderr, "mock-server did not start on port %d, see %s.\n", port, log_path);
+			exit(EXIT_FAILURE);
+		}
+		usleep(10000);
+	}
+}
+
+/* Runs tool in dir with the fetch settings for concurrency; fills seconds, CPU time and peak RSS. */
+static int runTool(const harness_config_t* config, const char* tool, const char* dir, const char* base_url,
+		long concurrency, const char* timing_log, const char* log_path, run_result_t* result) {
+	char program[1024];
+	snprintf(program, sizeof program, "%s/%s", config->bin_dir, tool);
+	if (program[0] != '/') {
+		/* The child changes directory, so a relative bin_dir has to be resolved first. */
+		char* resolved = realpath(program, NULL);
+		if (resolved) {
+			snprintf(program, sizeof program, "%s", resolved);
+			free(resolved);
+		}
+	}
+	const int multiplex = strcmp(config->http_version, "2") == 0;
+
+	const double start = monotonicSeconds();
+	const pid_t pid = fork();
+	if (pid == 0) {
+		char value[64];
+		setenv("ZIP_BASE_URL", base_url, 1);
+		snprintf(value, sizeof value, "%ld", concurrency);
+		setenv("ZIP_MAX_IN_FLIGHT", value, 1);
+		/* Over HTTP/2 the streams share one connection. */
+		setenv("ZIP_MAX_PER_HOST", multiplex ? "1" : value, 1);
+		setenv("ZIP_MULTIPLEX", multiplex ? "1" : "0", 1);
+		setenv("ZIP_HTTP_VERSION", config->http_version, 1);
+		snprintf(value, sizeof value, "%g", config->max_rps);
+		setenv("ZIP_MAX_RPS", value, 1);
+		setenv("ZIP_START_RPS", value, 1);
+		setenv("ZIP_CACHE", "0", 1);
+		setenv("ZIP_PERSIST_STATE", "0", 1);
+		setenv("ZIP_TIMING_LOG", timing_log, 1);
+
+		const int log = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		const int null_fd = open("/dev/null", O_WRONLY);
+		if (log < 0 || null_fd < 0 || chdir(dir) != 0) {
+			_exit(127);
+		}
+		dup2(null_fd, STDOUT_FILENO);
+		dup2(log, STDERR_FILENO);
+		execl(program, program, (char*)NULL);
+		fprintf(stderr, "Failed to run %s: %s\n", program, strerror(errno));
+		_exit(127);
+	}
+	if (pid < 0) {
+		fprintf(stderr, "fork() failed: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	int status = 0;
+	struct rusage usage;
+	memset(&usage, 0, sizeof usage);
+	while (wait4(pid, &status, 0, &usage) < 0 && errno == EINTR) {
+	}
+	result->seconds = monotonicSeconds() - start;
+	result->cpu_seconds = (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1e6
+		+ (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1e6;
+	result->peak_rss_mb = (double)usage.ru_maxrss / 1024.0;   /* ru_maxrss is in KB on Linux */
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "%s exited with status %d, see %s.\n", tool, WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+			log_path);
+		return 0;
+	}
+	return 1;
+}
+
+static int compareDoubles(const void* a, const void* b) {
+	const double x = *(const double*)a;
+	const double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+/* Nearest rank over sorted values. */
+static double percentile(const double values[], long count, double fraction) {
+	if (count == 0) {
+		return 0.0;
+	}
+	long rank = (long)(fraction * (double)count + 0.999999);
+	rank = rank < 1 ? 1 : rank > count ? count : rank;
+	return values[rank - 1];
+}
+
+/* Reads the "seconds status success url" lines the fetch engine wrote. */
+static void readTimingLog(const char* path, run_result_t* result) {
+	FILE* fp = fopen(path, "r");
+	long capacity = 1024;
+	long count = 0;
+	double* latencies = (double*)malloc((size_t)capacity * sizeof(double));
+	char line[2048];
+	while (fp && fgets(line, sizeof line, fp)) {
+		double seconds = 0.0;
+		long status = 0;
+		int success = 0;
+		if (sscanf(line, "%lf %ld %d", &seconds, &status, &success) != 3) {
+			continue;
+		}
+		if (!success) {
+			result->failed++;
+			continue;
+		}
+		if (count == capacity) {
+			capacity *= 2;
+			latencies = (double*)realloc(latencies, (size_t)capacity * sizeof(double));
+		}
+		latencies[count++] = seconds;
+	}
+	if (fp) {
+		fclose(fp);
+	}
+	qsort(latencies, (size_t)count, sizeof(double), compareDoubles);
+	result->pages = count;
+	result->p50_ms = percentile(latencies, count, 0.50) * 1000.0;
+	result->p99_ms = percentile(latencies, count, 0.99) * 1000.0;
+	free(latencies);
+}
+
+static long countLines(const char* path) {
+	FILE* fp = fopen(path, "r");
+	long lines = 0;
+	for (int c; fp && (c = fgetc(fp)) != EOF;) {
+		lines += c == '\n';
+	}
+	if (fp) {
+		fclose(fp);
+	}
+	return lines;
+}
+
+static void copyFile(const char* from, const char* to) {
+	size_t size = 0;
+	char* data = readFile(from, &size);
+	FILE* fp = fopen(to, "wb");
+	if (!fp || fwrite(data, 1, size, fp) != size) {
+		fprintf(stderr, "Failed to write %s.\n", to);
+		exit(EXIT_FAILURE);
+	}
+	fclose(fp);
+	free(data);
+}
+
+/*
+ * One sweep step. get-zip-codes runs in run/ and writes ../data, which is
+ * where read_list then runs, reading the zip codes get-zip-codes stored.
+ */
+static void runStep(const harness_config_t* config, long concurrency, const char* county_url,
+		const char* zip_url, run_result_t results[2]) {
+	char step[1024];
+	char run[1100];
+	char data[1100];
+	char path[1200];
+	char log[1200];
+	char timing[1200];
+	snprintf(step, sizeof step, "%s/c%ld", config->work_dir, concurrency);
+	snprintf(run, sizeof run, "%s/run", step);
+	snprintf(data, sizeof data, "%s/data", step);
+	makeDir(step);
+	makeDir(run);
+	makeDir(data);
+	snprintf(path, sizeof path, "%s/county-list.csv", config->work_dir);
+	snprintf(log, sizeof log, "%s/county-list.csv", data);
+	copyFile(path, log);
+	snprintf(path, sizeof path, "%s/" ZIP_LIST_FILE, config->work_dir);
+	snprintf(log, sizeof log, "%s/" ZIP_LIST_FILE, data);
+	copyFile(path, log);
+
+	run_result_t* counties = &results[0];
+	memset(counties, 0, sizeof(run_result_t));
+	counties->tool = "get-zip-codes";
+	counties->concurrency = concurrency;
+	snprintf(log, sizeof log, "%s/get-zip-codes.log", step);
+	snprintf(timing, sizeof timing, "%s/get-zip-codes.timing", step);
+	runTool(config, "get-zip-codes", run, county_url, concurrency, timing, log, counties);
+	readTimingLog(timing, counties);
+	snprintf(path, sizeof path, "%s/zip-codes-list.csv", data);
+	counties->zips = countLines(path);
+
+	run_result_t* zips = &results[1];
+	memset(zips, 0, sizeof(run_result_t));
+	zips->tool = "read_list";
+	zips->concurrency = concurrency;
+	snprintf(log, sizeof log, "%s/read_list.log", step);
+	snprintf(timing, sizeof timing, "%s/read_list.timing", step);
+	runTool(config, "read_list", data, zip_url, concurrency, timing, log, zips);
+	readTimingLog(timing, zips);
+	zips->zips = zips->pages;
+}
+
+static void printText(const harness_config_t* config, const run_result_t results[], int count) {
+	printf("HTTP/%s, %ld counties x %ld zips\n", config->http_version, config->counties, config->zips_per_county);
+	printf("%-14s %5s %6s %6s %6s %8s %9s %8s %8s %7s %7s\n", "tool", "conc", "pages", "zips", "failed",
+		"seconds", "zips/s", "p50_ms", "p99_ms", "cpu_s", "rss_mb");
+	for (int i = 0; i < count; ++i) {
+		const run_result_t* r = &results[i];
+		printf("%-14s %5ld %6ld %6ld %6ld %8.3f %9.1f %8.1f %8.1f %7.3f %7.1f\n", r->tool, r->concurrency,
+			r->pages, r->zips, r->failed, r->seconds, r->seconds > 0 ? (double)r->zips / r->seconds : 0.0,
+			r->p50_ms, r->p99_ms, r->cpu_seconds, r->peak_rss_mb);
+	}
+}
+
+static void printJson(const harness_config_t* config, const run_result_t results[], int count) {
+	printf("{\"http_version\": \"%s\", \"counties\": %ld, \"zips_per_county\": %ld, \"runs\": [",
+		config->http_version, config->counties, config->zips_per_county);
+	for (int i = 0; i < count; ++i) {
+		const run_result_t* r = &results[i];
+		printf("%s\n  {\"tool\": \"%s\", \"concurrency\": %ld, \"pages\": %ld, \"zips\": %ld, \"failed\": %ld, "
+			"\"seconds\": %.4f, \"zips_per_sec\": %.2f, \"p50_ms\": %.2f, \"p99_ms\": %.2f, \"cpu_seconds\": %.4f, "
+			"\"peak_rss_mb\": %.2f}", i > 0 ? "," : "", r->tool, r->concurrency, r->pages, r->zips, r->failed,
+			r->seconds, r->seconds > 0 ? (double)r->zips / r->seconds : 0.0, r->p50_ms, r->p99_ms,
+			r->cpu_seconds, r->peak_rss_mb);
+	}
+	printf("\n]}\n");
+}
+
+int main(int argc, char* argv[]) {
+	harness_config_t config;
+	parseArgs(argc, argv, &config);
+	signal(SIGPIPE, SIG_IGN);
+
+	char work_dir[] = "/tmp/load-harness.XXXXXX";
+	if (!config.work_dir) {
+		if (!mkdtemp(work_dir)) {
+			fprintf(stderr, "Failed to create a work directory: %s\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+		config.work_dir = work_dir;
+		temp_work_dir = config.keep ? NULL : work_dir;
+	} else {
+		makeDir(config.work_dir);
+	}
+	/* Handlers run in reverse: the servers stop before their logs are removed, on error exits too. */
+	atexit(removeWorkDir);
+	atexit(stopServers);
+	writeCountyPages(&config);
+
+	char county_url[256];
+	char zip_url[256];
+	char root[1200];
+	char log[1200];
+	if (config.county_url) {
+		snprintf(county_url, sizeof county_url, "%s", config.county_url);
+	} else {
+		snprintf(root, sizeof root, "%s/counties", config.work_dir);
+		snprintf(log, sizeof log, "%s/county-server.log", config.work_dir);
+		startServer(&config, config.port, root, NULL, log);
+		snprintf(county_url, sizeof county_url, "http://127.0.0.1:%d/", config.port);
+	}
+	if (config.zip_url) {
+		snprintf(zip_url, sizeof zip_url, "%s", config.zip_url);
+	} else {
+		snprintf(root, sizeof root, "%s/city-data", config.fixtures);
+		snprintf(log, sizeof log, "%s/zip-server.log", config.work_dir);
+		startServer(&config, config.port + 1, root, ZIP_FALLBACK, log);
+		snprintf(zip_url, sizeof zip_url, "http://127.0.0.1:%d/", config.port + 1);
+	}
+
+	run_result_t results[MAX_SWEEP * 2];
+	for (int i = 0; i < config.sweep_count; ++i) {
+		fprintf(stderr, "Running concurrency %ld...\n", config.concurrency[i]);
+		runStep(&config, config.concurrency[i], county_url, zip_url, &results[i * 2]);
+	}
+	stopServers();
+
+	if (config.json) {
+		printJson(&config, results, config.sweep_count * 2);
+	} else {
+		printText(&config, results, config.sweep_count * 2);
+	}
+
+	if (!temp_work_dir) {
+		fprintf(stderr, "Logs and databases are in %s.\n", config.work_dir);
+	}
+	return EXIT_SUCCESS;
+}
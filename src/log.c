@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "config.h"
+#include "log.h"
+
+#define IDLE_SLEEP_NS 1000000   /* the writer's nap when the ring is empty */
+
+static const char* level_names[] = { "error", "warn", "info", "debug" };
+
+/*
+ * A slot's sequence says whose turn it is: equal to a producer's ticket when
+ * the slot is free to fill, one past it once the message is ready for the
+ * writer, and a full lap ahead after the writer is done with it.
+ */
+typedef struct LogSlot {
+	atomic_size_t sequence;
+	char text[LOG_MESSAGE_SIZE];
+} log_slot_t;
+
+static struct {
+	log_slot_t* slots;
+	size_t mask;
+	atomic_size_t head;   /* next ticket for a producer */
+	size_t tail;          /* next slot to write, writer thread only */
+	atomic_long dropped;
+	atomic_int running;
+	atomic_int stopping;
+	int level;
+	int exit_hooked;
+	pthread_t thread;
+} logger = { .level = LOG_INFO };
+
+static size_t roundUpToPowerOfTwo(long value) {
+	size_t size = 1;
+	while (size < (size_t)value) {
+		size <<= 1;
+	}
+	return size;
+}
+
+/* Writes every ready slot under one stdio lock; returns how many it wrote. */
+static long drain(void) {
+	long written = 0;
+	flockfile(stderr);
+	for (;;) {
+		log_slot_t* slot = &logger.slots[logger.tail & logger.mask];
+		if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != logger.tail + 1) {
+			break;
+		}
+		fputs_unlocked(slot->text, stderr);
+		atomic_store_explicit(&slot->sequence, logger.tail + logger.mask + 1, memory_order_release);
+		logger.tail++;
+		written++;
+	}
+	fflush_unlocked(stderr);
+	funlockfile(stderr);
+	return written;
+}
+
+static void* runWriter(void* arg) {
+	(void)arg;
+	const struct timespec idle = { 0, IDLE_SLEEP_NS };
+	while (!atomic_load_explicit(&logger.stopping, memory_order_acquire)) {
+		if (drain() == 0) {
+			nanosleep(&idle, NULL);
+		}
+	}
+	drain();
+	return NULL;
+}
+
+static void parseLevel(void) {
+	const char* name = configString("ZIP_LOG_LEVEL", NULL);
+	if (!name) {
+		return;
+	}
+	for (int level = LOG_ERROR; level <= LOG_DEBUG; ++level) {
+		if (strcasecmp(name, level_names[level]) == 0) {
+			logger.level = level;
+			return;
+		}
+	}
+	fprintf(stderr, "Ignoring ZIP_LOG_LEVEL=%s, expected error, warn, info or debug.\n", name);
+}
+
+void logStart(void) {
+	parseLevel();
+	if (atomic_load(&logger.running)) {
+		return;
+	}
+	/*
+	 * The ring is allocated once and never freed: a thread that saw running
+	 * just before logStop() may still be filling a slot, even from an exit()
+	 * on another thread. A restart picks up where the last writer stopped.
+	 */
+	if (!logger.slots) {
+		const long slots = configLong("ZIP_LOG_RING", LOG_DEFAULT_RING_SLOTS);
+		const size_t count = roundUpToPowerOfTwo(slots > 1 ? slots : 2);
+		logger.slots = (log_slot_t*)malloc(count * sizeof(log_slot_t));
+		if (!logger.slots) {
+			fprintf(stderr, "Failed to allocate the log ring; logging synchronously.\n");
+			return;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			atomic_init(&logger.slots[i].sequence, i);
+		}
+		logger.mask = count - 1;
+	}
+	atomic_store(&logger.stopping, 0);
+	if (pthread_create(&logger.thread, NULL, runWriter, NULL) != 0) {
+		fprintf(stderr, "Failed to start the log writer; logging synchronously.\n");
+		return;
+	}
+	atomic_store_explicit(&logger.running, 1, memory_order_release);
+	if (!logger.exit_hooked) {
+		/* Error paths that exit() still get their queued messages out. */
+		atexit(logStop);
+		logger.exit_hooked = 1;
+	}
+}
+
+void logStop(void) {
+	if (!atomic_exchange(&logger.running, 0)) {
+		return;
+	}
+	atomic_store_explicit(&logger.stopping, 1, memory_order_release);
+	pthread_join(logger.thread, NULL);
+	const long dropped = atomic_exchange(&logger.dropped, 0);
+	if (dropped > 0) {
+		fprintf(stderr, "Dropped %ld log messages while the ring of %zu was full; raise ZIP_LOG_RING to keep them.\n",
+			dropped, logger.mask + 1);
+	}
+}
+
+int logEnabled(log_level_t level) {
+	return (int)level <= logger.level;
+}
+
+void logWrite(log_level_t level, const char* format, ...) {
+	if ((int)level > logger.level) {
+		return;
+	}
+	va_list args;
+	va_start(args, format);
+	if (!atomic_load_explicit(&logger.running, memory_order_acquire)) {
+		vfprintf(stderr, format, args);
+		va_end(args);
+		return;
+	}
+
+	size_t ticket = atomic_load_explicit(&logger.head, memory_order_relaxed);
+	log_slot_t* slot;
+	for (;;) {
+		slot = &logger.slots[ticket & logger.mask];
+		const size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+		const intptr_t lag = (intptr_t)sequence - (intptr_t)ticket;
+		if (lag == 0) {
+			if (atomic_compare_exchange_weak_explicit(&logger.head, &ticket, ticket + 1,
+					memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (lag < 0) {
+			/* The writer has not freed this slot from the last lap: the ring is full. */
+			atomic_fetch_add_explicit(&logger.dropped, 1, memory_order_relaxed);
+			va_end(args);
+			return;
+		} else {
+			ticket = atomic_load_explicit(&logger.head, memory_order_relaxed);
+		}
+	}
+	if (vsnprintf(slot->text, sizeof slot->text, format, args) >= (int)sizeof slot->text) {
+		slot->text[sizeof slot->text - 2] = '\n';
+	}
+	va_end(args);
+	atomic_store_explicit(&slot->sequence, ticket + 1, memory_order_release);
+}
@@ -0,0 +1,52 @@
+#ifndef ZIP_CODES_LOG_H
+#define ZIP_CODES_LOG_H
+
+#define LOG_DEFAULT_RING_SLOTS 1024   /* messages waiting for the writer; more are dropped */
+#define LOG_MESSAGE_SIZE 512          /* longer messages are cut short */
+
+typedef enum LogLevel {
+	LOG_ERROR,
+	LOG_WARN,
+	LOG_INFO,
+	LOG_DEBUG
+} log_level_t;
+
+/* Calls above this level are compiled out, arguments and all: -DLOG_COMPILE_LEVEL=LOG_INFO. */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+
+/*
+ * Leveled logging to stderr for messages on the fetch, parse and insert
+ * paths. The caller formats the message into a slot of a lock-free ring and
+ * returns; a background thread writes the slots out, so no worker ever waits
+ * on the stdio lock or the terminal. A message that finds the ring full is
+ * counted as dropped instead of blocking.
+ *
+ * logStart() reads ZIP_LOG_LEVEL (error, warn, info or debug; info by
+ * default) and ZIP_LOG_RING (slots, rounded up to a power of two). Before
+ * logStart() and after logStop() messages are written directly.
+ */
+void logStart(void);
+
+/*
+ * Writes out what is queued, stops the thread and reports dropped messages.
+ * The ring stays allocated for late producers. Also run at exit.
+ */
+void logStop(void);
+
+int logEnabled(log_level_t level);
+void logWrite(log_level_t level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+#define logAt(level, ...) do { \
+	if ((level) <= LOG_COMPILE_LEVEL) { \
+		logWrite((level), __VA_ARGS__); \
+	} \
+} while (0)
+
+#define logError(...) logAt(LOG_ERROR, __VA_ARGS__)
+#define logWarn(...) logAt(LOG_WARN, __VA_ARGS__)
+#define logInfo(...) logAt(LOG_INFO, __VA_ARGS__)
+#define logDebug(...) logAt(LOG_DEBUG, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,394 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "alloc_stats.h"
+#include "config.h"
+#include "metrics.h"
+
+#define SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+#define GROUPS (METRICS_MAX_VALUE_BITS - METRICS_SUB_BUCKET_BITS + 1)
+#define BUCKETS (GROUPS * SUB_BUCKETS)
+#define MAX_VALUE ((UINT64_C(1) << METRICS_MAX_VALUE_BITS) - 1)
+#define PATH_SIZE 1024
+
+typedef struct MetricInfo {
+	const char* name;
+	const char* help;
+	double scale;   /* recorded units to exported units */
+} metric_info_t;
+
+typedef struct Histogram {
+	atomic_uint_least64_t buckets[BUCKETS];
+	atomic_uint_least64_t sum;
+	atomic_uint_least64_t min;   /* UINT64_MAX - min, so zero-initialized storage means "none yet" */
+	atomic_uint_least64_t max;
+} histogram_t;
+
+/* A consistent enough copy to export; recording goes on while it is taken. */
+typedef struct HistogramSnapshot {
+	uint64_t buckets[BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+} histogram_snapshot_t;
+
+static const metric_info_t metric_info[METRIC_COUNT] = {
+	{ "dns_seconds", "Name lookup time on transfers that opened a connection.", 1e-6 },
+	{ "connect_seconds", "TCP connect time after the name lookup.", 1e-6 },
+	{ "tls_seconds", "TLS handshake time after the TCP connect.", 1e-6 },
+	{ "server_wait_seconds", "Time from sending the request to the first response byte.", 1e-6 },
+	{ "first_byte_seconds", "Time from the start of a transfer to the first response byte.", 1e-6 },
+	{ "transfer_seconds", "Total time of each transfer attempt.", 1e-6 },
+	{ "response_bytes", "Body bytes downloaded per transfer attempt.", 1.0 },
+	{ "parse_seconds", "Time spent parsing one page.", 1e-6 },
+	{ "db_row_seconds", "Time binding and stepping one insert.", 1e-6 },
+	{ "db_commit_seconds", "Time of one group commit.", 1e-6 },
+};
+
+static histogram_t histograms[METRIC_COUNT];
+static atomic_long status_counts[METRICS_STATUS_CODES];
+
+static struct {
+	const char* tool;
+	char json_path[PATH_SIZE];
+	char prom_path[PATH_SIZE];
+	int enabled;
+	long interval;
+	double started;
+	pthread_t thread;
+	int running;
+	int stopping;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+} exporter = { NULL, "", "", 0, 0, 0.0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static double monotonicSeconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+double metricsClock(void) {
+	return monotonicSeconds();
+}
+
+static int bucketIndex(uint64_t value) {
+	if (value < SUB_BUCKETS) {
+		return (int)value;
+	}
+	const int msb = 63 - __builtin_clzll(value);
+	const int shift = msb - METRICS_SUB_BUCKET_BITS;
+	return (shift + 1) * SUB_BUCKETS + (int)((value >> shift) - SUB_BUCKETS);
+}
+
+static uint64_t bucketLower(int index) {
+	const int group = index / SUB_BUCKETS;
+	const uint64_t sub = (uint64_t)(index % SUB_BUCKETS);
+	return group == 0 ? sub : (SUB_BUCKETS + sub) << (group - 1);
+}
+
+static uint64_t bucketWidth(int index) {
+	const int group = index / SUB_BUCKETS;
+	return group == 0 ? 1 : UINT64_C(1) << (group - 1);
+}
+
+void metricsRecord(metric_id_t id, uint64_t value) {
+	histogram_t* histogram = &histograms[id];
+	if (value > MAX_VALUE) {
+		value = MAX_VALUE;
+	}
+	atomic_fetch_add_explicit(&histogram->buckets[bucketIndex(value)], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+
+	const uint64_t inverted = UINT64_MAX - value;
+	uint64_t seen = atomic_load_explicit(&histogram->min, memory_order_relaxed);
+	while (inverted > seen && !atomic_compare_exchange_weak_explicit(&histogram->min, &seen, inverted,
+			memory_order_relaxed, memory_order_relaxed)) {
+	}
+	seen = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+	while (value > seen && !atomic_compare_exchange_weak_explicit(&histogram->max, &seen, value,
+			memory_order_relaxed, memory_order_relaxed)) {
+	}
+}
+
+void metricsRecordSeconds(metric_id_t id, double seconds) {
+	metricsRecord(id, seconds > 0 ? (uint64_t)(seconds * 1e6 + 0.5) : 0);
+}
+
+void metricsRecordStatus(long response_code) {
+	if (response_code < 0 || response_code >= METRICS_STATUS_CODES) {
+		response_code = 0;
+	}
+	atomic_fetch_add_explicit(&status_counts[response_code], 1, memory_order_relaxed);
+}
+
+static void snapshot(metric_id_t id, histogram_snapshot_t* copy) {
+	histogram_t* histogram = &histograms[id];
+	copy->count = 0;
+	for (int i = 0; i < BUCKETS; ++i) {
+		copy->buckets[i] = atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+		copy->count += copy->buckets[i];
+	}
+	copy->sum = atomic_load_explicit(&histogram->sum, memory_order_relaxed);
+	copy->min = UINT64_MAX - atomic_load_explicit(&histogram->min, memory_order_relaxed);
+	copy->max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+}
+
+/* The midpoint of the bucket holding the given fraction of the samples, within [min, max]. */
+static double percentile(const histogram_snapshot_t* copy, double fraction) {
+	if (copy->count == 0) {
+		return 0.0;
+	}
+	uint64_t rank = (uint64_t)(fraction * (double)copy->count + 0.5);
+	rank = rank < 1 ? 1 : rank;
+	uint64_t seen = 0;
+	for (int i = 0; i < BUCKETS; ++i) {
+		seen += copy->buckets[i];
+		if (seen >= rank) {
+			double value = (double)bucketLower(i) + (double)(bucketWidth(i) - 1) / 2.0;
+			value = value < (double)copy->min ? (double)copy->min : value;
+			return value > (double)copy->max ? (double)copy->max : value;
+		}
+	}
+	return (double)copy->max;
+}
+
+static void writeJson(FILE* fp, double uptime) {
+	static histogram_snapshot_t copy;
+	fprintf(fp, "{\"tool\": \"%s\", \"uptime_seconds\": %.3f, \"histograms\": {", exporter.tool, uptime);
+	for (int id = 0; id < METRIC_COUNT; ++id) {
+		const double scale = metric_info[id].scale;
+		snapshot((metric_id_t)id, &copy);
+		fprintf(fp, "%s\n  \"%s\": {\"count\": %llu, \"sum\": %.9g", id > 0 ? "," : "", metric_info[id].name,
+			(unsigned long long)copy.count, (double)copy.sum * scale);
+		if (copy.count > 0) {
+			fprintf(fp, ", \"min\": %.9g, \"max\": %.9g, \"mean\": %.9g, \"p50\": %.9g, \"p90\": %.9g, "
+				"\"p99\": %.9g, \"p999\": %.9g", (double)copy.min * scale, (double)copy.max * scale,
+				(double)copy.sum * scale / (double)copy.count, percentile(&copy, 0.50) * scale,
+				percentile(&copy, 0.90) * scale, percentile(&copy, 0.99) * scale, percentile(&copy, 0.999) * scale);
+		}
+		/* Only the buckets that hold samples, as [lower bound, upper bound, count]. */
+		fprintf(fp, ", \"buckets\": [");
+		int first = 1;
+		for (int i = 0; i < BUCKETS; ++i) {
+			if (copy.buckets[i] == 0) {
+				continue;
+			}
+			fprintf(fp, "%s[%.9g, %.9g, %llu]", first ? "" : ", ", (double)bucketLower(i) * scale,
+				(double)(bucketLower(i) + bucketWidth(i)) * scale, (unsigned long long)copy.buckets[i]);
+			first = 0;
+		}
+		fprintf(fp, "]}");
+	}
+	fprintf(fp, "\n}, \"responses\": {");
+	int first = 1;
+	for (int code = 0; code < METRICS_STATUS_CODES; ++code) {
+		const long count = atomic_load_explicit(&status_counts[code], memory_order_relaxed);
+		if (count > 0) {
+			fprintf(fp, "%s\"%d\": %ld", first ? "" : ", ", code, count);
+			first = 0;
+		}
+	}
+	fprintf(fp, "}, \"memory\": {\"peak_rss_bytes\": %llu", (unsigned long long)allocPeakRssBytes());
+	if (allocStatsAvailable()) {
+		alloc_phase_stats_t phases[ALLOC_PHASE_COUNT];
+		allocStatsSnapshot(phases);
+		fprintf(fp, ", \"heap_live_bytes\": %llu, \"heap_peak_bytes\": %llu, \"phases\": {",
+			(unsigned long long)allocLiveBytes(), (unsigned long long)allocPeakBytes());
+		for (int phase = 0; phase < ALLOC_PHASE_COUNT; ++phase) {
+			const alloc_phase_stats_t* stats = &phases[phase];
+			fprintf(fp, "%s\n  \"%s\": {\"allocations\": %llu, \"bytes\": %llu, \"frees\": %llu, "
+				"\"freed_bytes\": %llu, \"peak_bytes\": %llu}", phase > 0 ? "," : "",
+				allocPhaseName((alloc_phase_t)phase), (unsigned long long)stats->allocations,
+				(unsigned long long)stats->bytes, (unsigned long long)stats->frees,
+				(unsigned long long)stats->freed_bytes, (unsigned long long)stats->peak_bytes);
+		}
+		fprintf(fp, "\n}");
+	}
+	fprintf(fp, "}}\n");
+}
+
+/*
+ * One cumulative bucket per power of two keeps the exported series fixed from
+ * one dump to the next; the JSON carries the fine buckets.
+ */
+static void writePrometheus(FILE* fp, double uptime) {
+	static histogram_snapshot_t copy;
+	for (int id = 0; id < METRIC_COUNT; ++id) {
+		const metric_info_t* info = &metric_info[id];
+		snapshot((metric_id_t)id, &copy);
+		fprintf(fp, "# HELP zip_%s %s\n# TYPE zip_%s histogram\n", info->name, info->help, info->name);
+		uint64_t cumulative = 0;
+		for (int group = 0; group < GROUPS; ++group) {
+			for (int i = group * SUB_BUCKETS; i < (group + 1) * SUB_BUCKETS; ++i) {
+				cumulative += copy.buckets[i];
+			}
+			const double upper = (double)(UINT64_C(1) << (group + METRICS_SUB_BUCKET_BITS)) * info->scale;
+			fprintf(fp, "zip_%s_bucket{tool=\"%s\",le=\"%.9g\"} %llu\n", info->name, exporter.tool, upper,
+				(unsigned long long)cumulative);
+		}
+		fprintf(fp, "zip_%s_bucket{tool=\"%s\",le=\"+Inf\"} %llu\n", info->name, exporter.tool,
+			(unsigned long long)copy.count);
+		fprintf(fp, "zip_%s_sum{tool=\"%s\"} %.9g\n", info->name, exporter.tool, (double)copy.sum * info->scale);
+		fprintf(fp, "zip_%s_count{tool=\"%s\"} %llu\n", info->name, exporter.tool, (unsigned long long)copy.count);
+	}
+
+	fprintf(fp, "# HELP zip_http_responses_total Transfer attempts by HTTP status, 0 when no response arrived.\n"
+		"# TYPE zip_http_responses_total counter\n");
+	for (int code = 0; code < METRICS_STATUS_CODES; ++code) {
+		const long count = atomic_load_explicit(&status_counts[code], memory_order_relaxed);
+		if (count > 0) {
+			fprintf(fp, "zip_http_responses_total{tool=\"%s\",code=\"%d\"} %ld\n", exporter.tool, code, count);
+		}
+	}
+	fprintf(fp, "# HELP zip_peak_rss_bytes Peak resident set size from getrusage.\n"
+		"# TYPE zip_peak_rss_bytes gauge\nzip_peak_rss_bytes{tool=\"%s\"} %llu\n", exporter.tool,
+		(unsigned long long)allocPeakRssBytes());
+	if (allocStatsAvailable()) {
+		alloc_phase_stats_t phases[ALLOC_PHASE_COUNT];
+		allocStatsSnapshot(phases);
+		fprintf(fp, "# HELP zip_heap_live_bytes Heap bytes in use.\n# TYPE zip_heap_live_bytes gauge\n"
+			"zip_heap_live_bytes{tool=\"%s\"} %llu\n", exporter.tool, (unsigned long long)allocLiveBytes());
+		fprintf(fp, "# HELP zip_heap_allocations_total Heap allocations by pipeline phase.\n"
+			"# TYPE zip_heap_allocations_total counter\n");
+		for (int phase = 0; phase < ALLOC_PHASE_COUNT; ++phase) {
+			fprintf(fp, "zip_heap_allocations_total{tool=\"%s\",phase=\"%s\"} %llu\n", exporter.tool,
+				allocPhaseName((alloc_phase_t)phase), (unsigned long long)phases[phase].allocations);
+		}
+		fprintf(fp, "# HELP zip_heap_allocated_bytes_total Heap bytes allocated by pipeline phase.\n"
+			"# TYPE zip_heap_allocated_bytes_total counter\n");
+		for (int phase = 0; phase < ALLOC_PHASE_COUNT; ++phase) {
+			fprintf(fp, "zip_heap_allocated_bytes_total{tool=\"%s\",phase=\"%s\"} %llu\n", exporter.tool,
+				allocPhaseName((alloc_phase_t)phase), (unsigned long long)phases[phase].bytes);
+		}
+		fprintf(fp, "# HELP zip_heap_peak_bytes Most heap in use after an allocation in each phase.\n"
+			"# TYPE zip_heap_peak_bytes gauge\n");
+		for (int phase = 0; phase < ALLOC_PHASE_COUNT; ++phase) {
+			fprintf(fp, "zip_heap_peak_bytes{tool=\"%s\",phase=\"%s\"} %llu\n", exporter.tool,
+				allocPhaseName((alloc_phase_t)phase), (unsigned long long)phases[phase].peak_bytes);
+		}
+	}
+	fprintf(fp, "# HELP zip_uptime_seconds Seconds since the run started.\n# TYPE zip_uptime_seconds gauge\n"
+		"zip_uptime_seconds{tool=\"%s\"} %.3f\n", exporter.tool, uptime);
+}
+
+/* Writes next to path and renames, so a collector never reads half a file. */
+static void writeFile(const char* path, void (*write)(FILE*, double), double uptime) {
+	char temporary[PATH_SIZE + 8];
+	snprintf(temporary, sizeof temporary, "%s.tmp", path);
+	FILE* fp = fopen(temporary, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed to write metrics to %s: %s\n", temporary, strerror(errno));
+		return;
+	}
+	write(fp, uptime);
+	if (fclose(fp) != 0 || rename(temporary, path) != 0) {
+		fprintf(stderr, "Failed to write metrics to %s: %s\n", path, strerror(errno));
+	}
+}
+
+static void dump(void) {
+	const double uptime = monotonicSeconds() - exporter.started;
+	writeFile(exporter.json_path, writeJson, uptime);
+	writeFile(exporter.prom_path, writePrometheus, uptime);
+}
+
+static void* runExporter(void* arg) {
+	(void)arg;
+	pthread_mutex_lock(&exporter.lock);
+	while (!exporter.stopping) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += exporter.interval;
+		while (!exporter.stopping
+				&& pthread_cond_timedwait(&exporter.wake, &exporter.lock, &deadline) != ETIMEDOUT) {
+		}
+		if (!exporter.stopping) {
+			pthread_mutex_unlock(&exporter.lock);
+			dump();
+			pthread_mutex_lock(&exporter.lock);
+		}
+	}
+	pthread_mutex_unlock(&exporter.lock);
+	return NULL;
+}
+
+void metricsStart(const char* tool, const char* default_prefix) {
+	allocStatsConfigure();
+	exporter.tool = tool;
+	exporter.started = monotonicSeconds();
+	exporter.enabled = configLong("ZIP_METRICS", 1) != 0;
+	exporter.interval = configLong("ZIP_METRICS_INTERVAL", METRICS_DEFAULT_INTERVAL);
+	const char* prefix = configString("ZIP_METRICS_PREFIX", default_prefix);
+	snprintf(exporter.json_path, sizeof exporter.json_path, "%s.json", prefix);
+	snprintf(exporter.prom_path, sizeof exporter.prom_path, "%s.prom", prefix);
+	if (!exporter.enabled || exporter.interval <= 0) {
+		return;
+	}
+	exporter.running = pthread_create(&exporter.thread, NULL, runExporter, NULL) == 0;
+	if (!exporter.running) {
+		fprintf(stderr, "Failed to start the metrics exporter; metrics are written at the end only.\n");
+	}
+}
+
+static void printSummary(void) {
+	static histogram_snapshot_t copy;
+	fprintf(stderr, "%-20s %9s %10s %10s %10s %10s\n", "stage", "count", "total_s", "mean_ms", "p50_ms",
+		"p99_ms");
+	for (int id = 0; id < METRIC_COUNT; ++id) {
+		snapshot((metric_id_t)id, &copy);
+		if (copy.count == 0 || id == METRIC_RESPONSE_BYTES) {
+			continue;
+		}
+		const double ms = metric_info[id].scale * 1000.0;
+		fprintf(stderr, "%-20s %9llu %10.3f %10.3f %10.3f %10.3f\n", metric_info[id].name,
+			(unsigned long long)copy.count, (double)copy.sum * metric_info[id].scale,
+			(double)copy.sum * ms / (double)copy.count, percentile(&copy, 0.50) * ms, percentile(&copy, 0.99) * ms);
+	}
+}
+
+static void printMemory(void) {
+	const double mb = 1024.0 * 1024.0;
+	if (allocStatsAvailable()) {
+		alloc_phase_stats_t phases[ALLOC_PHASE_COUNT];
+		allocStatsSnapshot(phases);
+		fprintf(stderr, "%-20s %9s %10s %9s %10s %10s\n", "phase", "allocs", "alloc_mb", "frees", "freed_mb",
+			"peak_mb");
+		for (int phase = 0; phase < ALLOC_PHASE_COUNT; ++phase) {
+			const alloc_phase_stats_t* stats = &phases[phase];
+			if (stats->allocations == 0 && stats->frees == 0) {
+				continue;
+			}
+			fprintf(stderr, "%-20s %9llu %10.3f %9llu %10.3f %10.3f\n", allocPhaseName((alloc_phase_t)phase),
+				(unsigned long long)stats->allocations, (double)stats->bytes / mb,
+				(unsigned long long)stats->frees, (double)stats->freed_bytes / mb, (double)stats->peak_bytes / mb);
+		}
+		fprintf(stderr, "Heap peak %.3f MB, %.3f MB still in use. ", (double)allocPeakBytes() / mb,
+			(double)allocLiveBytes() / mb);
+	}
+	fprintf(stderr, "Peak RSS %.3f MB.\n", (double)allocPeakRssBytes() / mb);
+}
+
+void metricsStop(void) {
+	if (exporter.running) {
+		pthread_mutex_lock(&exporter.lock);
+		exporter.stopping = 1;
+		pthread_cond_signal(&exporter.wake);
+		pthread_mutex_unlock(&exporter.lock);
+		pthread_join(exporter.thread, NULL);
+		exporter.running = 0;
+	}
+	printSummary();
+	printMemory();
+	if (exporter.enabled) {
+		dump();
+		fprintf(stderr, "Metrics written to %s and %s.\n", exporter.json_path, exporter.prom_path);
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef ZIP_CODES_METRICS_H
+#define ZIP_CODES_METRICS_H
+
+#include <stdint.h>
+
+#define METRICS_DEFAULT_INTERVAL 10   /* seconds between periodic dumps, 0 dumps only at the end */
+#define METRICS_SUB_BUCKET_BITS 5     /* 32 linear buckets per power of two, under 3.2% error */
+#define METRICS_MAX_VALUE_BITS 40     /* larger values are clamped: about 12 days in us, 1 TB in bytes */
+#define METRICS_STATUS_CODES 600      /* HTTP status counters; 0 counts transfers with no response */
+
+/*
+ * The stages of a run. Times are recorded in microseconds and exported in
+ * seconds; METRIC_RESPONSE_BYTES is in bytes.
+ */
+typedef enum MetricId {
+	METRIC_DNS,             /* name lookup, on transfers that opened a connection */
+	METRIC_CONNECT,         /* TCP connect after the lookup, same transfers */
+	METRIC_TLS,             /* TLS handshake after the connect, https only */
+	METRIC_SERVER_WAIT,     /* request sent to first response byte: server think time */
+	METRIC_FIRST_BYTE,      /* transfer start to first response byte */
+	METRIC_TOTAL,           /* whole transfer, every attempt */
+	METRIC_RESPONSE_BYTES,  /* body bytes downloaded per attempt */
+	METRIC_PARSE,           /* parsing one page */
+	METRIC_DB_ROW,          /* binding and stepping one insert */
+	METRIC_DB_COMMIT,       /* one group commit */
+	METRIC_COUNT
+} metric_id_t;
+
+/*
+ * Process-wide log-linear histograms: each power of two is split into 32
+ * linear buckets, so any value is kept within about 3% using a fixed array of
+ * counters. Recording is a few relaxed atomic adds and is safe from any
+ * thread: the fetch loop, replay workers and the database writer all record
+ * into the same histograms.
+ */
+void metricsRecord(metric_id_t id, uint64_t value);
+void metricsRecordSeconds(metric_id_t id, double seconds);
+void metricsRecordStatus(long response_code);
+
+/* Monotonic seconds, for timing a stage before recording it. */
+double metricsClock(void);
+
+/*
+ * Starts dumping the histograms to <prefix>.json and <prefix>.prom (the
+ * Prometheus text format, for node_exporter's textfile collector) every
+ * ZIP_METRICS_INTERVAL seconds from a background thread. ZIP_METRICS_PREFIX
+ * overrides default_prefix and ZIP_METRICS=0 turns the files off. tool labels
+ * the exported series.
+ */
+void metricsStart(const char* tool, const char* default_prefix);
+
+/* Writes the final dump, stops the thread and prints a per-stage summary to stderr. */
+void metricsStop(void);
+
+#endif
@@ -0,0 +1,798 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#ifdef HAVE_NGHTTP2
+#include <nghttp2/nghttp2.h>
+#endif
+
+/*
+ * Local stand-in for city-data.com and zip-codes.com. Serves files from a
+ * fixture directory by the last path segment of the request, falling back to
+ * a default page, and injects latency and errors so the fetch engine's retry,
+ * backoff, hedging and rate control can be exercised without the real sites.
+ * Pages carry an ETag and Last-Modified and conditional requests that still
+ * match get a 304, as a caching origin would answer. A throttle answers
+ * requests over a rate with 429, and when built with nghttp2 the server also
+ * speaks cleartext HTTP/2 to clients that open with the connection preface.
+ */
+
+#define DEFAULT_PORT 8080
+#define REQUEST_BUFFER_SIZE 8192
+#define PARETO_ALPHA 2.0        /* tail index of the pareto jitter; its mean is then jitter_ms */
+#define PARETO_MAX_FACTOR 100   /* caps a pareto draw at this many times jitter_ms */
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_MAX_STREAMS 128
+
+typedef enum { LATENCY_UNIFORM, LATENCY_EXPONENTIAL, LATENCY_PARETO } latency_dist_t;
+
+typedef struct {
+	int port;
+	const char* root;
+	const char* fallback;
+	long latency_ms;      /* added to every response */
+	long jitter_ms;       /* uniform extra latency in [0, jitter_ms] */
+	double slow_rate;     /* fraction of responses that get slow_ms on top */
+	long slow_ms;
+	double error_rate;    /* fraction of responses replaced by error_status */
+	int error_status;
+	long retry_after;     /* Retry-After seconds on error responses, 0 for none */
+	latency_dist_t jitter_dist;   /* shape of the extra latency, with mean jitter_ms */
+	double throttle_rps;  /* requests/sec admitted before answering 429, 0 for no limit */
+	int http_version;     /* 1 or 2 to accept only that version, 0 for both */
+} mock_config_t;
+
+/* The response to one request, independent of the HTTP version it goes out on. */
+typedef struct {
+	int status;
+	const char* reason;
+	char etag[32];            /* "" for none */
+	char last_modified[64];
+	long retry_after;
+	char* body;               /* NULL for an empty body */
+	size_t size;
+} mock_response_t;
+
+/* One token bucket for the whole server, holding up to a second of requests. */
+static struct {
+	pthread_mutex_t lock;
+	double tokens;
+	double updated;
+} throttle = { PTHREAD_MUTEX_INITIALIZER, 0.0, 0.0 };
+
+typedef struct {
+	int fd;
+	const mock_config_t* config;
+} mock_connection_t;
+
+static void usage(const char* program) {
+	fprintf(stderr, "Usage: %s [-p port] [-d fixture_dir] [-f fallback_file] [-l latency_ms] "
+		"[-j jitter_ms] [-D uniform|exponential|pareto] [-s slow_rate] [-S slow_ms] [-e error_rate] "
+		"[-E error_status] [-r retry_after] [-t throttle_rps] [-H 1|2]\n", program);
+	exit(EXIT_FAILURE);
+}
+
+static void parseArgs(int argc, char* argv[], mock_config_t* config) {
+	memset(config, 0, sizeof(mock_config_t));
+	config->port = DEFAULT_PORT;
+	config->root = ".";
+	config->error_status = 503;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:d:f:l:j:D:s:S:e:E:r:t:H:")) != -1) {
+		switch (opt) {
+		case 'p': config->port = atoi(optarg); break;
+		case 'd': config->root = optarg; break;
+		case 'f': config->fallback = optarg; break;
+		case 'l': config->latency_ms = atol(optarg); break;
+		case 'j': config->jitter_ms = atol(optarg); break;
+		case 's': config->slow_rate = atof(optarg); break;
+		case 'S': config->slow_ms = atol(optarg); break;
+		case 'e': config->error_rate = atof(optarg); break;
+		case 'E': config->error_status = atoi(optarg); break;
+		case 'r': config->retry_after = atol(optarg); break;
+		case 't': config->throttle_rps = atof(optarg); break;
+		case 'H': config->http_version = atoi(optarg); break;
+		case 'D':
+			if (strcmp(optarg, "uniform") == 0) {
+				config->jitter_dist = LATENCY_UNIFORM;
+			} else if (strcmp(optarg, "exponential") == 0) {
+				config->jitter_dist = LATENCY_EXPONENTIAL;
+			} else if (strcmp(optarg, "pareto") == 0) {
+				config->jitter_dist = LATENCY_PARETO;
+			} else {
+				usage(argv[0]);
+			}
+			break;
+		default: usage(argv[0]);
+		}
+	}
+	if (config->http_version != 0 && config->http_version != 1 && config->http_version != 2) {
+		usage(argv[0]);
+	}
+#ifndef HAVE_NGHTTP2
+	if (config->http_version == 2) {
+		fprintf(stderr, "HTTP/2 needs a build with nghttp2.\n");
+		exit(EXIT_FAILURE);
+	}
+#endif
+}
+
+static double uniform(unsigned int* seed) {
+	return (double)rand_r(seed) / ((double)RAND_MAX + 1.0);
+}
+
+static double monotonicSeconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/* Base latency plus a jitter draw and the occasional slow response, in ms. */
+static long responseDelay(const mock_config_t* config, unsigned int* seed) {
+	long delay = config->latency_ms;
+	if (config->jitter_ms > 0) {
+		const double jitter = (double)config->jitter_ms;
+		const double u = uniform(seed);
+		double extra = 0.0;
+		switch (config->jitter_dist) {
+		case LATENCY_UNIFORM: extra = u * (jitter + 1.0); break;
+		case LATENCY_EXPONENTIAL: extra = -log(1.0 - u) * jitter; break;
+		case LATENCY_PARETO:
+			/* Lomax: a heavy tail with mean jitter_ms for alpha 2. */
+			extra = jitter * (PARETO_ALPHA - 1.0) * (pow(1.0 - u, -1.0 / PARETO_ALPHA) - 1.0);
+			extra = extra < jitter * PARETO_MAX_FACTOR ? extra : jitter * PARETO_MAX_FACTOR;
+			break;
+		}
+		delay += (long)extra;
+	}
+	if (config->slow_rate > 0 && uniform(seed) < config->slow_rate) {
+		delay += config->slow_ms;
+	}
+	return delay;
+}
+
+/* Takes a token for a request that just arrived; returns 0 when it is over the rate. */
+static int throttleAdmit(const mock_config_t* config) {
+	if (config->throttle_rps <= 0) {
+		return 1;
+	}
+	const double now = monotonicSeconds();
+	const double burst = config->throttle_rps > 1.0 ? config->throttle_rps : 1.0;
+	pthread_mutex_lock(&throttle.lock);
+	if (throttle.updated == 0.0) {
+		throttle.tokens = burst;
+	} else {
+		throttle.tokens += (now - throttle.updated) * config->throttle_rps;
+		throttle.tokens = throttle.tokens < burst ? throttle.tokens : burst;
+	}
+	throttle.updated = now;
+	const int admitted = throttle.tokens >= 1.0;
+	if (admitted) {
+		throttle.tokens -= 1.0;
+	}
+	pthread_mutex_unlock(&throttle.lock);
+	return admitted;
+}
+
+static void sleepMs(long ms) {
+	if (ms <= 0) {
+		return;
+	}
+	struct timespec delay;
+	delay.tv_sec = ms / 1000;
+	delay.tv_nsec = (ms % 1000) * 1000000L;
+	while (nanosleep(&delay, &delay) == -1 && errno == EINTR) {
+	}
+}
+
+static int writeAll(int fd, const char* data, size_t size) {
+	while (size > 0) {
+		const ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+		if (written <= 0) {
+			return -1;
+		}
+		data += written;
+		size -= (size_t)written;
+	}
+	return 0;
+}
+
+static char* loadFile(const char* path, size_t* size, time_t* modified) {
+	FILE* fp = fopen(path, "rb");
+	if (!fp) {
+		return NULL;
+	}
+	struct stat info;
+	*modified = fstat(fileno(fp), &info) == 0 ? info.st_mtime : 0;
+	fseek(fp, 0, SEEK_END);
+	const long length = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	char* body = (char*)malloc((size_t)length + 1);
+	*size = fread(body, 1, (size_t)length, fp);
+	fclose(fp);
+	return body;
+}
+
+static char* loadFixture(const mock_config_t* config, const char* path, size_t* size, time_t* modified) {
+	char name[256] = {'\0'};
+	const char* slash = strrchr(path, '/');
+	snprintf(name, sizeof name, "%s", slash ? &slash[1] : path);
+	char* query = strchr(name, '?');
+	if (query) {
+		*query = '\0';
+	}
+
+	char file[1024];
+	if (name[0] != '\0' && strstr(name, "..") == NULL) {
+		snprintf(file, sizeof file, "%s/%s", config->root, name);
+		char* body = loadFile(file, size, modified);
+		if (body) {
+			return body;
+		}
+	}
+	if (config->fallback) {
+		snprintf(file, sizeof file, "%s/%s", config->root, config->fallback);
+		return loadFile(file, size, modified);
+	}
+	return NULL;
+}
+
+/* Copies the value of request header name, without surrounding spaces; returns 0 when it is absent. */
+static int requestHeader(const char* request, const char* name, char* value, size_t size) {
+	const size_t length = strlen(name);
+	for (const char* line = strstr(request, "\r\n"); line; line = strstr(line, "\r\n")) {
+		line += 2;
+		if (line[0] == '\r' || line[0] == '\0') {
+			break;   /* end of this request's headers */
+		}
+		if (strncasecmp(line, name, length) == 0 && line[length] == ':') {
+			const char* start = &line[length + 1];
+			while (*start == ' ') {
+				start++;
+			}
+			const size_t end = strcspn(start, "\r\n");
+			snprintf(value, size, "%.*s", (int)end, start);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Fills response for path: a throttled or injected error, a 404, a 304 when
+ * the request's validators still match, or the page. if_none_match and
+ * if_modified_since are NULL when the request did not send them.
+ */
+static void buildResponse(const mock_config_t* config, const char* path, const char* if_none_match,
+		const char* if_modified_since, int throttled, unsigned int* seed, mock_response_t* response) {
+	memset(response, 0, sizeof(mock_response_t));
+	if (throttled) {
+		response->status = 429;
+		response->reason = "Too Many Requests";
+		response->retry_after = config->retry_after > 0 ? config->retry_after : 1;
+		return;
+	}
+	if (config->error_rate > 0 && uniform(seed) < config->error_rate) {
+		response->status = config->error_status;
+		response->reason = "Injected Error";
+		response->retry_after = config->retry_after;
+		return;
+	}
+
+	time_t modified = 0;
+	response->body = loadFixture(config, path, &response->size, &modified);
+	if (!response->body) {
+		response->status = 404;
+		response->reason = "Not Found";
+		return;
+	}
+
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < response->size; ++i) {
+		hash = (hash ^ (unsigned char)response->body[i]) * 1099511628211ULL;
+	}
+	struct tm gmt;
+	snprintf(response->etag, sizeof response->etag, "\"%016llx\"", hash);
+	strftime(response->last_modified, sizeof response->last_modified, "%a, %d %b %Y %H:%M:%S GMT",
+		gmtime_r(&modified, &gmt));
+
+	/* If-None-Match wins over If-Modified-Since when both are sent. */
+	int not_modified = 0;
+	if (if_none_match) {
+		not_modified = strstr(if_none_match, response->etag) != NULL || strcmp(if_none_match, "*") == 0;
+	} else if (if_modified_since) {
+		not_modified = strcmp(if_modified_since, response->last_modified) == 0;
+	}
+	if (not_modified) {
+		free(response->body);
+		response->body = NULL;
+		response->size = 0;
+		response->status = 304;
+		response->reason = "Not Modified";
+		return;
+	}
+	response->status = 200;
+	response->reason = "OK";
+}
+
+static int respond(int fd, const mock_config_t* config, const char* request, const char* path,
+		unsigned int* seed) {
+	const int throttled = !throttleAdmit(config);
+	sleepMs(responseDelay(config, seed));
+
+	char if_none_match[256];
+	char if_modified_since[256];
+	const int has_if_none_match = requestHeader(request, "If-None-Match", if_none_match, sizeof if_none_match);
+	const int has_if_modified_since = requestHeader(request, "If-Modified-Since", if_modified_since,
+		sizeof if_modified_since);
+	mock_response_t response;
+	buildResponse(config, path, has_if_none_match ? if_none_match : NULL,
+		has_if_modified_since ? if_modified_since : NULL, throttled, seed, &response);
+
+	char header[512];
+	int length = snprintf(header, sizeof header, "HTTP/1.1 %d %s\r\n", response.status, response.reason);
+	if (response.status != 304) {
+		length += snprintf(&header[length], sizeof header - (size_t)length, "%sContent-Length: %zu\r\n",
+			response.body ? "Content-Type: text/html\r\n" : "", response.size);
+	}
+	if (response.etag[0]) {
+		length += snprintf(&header[length], sizeof header - (size_t)length, "ETag: %s\r\nLast-Modified: %s\r\n",
+			response.etag, response.last_modified);
+	}
+	if (response.retry_after > 0) {
+		length += snprintf(&header[length], sizeof header - (size_t)length, "Retry-After: %ld\r\n",
+			response.retry_after);
+	}
+	snprintf(&header[length], sizeof header - (size_t)length, "\r\n");
+
+	int rc = writeAll(fd, header, strlen(header));
+	if (rc == 0 && response.body) {
+		rc = writeAll(fd, response.body, response.size);
+	}
+	free(response.body);
+	return rc;
+}
+
+#ifdef HAVE_NGHTTP2
+/* A request stream; its response is submitted once due, after the injected latency. */
+typedef struct MockStream {
+	int32_t id;
+	char path[1024];
+	char if_none_match[256];
+	char if_modified_since[256];
+	int has_if_none_match;
+	int has_if_modified_since;
+	int scheduled;             /* request complete, response not yet submitted */
+	int throttled;
+	double due;
+	mock_response_t response;
+	size_t sent;
+	struct MockStream* next;
+} mock_stream_t;
+
+typedef struct {
+	int fd;
+	const mock_config_t* config;
+	mock_stream_t* streams;
+	unsigned int* seed;
+} mock_http2_t;
+
+static void copyHeaderValue(char* out, size_t size, const uint8_t* value, size_t length) {
+	snprintf(out, size, "%.*s", (int)length, (const char*)value);
+}
+
+static ssize_t sendHttp2(nghttp2_session* session, const uint8_t* data, size_t length, int flags,
+		void* user_data) {
+	(void)session;
+	(void)flags;
+	const mock_http2_t* connection = (const mock_http2_t*)user_data;
+	return writeAll(connection->fd, (const char*)data, length) == 0 ? (ssize_t)length
+		: NGHTTP2_ERR_CALLBACK_FAILURE;
+}
+
+static int beginHttp2Headers(nghttp2_session* session, const nghttp2_frame* frame, void* user_data) {
+	if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST) {
+		return 0;
+	}
+	mock_http2_t* connection = (mock_http2_t*)user_data;
+	mock_stream_t* stream = (mock_stream_t*)calloc(1, sizeof(mock_stream_t));
+	if (!stream) {
+		return NGHTTP2_ERR_CALLBACK_FAILURE;
+	}
+	stream->id = frame->hd.stream_id;
+	stream->next = connection->streams;
+	connection->streams = stream;
+	nghttp2_session_set_stream_user_data(session, stream->id, stream);
+	return 0;
+}
+
+static int onHttp2Header(nghttp2_session* session, const nghttp2_frame* frame, const uint8_t* name,
+		size_t name_length, const uint8_t* value, size_t value_length, uint8_t flags, void* user_data) {
+	(void)flags;
+	(void)user_data;
+	mock_stream_t* stream = (mock_stream_t*)nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+	if (!stream) {
+		return 0;
+	}
+	/* HTTP/2 header names arrive lower case. */
+	if (name_length == 5 && memcmp(name, ":path", 5) == 0) {
+		copyHeaderValue(stream->path, sizeof stream->path, value, value_length);
+	} else if (name_length == 13 && memcmp(name, "if-none-match", 13) == 0) {
+		copyHeaderValue(stream->if_none_match, sizeof stream->if_none_match, value, value_length);
+		stream->has_if_none_match = 1;
+	} else if (name_length == 17 && memcmp(name, "if-modified-since", 17) == 0) {
+		copyHeaderValue(stream->if_modified_since, sizeof stream->if_modified_since, value, value_length);
+		stream->has_if_modified_since = 1;
+	}
+	return 0;
+}
+
+static int onHttp2Frame(nghttp2_session* session, const nghttp2_frame* frame, void* user_data) {
+	mock_http2_t* connection = (mock_http2_t*)user_data;
+	if ((frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA)
+			|| !(frame->hd.flags & NGHTTP2_FLAG_END_STREAM)) {
+		return 0;
+	}
+	mock_stream_t* stream = (mock_stream_t*)nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+	if (stream && !stream->scheduled) {
+		stream->throttled = !throttleAdmit(connection->config);
+		stream->due = monotonicSeconds() + (double)responseDelay(connection->config, connection->seed) / 1000.0;
+		stream->scheduled = 1;
+	}
+	return 0;
+}
+
+static int closeHttp2Stream(nghttp2_session* session, int32_t stream_id, uint32_t error_code, void* user_data) {
+	(void)session;
+	(void)error_code;
+	mock_http2_t* connection = (mock_http2_t*)user_data;
+	for (mock_stream_t** link = &connection->streams; *link; link = &(*link)->next) {
+		if ((*link)->id == stream_id) {
+			mock_stream_t* stream = *link;
+			*link = stream->next;
+			free(stream->response.body);
+			free(stream);
+			break;
+		}
+	}
+	return 0;
+}
+
+static ssize_t readHttp2Body(nghttp2_session* session, int32_t stream_id, uint8_t* buf, size_t length,
+		uint32_t* data_flags, nghttp2_data_source* source, void* user_data) {
+	(void)session;
+	(void)stream_id;
+	(void)user_data;
+	mock_stream_t* stream = (mock_stream_t*)source->ptr;
+	const size_t remaining = stream->response.size - stream->sent;
+	const size_t count = remaining < length ? remaining : length;
+	memcpy(buf, &stream->response.body[stream->sent], count);
+	stream->sent += count;
+	if (stream->sent == stream->response.size) {
+		*data_flags |= NGHTTP2_DATA_FLAG_EOF;
+	}
+	return (ssize_t)count;
+}
+
+static nghttp2_nv headerPair(const char* name, const char* value) {
+	nghttp2_nv nv;
+	nv.name = (uint8_t*)(uintptr_t)name;
+	nv.namelen = strlen(name);
+	nv.value = (uint8_t*)(uintptr_t)value;
+	nv.valuelen = strlen(value);
+	nv.flags = NGHTTP2_NV_FLAG_NONE;
+	return nv;
+}
+
+static int submitHttp2Response(nghttp2_session* session, mock_http2_t* connection, mock_stream_t* stream) {
+	mock_response_t* response = &stream->response;
+	buildResponse(connection->config, stream->path, stream->has_if_none_match ? stream->if_none_match : NULL,
+		stream->has_if_modified_since ? stream->if_modified_since : NULL, stream->throttled, connection->seed,
+		response);
+
+	char status[8];
+	char length[32];
+	char retry_after[32];
+	nghttp2_nv headers[6];
+	size_t count = 0;
+	snprintf(status, sizeof status, "%d", response->status);
+	headers[count++] = headerPair(":status", status);
+	if (response->status != 304) {
+		snprintf(length, sizeof length, "%zu", response->size);
+		headers[count++] = headerPair("content-length", length);
+	}
+	if (response->body) {
+		headers[count++] = headerPair("content-type", "text/html");
+	}
+	if (response->etag[0]) {
+		headers[count++] = headerPair("etag", response->etag);
+		headers[count++] = headerPair("last-modified", response->last_modified);
+	}
+	if (response->retry_after > 0) {
+		snprintf(retry_after, sizeof retry_after, "%ld", response->retry_after);
+		headers[count++] = headerPair("retry-after", retry_after);
+	}
+
+	nghttp2_data_provider body;
+	body.source.ptr = stream;
+	body.read_callback = readHttp2Body;
+	return nghttp2_submit_response(session, stream->id, headers, count, response->body ? &body : NULL);
+}
+
+/* Decodes the base64url HTTP2-Settings header; returns the payload size, or -1 if it is malformed. */
+static long decodeSettings(const char* text, uint8_t* out, size_t capacity) {
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+	unsigned long bits = 0;
+	int bit_count = 0;
+	size_t size = 0;
+	for (const char* c = text; *c && *c != '='; ++c) {
+		const char* digit = strchr(alphabet, *c);
+		if (!digit) {
+			return -1;
+		}
+		bits = (bits << 6) | (unsigned long)(digit - alphabet);
+		bit_count += 6;
+		if (bit_count >= 8) {
+			bit_count -= 8;
+			if (size == capacity) {
+				return -1;
+			}
+			out[size++] = (uint8_t)(bits >> bit_count);
+		}
+	}
+	return (long)size;
+}
+
+/*
+ * Serves a connection as HTTP/2; data holds the bytes read after the switch.
+ * A connection that opened with the preface passes upgrade NULL. One that
+ * asked to upgrade from HTTP/1.1 passes its request, which becomes stream 1
+ * and is answered over HTTP/2.
+ */
+static void serveHttp2(int fd, const mock_config_t* config, unsigned int* seed, const char* data, size_t size,
+		const char* upgrade, const char* path) {
+	mock_http2_t connection = { fd, config, NULL, seed };
+	nghttp2_session_callbacks* callbacks = NULL;
+	nghttp2_session* session = NULL;
+	if (nghttp2_session_callbacks_new(&callbacks) != 0) {
+		return;
+	}
+	nghttp2_session_callbacks_set_send_callback(callbacks, sendHttp2);
+	nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, beginHttp2Headers);
+	nghttp2_session_callbacks_set_on_header_callback(callbacks, onHttp2Header);
+	nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, onHttp2Frame);
+	nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, closeHttp2Stream);
+	const int created = nghttp2_session_server_new(&session, callbacks, &connection);
+	nghttp2_session_callbacks_del(callbacks);
+	if (created != 0) {
+		return;
+	}
+
+	if (upgrade) {
+		char encoded[256];
+		uint8_t payload[192];
+		const long payload_size = requestHeader(upgrade, "HTTP2-Settings", encoded, sizeof encoded)
+			? decodeSettings(encoded, payload, sizeof payload) : -1;
+		mock_stream_t* stream = (mock_stream_t*)calloc(1, sizeof(mock_stream_t));
+		const char switching[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+		if (!stream || payload_size < 0 || writeAll(fd, switching, strlen(switching)) != 0
+				|| nghttp2_session_upgrade2(session, payload, (size_t)payload_size, 0, stream) != 0) {
+			free(stream);
+			goto done;
+		}
+		stream->id = 1;
+		snprintf(stream->path, sizeof stream->path, "%s", path);
+		stream->has_if_none_match = requestHeader(upgrade, "If-None-Match", stream->if_none_match,
+			sizeof stream->if_none_match);
+		stream->has_if_modified_since = requestHeader(upgrade, "If-Modified-Since", stream->if_modified_since,
+			sizeof stream->if_modified_since);
+		stream->throttled = !throttleAdmit(config);
+		stream->due = monotonicSeconds() + (double)responseDelay(config, seed) / 1000.0;
+		stream->scheduled = 1;
+		connection.streams = stream;
+	}
+
+	nghttp2_settings_entry settings[] = { { NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, HTTP2_MAX_STREAMS } };
+	nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, settings, sizeof settings / sizeof settings[0]);
+	if (size > 0 && nghttp2_session_mem_recv(session, (const uint8_t*)data, size) < 0) {
+		goto done;
+	}
+
+	/* Streams wait out their latency side by side; the poll wakes for the next one due. */
+	char buffer[REQUEST_BUFFER_SIZE];
+	for (;;) {
+		const double now = monotonicSeconds();
+		double next_due = -1.0;
+		for (mock_stream_t* stream = connection.streams; stream; stream = stream->next) {
+			if (!stream->scheduled) {
+				continue;
+			}
+			if (stream->due <= now) {
+				stream->scheduled = 0;
+				if (submitHttp2Response(session, &connection, stream) != 0) {
+					goto done;
+				}
+			} else if (next_due < 0 || stream->due < next_due) {
+				next_due = stream->due;
+			}
+		}
+		if (nghttp2_session_send(session) != 0) {
+			break;
+		}
+		if (!nghttp2_session_want_read(session) && !nghttp2_session_want_write(session)) {
+			break;
+		}
+
+		struct pollfd ready = { fd, POLLIN, 0 };
+		const int timeout = next_due < 0 ? -1 : (int)ceil((next_due - monotonicSeconds()) * 1000.0);
+		const int polled = poll(&ready, 1, timeout < 0 && next_due >= 0 ? 0 : timeout);
+		if (polled < 0 && errno != EINTR) {
+			break;
+		}
+		if (polled > 0) {
+			const ssize_t received = recv(fd, buffer, sizeof buffer, 0);
+			if (received <= 0 || nghttp2_session_mem_recv(session, (const uint8_t*)buffer, (size_t)received) < 0) {
+				break;
+			}
+		}
+	}
+
+done:
+	nghttp2_session_del(session);
+	while (connection.streams) {
+		mock_stream_t* next = connection.streams->next;
+		free(connection.streams->response.body);
+		free(connection.streams);
+		connection.streams = next;
+	}
+}
+#endif
+
+static void* serveConnection(void* arg) {
+	mock_connection_t* connection = (mock_connection_t*)arg;
+	unsigned int seed = (unsigned int)time(NULL) ^ (unsigned int)connection->fd;
+	char buffer[REQUEST_BUFFER_SIZE] = {'\0'};
+	size_t used = 0;
+
+	for (;;) {
+		char* end = NULL;
+		while ((end = strstr(buffer, "\r\n\r\n")) == NULL) {
+			if (used >= sizeof buffer - 1) {
+				goto done;
+			}
+			const ssize_t received = recv(connection->fd, &buffer[used], sizeof buffer - 1 - used, 0);
+			if (received <= 0) {
+				goto done;
+			}
+			used += (size_t)received;
+			buffer[used] = '\0';
+		}
+
+		/* The preface's first line ends in a blank line too, so the rest of it may still be in flight. */
+		while (strncmp(buffer, "PRI * HTTP/2.0", 14) == 0 && used < sizeof HTTP2_PREFACE - 1) {
+			const ssize_t received = recv(connection->fd, &buffer[used], sizeof buffer - 1 - used, 0);
+			if (received <= 0) {
+				goto done;
+			}
+			used += (size_t)received;
+			buffer[used] = '\0';
+		}
+		if (used >= sizeof HTTP2_PREFACE - 1 && memcmp(buffer, HTTP2_PREFACE, sizeof HTTP2_PREFACE - 1) == 0) {
+#ifdef HAVE_NGHTTP2
+			if (connection->config->http_version != 1) {
+				serveHttp2(connection->fd, connection->config, &seed, buffer, used, NULL, NULL);
+			}
+#endif
+			goto done;
+		}
+
+		char method[16] = {'\0'};
+		char path[1024] = {'\0'};
+		if (sscanf(buffer, "%15s %1023s", method, path) != 2 || strcmp(method, "GET") != 0) {
+			const char bad_request[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n"
+				"Connection: close\r\n\r\n";
+			writeAll(connection->fd, bad_request, strlen(bad_request));
+			goto done;
+		}
+		const size_t consumed = (size_t)(end - buffer) + 4;
+
+#ifdef HAVE_NGHTTP2
+		char upgrade[32];
+		if (connection->config->http_version != 1 && requestHeader(buffer, "Upgrade", upgrade, sizeof upgrade)
+				&& strcmp(upgrade, "h2c") == 0) {
+			end[2] = '\0';   /* the request ends its own headers for requestHeader() */
+			serveHttp2(connection->fd, connection->config, &seed, &buffer[consumed], used - consumed, buffer, path);
+			goto done;
+		}
+#endif
+		if (connection->config->http_version == 2) {
+			const char unsupported[] = "HTTP/1.1 505 HTTP Version Not Supported\r\nContent-Length: 0\r\n"
+				"Connection: close\r\n\r\n";
+			writeAll(connection->fd, unsupported, strlen(unsupported));
+			goto done;
+		}
+		const int close_after = strcasestr(buffer, "Connection: close") != NULL;
+
+		if (respond(connection->fd, connection->config, buffer, path, &seed) != 0 || close_after) {
+			goto done;
+		}
+
+		/* Keep any pipelined bytes that followed this request. */
+		memmove(buffer, &buffer[consumed], used - consumed + 1);
+		used -= consumed;
+	}
+
+done:
+	close(connection->fd);
+	free(connection);
+	return NULL;
+}
+
+int main(int argc, char* argv[]) {
+	mock_config_t config;
+	parseArgs(argc, argv, &config);
+	signal(SIGPIPE, SIG_IGN);
+
+	const int server = socket(AF_INET, SOCK_STREAM, 0);
+	if (server < 0) {
+		perror("Failed to create socket");
+		exit(EXIT_FAILURE);
+	}
+	const int reuse = 1;
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof address);
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons((unsigned short)config.port);
+	if (bind(server, (struct sockaddr*)&address, sizeof address) != 0 || listen(server, 128) != 0) {
+		perror("Failed to listen");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(stderr, "Serving %s on http://127.0.0.1:%d/\n", config.root, config.port);
+
+	for (;;) {
+		const int fd = accept(server, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("accept() failed");
+			break;
+		}
+		/* Headers and body go out in separate writes; Nagle would hold the body for the client's delayed ACK. */
+		const int nodelay = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof nodelay);
+
+		mock_connection_t* connection = (mock_connection_t*)malloc(sizeof(mock_connection_t));
+		connection->fd = fd;
+		connection->config = &config;
+
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, serveConnection, connection) != 0) {
+			close(fd);
+			free(connection);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+
+	close(server);
+	return EXIT_SUCCESS;
+}
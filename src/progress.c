@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "log.h"
+#include "progress.h"
+
+struct Progress {
+	const char* kind;
+	sqlite3_stmt* mark_stmt;
+	int64_t* done;   /* sorted, for bsearch */
+	long done_count;
+};
+
+static const char* status_names[] = { "done", "failed" };
+
+static sqlite3_stmt* prepareOrExit(sqlite3* db, const char* sql) {
+	sqlite3_stmt* stmt = NULL;
+	if (sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare '%s' with error: %s\n", sql, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		exit(EXIT_FAILURE);
+	}
+	return stmt;
+}
+
+static void forget(sqlite3* db, const char* kind) {
+	sqlite3_stmt* stmt = prepareOrExit(db, "DELETE FROM progress WHERE kind = ?;");
+	sqlite3_bind_text(stmt, 1, kind, -1, SQLITE_STATIC);
+	if (sqlite3_step(stmt) != SQLITE_DONE) {
+		fprintf(stderr, "Failed to clear the %s progress with error: %s\n", kind, sqlite3_errmsg(db));
+	}
+	sqlite3_finalize(stmt);
+}
+
+static void loadDone(progress_t* progress, sqlite3* db) {
+	/* The primary key keeps each kind's items in order, so the array comes out sorted. */
+	sqlite3_stmt* stmt = prepareOrExit(db, "SELECT item FROM progress WHERE kind = ? AND status = 'done' "
+		"ORDER BY item;");
+	sqlite3_bind_text(stmt, 1, progress->kind, -1, SQLITE_STATIC);
+	long capacity = 0;
+	int rc;
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if (progress->done_count == capacity) {
+			capacity = capacity > 0 ? capacity * 2 : 1024;
+			int64_t* grown = (int64_t*)realloc(progress->done, (size_t)capacity * sizeof(int64_t));
+			if (!grown) {
+				fprintf(stderr, "Failed to load the %s progress.\n", progress->kind);
+				exit(EXIT_FAILURE);
+			}
+			progress->done = grown;
+		}
+		progress->done[progress->done_count++] = sqlite3_column_int64(stmt, 0);
+	}
+	if (rc != SQLITE_DONE) {
+		fprintf(stderr, "Failed to read the %s progress with error: %s\n", progress->kind, sqlite3_errmsg(db));
+	}
+	sqlite3_finalize(stmt);
+}
+
+progress_t* progressOpen(sqlite3* db, const char* kind, int resume) {
+	char* err = NULL;
+	if (sqlite3_exec(db, PROGRESS_CREATE_STMT, NULL, NULL, &err) != SQLITE_OK) {
+		fprintf(stderr, "Failed to create the progress table: %s\n", err);
+		sqlite3_free(err);
+		sqlite3_close(db);
+		exit(EXIT_FAILURE);
+	}
+	progress_t* progress = (progress_t*)calloc(1, sizeof(progress_t));
+	if (!progress) {
+		fprintf(stderr, "Failed to allocate the %s progress.\n", kind);
+		exit(EXIT_FAILURE);
+	}
+	progress->kind = kind;
+	if (resume) {
+		loadDone(progress, db);
+	} else {
+		forget(db, kind);
+	}
+	progress->mark_stmt = prepareOrExit(db, "INSERT OR REPLACE INTO progress ( kind, item, status, updated_at ) "
+		"VALUES ( ?, ?, ?, strftime('%s', 'now') );");
+	return progress;
+}
+
+static int compareItems(const void* a, const void* b) {
+	const int64_t left = *(const int64_t*)a;
+	const int64_t right = *(const int64_t*)b;
+	return (left > right) - (left < right);
+}
+
+int progressIsDone(const progress_t* progress, int64_t item) {
+	return progress->done_count > 0
+		&& bsearch(&item, progress->done, (size_t)progress->done_count, sizeof(int64_t), compareItems) != NULL;
+}
+
+long progressDoneCount(const progress_t* progress) {
+	return progress->done_count;
+}
+
+int progressMark(progress_t* progress, int64_t item, progress_status_t status) {
+	sqlite3_stmt* stmt = progress->mark_stmt;
+	sqlite3_bind_text(stmt, 1, progress->kind, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 2, item);
+	sqlite3_bind_text(stmt, 3, status_names[status], -1, SQLITE_STATIC);
+	const int rc = sqlite3_step(stmt);
+	if (rc != SQLITE_DONE) {
+		logError("Failed to record the progress of %s %lld with error: %s\n", progress->kind, (long long)item,
+			sqlite3_errmsg(sqlite3_db_handle(stmt)));
+	}
+	sqlite3_reset(stmt);
+	return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+void progressClose(progress_t* progress) {
+	sqlite3_finalize(progress->mark_stmt);
+	free(progress->done);
+	free(progress);
+}
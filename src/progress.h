@@ -0,0 +1,42 @@
+#ifndef ZIP_CODES_PROGRESS_H
+#define ZIP_CODES_PROGRESS_H
+
+#include <stdint.h>
+#include <sqlite3.h>
+
+/* kind is "zip" for read_list and "county" for get-zip-codes; item is the zip code or county_id. */
+#define PROGRESS_CREATE_STMT "CREATE TABLE IF NOT EXISTS progress ( " \
+	"kind TEXT NOT NULL, " \
+	"item INTEGER NOT NULL, " \
+	"status TEXT NOT NULL, " \
+	"updated_at INTEGER NOT NULL, " \
+	"PRIMARY KEY ( kind, item ) ) WITHOUT ROWID;"
+
+typedef enum ProgressStatus {
+	PROGRESS_DONE,     /* its rows are committed; skipped on the next run */
+	PROGRESS_FAILED    /* every attempt failed; fetched again on the next run */
+} progress_status_t;
+
+typedef struct Progress progress_t;
+
+/*
+ * Opens the progress of one kind of item in db, creating the table when
+ * needed. With resume the items already done are loaded so the caller can
+ * skip them; without it the kind's rows are cleared and the run starts over.
+ */
+progress_t* progressOpen(sqlite3* db, const char* kind, int resume);
+
+int progressIsDone(const progress_t* progress, int64_t item);
+long progressDoneCount(const progress_t* progress);
+
+/*
+ * Records an item's status. Call it from the database writer's write_row
+ * callback, so the status commits in the same transaction as the item's rows
+ * and a crash can never leave an item marked done without its data.
+ */
+int progressMark(progress_t* progress, int64_t item, progress_status_t status);
+
+/* Finalizes the statement; call before closing db. */
+void progressClose(progress_t* progress);
+
+#endif
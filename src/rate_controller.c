@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+
+#include "log.h"
+#include "rate_controller.h"
+
+void rateControllerInit(rate_controller_t* controller, const rate_controller_config_t* config, double now) {
+	controller->config = *config;
+	if (controller->config.min_rate <= 0) {
+		controller->config.min_rate = RATE_MIN_REQUESTS_PER_SEC;
+	}
+	if (controller->config.max_rate > 0 && controller->config.min_rate > controller->config.max_rate) {
+		controller->config.min_rate = controller->config.max_rate;
+	}
+
+	controller->rate = controller->config.initial_rate;
+	if (controller->rate <= 0 || (controller->config.max_rate > 0 && controller->rate > controller->config.max_rate)) {
+		controller->rate = controller->config.max_rate;
+	}
+	if (controller->config.max_rate > 0 && controller->rate < controller->config.min_rate) {
+		controller->rate = controller->config.min_rate;
+	}
+
+	controller->tokens = 1.0;
+	controller->last_refill = now;
+	controller->latency_baseline = 0.0;
+	controller->latency_samples = 0;
+	controller->last_decrease = 0.0;
+	controller->paused_until = 0.0;
+}
+
+static void refillTokens(rate_controller_t* controller, double now) {
+	controller->tokens += (now - controller->last_refill) * controller->rate;
+	if (controller->tokens > 1.0) {
+		controller->tokens = 1.0;
+	}
+	controller->last_refill = now;
+}
+
+int rateControllerTryAcquire(rate_controller_t* controller, double now) {
+	if (now < controller->paused_until) {
+		return 0;
+	}
+	if (controller->config.max_rate <= 0) {
+		return 1;
+	}
+
+	refillTokens(controller, now);
+	if (controller->tokens >= 1.0) {
+		controller->tokens -= 1.0;
+		return 1;
+	}
+	return 0;
+}
+
+long rateControllerWaitMs(const rate_controller_t* controller, double now) {
+	if (now < controller->paused_until) {
+		return (long)((controller->paused_until - now) * 1000.0) + 1;
+	}
+	if (controller->config.max_rate <= 0) {
+		return 0;
+	}
+
+	const double tokens = controller->tokens + (now - controller->last_refill) * controller->rate;
+	if (tokens >= 1.0) {
+		return 0;
+	}
+	return (long)((1.0 - tokens) / controller->rate * 1000.0) + 1;
+}
+
+static void decreaseRate(rate_controller_t* controller, double now, const char* reason) {
+	/* One cut per baseline latency: responses already in flight report the same overload. */
+	const double hold = controller->latency_baseline > 1.0 ? controller->latency_baseline : 1.0;
+	if (now - controller->last_decrease < hold) {
+		return;
+	}
+	controller->last_decrease = now;
+
+	if (controller->config.max_rate <= 0) {
+		return;
+	}
+
+	refillTokens(controller, now);
+	controller->rate *= RATE_DECREASE_FACTOR;
+	if (controller->rate < controller->config.min_rate) {
+		controller->rate = controller->config.min_rate;
+	}
+	logInfo("Rate cut to %.2f requests/sec (%s).\n", controller->rate, reason);
+}
+
+static void increaseRate(rate_controller_t* controller, double now) {
+	if (controller->config.max_rate <= 0 || controller->rate >= controller->config.max_rate) {
+		return;
+	}
+
+	/* Each response is 1/rate seconds of traffic, so this adds RATE_ADDITIVE_STEP per second. */
+	refillTokens(controller, now);
+	controller->rate += RATE_ADDITIVE_STEP / controller->rate;
+	if (controller->rate > controller->config.max_rate) {
+		controller->rate = controller->config.max_rate;
+	}
+}
+
+/* Transport failures that mean the server or the path to it is not keeping up. */
+static const char* overloadFailure(CURLcode result) {
+	switch (result) {
+	case CURLE_OPERATION_TIMEDOUT: return "timeout";
+	case CURLE_COULDNT_CONNECT: return "connection refused";
+	case CURLE_GOT_NOTHING: return "empty reply";
+	case CURLE_SEND_ERROR:
+	case CURLE_RECV_ERROR:
+	case CURLE_PARTIAL_FILE:
+	case CURLE_HTTP2:
+	case CURLE_HTTP2_STREAM: return "connection reset";
+	default: return NULL;
+	}
+}
+
+void rateControllerOnResponse(rate_controller_t* controller, CURLcode result, long response_code,
+		double total_time, long retry_after, double now) {
+	if (retry_after > 0) {
+		if (now + retry_after > controller->paused_until) {
+			controller->paused_until = now + retry_after;
+		}
+		logWarn("Server asked to retry after %ld seconds.\n", retry_after);
+		decreaseRate(controller, now, "Retry-After");
+		return;
+	}
+
+	if (result != CURLE_OK) {
+		const char* failure = overloadFailure(result);
+		if (failure) {
+			decreaseRate(controller, now, failure);
+		}
+		return;
+	}
+
+	switch (response_code) {
+	case 429: decreaseRate(controller, now, "429 Too Many Requests"); return;
+	case 500: decreaseRate(controller, now, "500 Internal Server Error"); return;
+	case 502: decreaseRate(controller, now, "502 Bad Gateway"); return;
+	case 503: decreaseRate(controller, now, "503 Service Unavailable"); return;
+	case 504: decreaseRate(controller, now, "504 Gateway Timeout"); return;
+	default: break;
+	}
+
+	if (response_code == 0 || response_code >= 500) {
+		return;
+	}
+
+	const int spike = controller->latency_samples >= RATE_LATENCY_WARMUP_SAMPLES
+		&& total_time > controller->latency_baseline * RATE_LATENCY_SPIKE_FACTOR;
+
+	if (controller->latency_samples == 0) {
+		controller->latency_baseline = total_time;
+	} else {
+		controller->latency_baseline += RATE_LATENCY_EWMA_ALPHA * (total_time - controller->latency_baseline);
+	}
+	controller->latency_samples++;
+
+	if (spike) {
+		decreaseRate(controller, now, "latency spike");
+	} else {
+		increaseRate(controller, now);
+	}
+}
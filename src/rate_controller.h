@@ -0,0 +1,43 @@
+#ifndef ZIP_CODES_RATE_CONTROLLER_H
+#define ZIP_CODES_RATE_CONTROLLER_H
+
+#include <curl/curl.h>
+
+#define RATE_MIN_REQUESTS_PER_SEC 0.1
+#define RATE_ADDITIVE_STEP 0.25          /* requests/sec gained per second of healthy responses */
+#define RATE_DECREASE_FACTOR 0.5         /* rate multiplier on a congestion signal */
+#define RATE_LATENCY_SPIKE_FACTOR 3.0    /* total time above this multiple of the baseline is a spike */
+#define RATE_LATENCY_WARMUP_SAMPLES 10   /* responses before latency spikes are trusted */
+#define RATE_LATENCY_EWMA_ALPHA 0.1
+
+typedef struct RateControllerConfig {
+	double initial_rate;   /* requests/sec to start at */
+	double max_rate;       /* politeness ceiling, <= 0 disables pacing */
+	double min_rate;       /* floor for multiplicative decrease */
+} rate_controller_config_t;
+
+/*
+ * Additive-increase/multiplicative-decrease request pacing. Healthy responses
+ * raise the rate towards max_rate; 429, 500, 502, 503 and 504 responses,
+ * timeouts and dropped connections, Retry-After headers and latency spikes
+ * cut it, at most once per baseline latency so a burst of
+ * failures from one overload event counts only once.
+ */
+typedef struct RateController {
+	rate_controller_config_t config;
+	double rate;
+	double tokens;
+	double last_refill;
+	double latency_baseline;
+	long latency_samples;
+	double last_decrease;
+	double paused_until;
+} rate_controller_t;
+
+void rateControllerInit(rate_controller_t* controller, const rate_controller_config_t* config, double now);
+int rateControllerTryAcquire(rate_controller_t* controller, double now);
+long rateControllerWaitMs(const rate_controller_t* controller, double now);
+void rateControllerOnResponse(rate_controller_t* controller, CURLcode result, long response_code,
+	double total_time, long retry_after, double now);
+
+#endif
@@ -4,51 +4,54 @@
 #include <curl/curl.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sds.h>
 #include <unistd.h>
 #include <sqlite3.h>
+#include "alloc_stats.h"
+#include "arena.h"
+#include "config.h"
+#include "county_dict.h"
+#include "db_writer.h"
+#include "fetch_engine.h"
+#include "log.h"
+#include "metrics.h"
+#include "progress.h"
+#include "replay.h"
+#include "trace.h"
+#include "zip_code_db.h"
+#include "zip_page_parser.h"
 
 #define STATE_NAME "ca"
 #define COUNTY_NAME "el_dorado"
 #define BASE_URL "http://www.city-data.com/zips/"
+#define FETCH_STATE_DIR ".fetch-state"
+#define HTTP_CACHE_DIR ".http-cache"
+#define METRICS_PREFIX "read_list-metrics"
 #define SQLITE3_DB_NAME "zip_codes_db.sqlite3"
 
+/* Politeness budget for city-data.com, overridable from the environment. */
+#define DEFAULT_MAX_IN_FLIGHT 8
+#define DEFAULT_MAX_PER_HOST 4
+#define DEFAULT_START_REQUESTS_PER_SEC 0.6
+#define DEFAULT_MAX_REQUESTS_PER_SEC 2.0
+#define URL_SIZE 256
+#define DEFAULT_RESUME 1   /* skip the zip codes an earlier run finished */
+
 typedef struct ZipCode {
-	char state[8];
-	char county[64];
-	char* code;
+	county_id_t county_id;
+	char code[8];
 	struct ZipCode* next;
 } ZipCode;
 
-typedef struct MemoryBuffer {
-	char* memory;
-	size_t size;
-} MemoryBuffer;
-
-typedef struct ZipCodeRecord {
-	char* state;
-	char* county;
-	char* code;
-	char* population;
-	char* population2010;
-	char* population2000;
-	char* medianHouseholdIncome;
-	char* foreignBornPopulation;
-	char* medianHomePrice;
-	char* landArea;
-	char* medianResidentAge;
-	char* malePercent;
-	char* femalePercent;
-	char* whitePopulation;
-	char* hispanicLatinoPopulation;
-	char* blackPopulation;
-	char* asianPopulation;
-	char* americanIndianPopulation;
-	char* highSchool;
-	char* bachelorsDegree;
-	char* graduateDegree;
-	char* averageHouseholdSize;
-} ZipCodeRecord;
+typedef struct ZipCodeFetch {
+	ZipCode* zip;
+	ZipCodeRecord* record;
+	int fetched;
+} ZipCodeFetch;
+
+typedef struct ZipCodeSink {
+	db_writer_t* writer;
+	const county_dict_t* counties;
+} ZipCodeSink;
 
 const char INPUT_FILE_NAME[] = "zip_code_list_" STATE_NAME "_" COUNTY_NAME ".txt";
 const char OUTPUT_FILE_NAME[] = "zip_code_data_" STATE_NAME "_" COUNTY_NAME ".csv";
@@ -69,29 +72,12 @@ static void closeFile(FILE* fp) {
 	}
 }
 
-static ZipCode* loadLinkedList(FILE* fp) {
-	char zip_code[8];
-	ZipCode* list_head = (ZipCode*)malloc(sizeof(struct ZipCode));
-	
-	ZipCode* prev = list_head;
-	for (; fscanf(fp, "%s", zip_code) != EOF; ) {
-		prev->code = (char*)malloc(8 * sizeof(char));
-		strcpy(prev->code, zip_code);
-		ZipCode* next = (ZipCode*)malloc(sizeof(struct ZipCode));
-		prev->next = next;
-		prev = next;
-	}
-	prev->code = NULL;
-	prev->next = NULL;
-
-	return list_head;
-}
-
-static ZipCode* loadLinkedListFromSqlite(sqlite3* db) {
-	ZipCode* list_head = (ZipCode*)malloc(sizeof(struct ZipCode));
+static ZipCode* loadLinkedListFromSqlite(sqlite3* db, arena_t* arena) {
+	ZipCode* list_head = (ZipCode*)arenaAlloc(arena, sizeof(struct ZipCode));
 	char *err = NULL;
-	const char *select_stmt = "SELECT * FROM zip_codes_by_county WHERE state='wy' ORDER BY "
-		"state ASC, county ASC, zip_code ASC";
+	const char *select_stmt = "SELECT z.zip_code, z.county_id FROM zip_codes_by_county z "
+		"JOIN counties c ON c.county_id = z.county_id WHERE c.state='wy' ORDER BY "
+		"c.state ASC, c.county ASC, z.zip_code ASC";
 	int nRows = 0;
 	int nCols = 0;
 	char **result = NULL;
@@ -104,16 +90,13 @@ static ZipCode* loadLinkedListFromSqlite(sqlite3* db) {
 
 	ZipCode* prev = list_head;
 	for (int i=1; i<=nRows; ++i) {
-		prev->code = (char*)malloc(8 * sizeof(char));
-		strcpy(prev->code, result[i*nCols]);
-		strcpy(prev->state, result[i*nCols+1]);
-		strcpy(prev->county, result[i*nCols+2]);
+		snprintf(prev->code, sizeof prev->code, "%s", result[i*nCols]);
+		prev->county_id = (county_id_t)strtol(result[i*nCols+1], NULL, 10);
 
-		ZipCode* next = (ZipCode*)malloc(sizeof(struct ZipCode));
+		ZipCode* next = (ZipCode*)arenaAlloc(arena, sizeof(struct ZipCode));
 		prev->next = next;
 		prev = next;
 	}
-	prev->code = NULL;
 	prev->next = NULL;
 
 	sqlite3_free_table(result);
@@ -121,45 +104,13 @@ static ZipCode* loadLinkedListFromSqlite(sqlite3* db) {
 	return list_head;
 }
 
-static void freeLinkedList(ZipCode* list_head) {
-	ZipCode* prevZip = list_head;
-	while (1) {
-		if (prevZip->next == NULL) {
-			free(prevZip->code);
-			free(prevZip);
-			break;
-		}
-
-		free(prevZip->code);
-		ZipCode* last = prevZip;	
-		prevZip = prevZip->next;
-		free(last);
-	}
-}
-
-static size_t writeCallback(void *contents, size_t size, size_t nmemb, void *userp) {
-	size_t rsz = size * nmemb;
-	MemoryBuffer* mem = (MemoryBuffer*)userp;
-	char* ptr = realloc(mem->memory, mem->size + rsz + 1);
-
-	if (ptr == NULL) {
-		fprintf(stderr, "Insufficient memory (realloc returned NULL)...\n");
-		return 0;
-	}
-
-	mem->memory = ptr;
-	memcpy(&(mem->memory[mem->size]), contents, rsz);
-	mem->size += rsz;
-	mem->memory[mem->size] = 0;
-	return rsz;
-}
-
 CURL* initCurl(void) {
 	CURL* curl = curl_easy_init();
 	if (!curl) {
 		fprintf(stderr, "Failed to initialize curl.\n");
 		exit(EXIT_FAILURE);
 	}
+	curl_easy_setopt(curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");
 	return curl;
 }
 
@@ -175,31 +126,18 @@ static void openDb(sqlite3** db) {
 }
 
 static void initDb(sqlite3** db) {
-	fprintf(stderr, "About to create the table named 'zip_codes'.\n");
 	char *error_message = NULL;
-	char *create_stmt = "CREATE TABLE IF NOT EXISTS zip_codes ( "
-		"zip_code INTEGER PRIMARY KEY, "
-		"state TEXT, "
-		"county TEXT, "
-		"population INTEGER, "
-		"population_2010 INTEGER, "
-		"population_2000 INTEGER, "
-		"land_area REAL, "
-		"foreign_born_population REAL, "
-		"median_household_income INTEGER, "
-		"median_home_price INTEGER, "
-		"median_resident_age REAL, "
-		"white_population INTEGER, "
-		"hispanic_population INTEGER, "
-		"black_population INTEGER, "
-		"asian_population INTEGER, "
-		"american_indian_population INTEGER, "
-		"high_school REAL, "
-		"bachelors_degree REAL, "
-		"graduate_degree REAL, "
-		"male_percent REAL, "
-		"female_percent REAL, "
-		"average_household_size REAL );";
+	if (sqlite3_exec(*db, COUNTIES_CREATE_STMT, NULL, NULL, &error_message) != SQLITE_OK) {
+		fprintf(stderr, "Failed to create the counties table: %s\n", error_message);
+		sqlite3_free(error_message);
+		sqlite3_close( *db );
+		exit( EXIT_FAILURE );
+	}
+	dbMigrateCountyColumns(*db, "zip_codes_by_county", ZIP_CODES_BY_COUNTY_CREATE_STMT);
+	dbMigrateCountyColumns(*db, "zip_codes", ZIP_CODES_CREATE_STMT);
+
+	fprintf(stderr, "About to create the table named 'zip_codes'.\n");
+	const char *create_stmt = ZIP_CODES_CREATE_STMT;
 	int rc = sqlite3_exec(*db, create_stmt, NULL, NULL, &error_message);
 	if ( rc != SQLITE_OK ) {
 		fputs("Failed to create table.\n", stderr);
@@ -212,458 +150,132 @@ static void initDb(sqlite3** db) {
 	}
 }
 
-static void beginTransaction(sqlite3* db) {
-	char *error_message = NULL;
-	int rc = sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, &error_message);
-	if ( rc != SQLITE_OK ) {
-		fprintf(stderr, "Failed to 'BEGIN TRANSACTION' with error: %s\n", error_message);
-		sqlite3_free(error_message);
+/* A fetched zip's row and its progress commit together; a failed zip only records the failure. */
+static int writeFetchedZip(sqlite3_stmt* stmt, void* row, void* userdata) {
+	ZipCodeFetch* fetch = (ZipCodeFetch*)row;
+	progress_t* progress = (progress_t*)userdata;
+	const int64_t code = strtol(fetch->zip->code, NULL, 10);
+	if (!fetch->fetched) {
+		return progressMark(progress, code, PROGRESS_FAILED);
 	}
+	const int rc = insertZipCodeRecord(stmt, fetch->record);
+	return rc == SQLITE_OK ? progressMark(progress, code, PROGRESS_DONE) : rc;
 }
 
-static void commitTransaction(sqlite3* db) {
-	char *error_message = NULL;
-	int rc = sqlite3_exec(db, "COMMIT", NULL, NULL, &error_message);
-	if ( rc != SQLITE_OK ) {
-		fprintf(stderr, "Failed to commit transaction with error: %s\n", error_message);
-		sqlite3_free(error_message);
-	}
+static void beginZipPage(void* state, void* userdata) {
+	(void)userdata;
+	zipPageParserInit((zip_page_parser_t*)state);
 }
 
-static void doInsert(sqlite3* db, char* stmt) {
-	char *error_message = NULL;
-	printf("insert stmt = %s\n", stmt);
-	int rc = sqlite3_exec(db, stmt, NULL, NULL, &error_message);
-	if ( rc != SQLITE_OK ) {
-		fprintf(stderr, "Failed to execute insert stmt with error: %s\n", error_message);
-		sqlite3_free(error_message);
-	}
+static int feedZipPage(void* state, const char* data, size_t size) {
+	return zipPageParserFeed((zip_page_parser_t*)state, data, size);
 }
 
-static void removeCommasFromNumber(char* output, char* input) {
-	char *rest = input;
-	for (char *token = strtok_r(rest, ",", &rest); token; token = strtok_r(rest, ",", &rest)) {
-		strcat(output, token);
-	} 
-	if (strlen(output) == 0) {
-		strcat(output, "0");
-	}
+static void endZipPage(void* state) {
+	zipPageParserFinish((zip_page_parser_t*)state);
 }
 
-static void percentToFraction(char* output, char* input) {
-	if (strlen(input) == 0) {
-		output = "0.0";
-		return;
-	}
+static size_t saveZipPage(const void* state, char* out, size_t capacity) {
+	return zipPageParserSave((const zip_page_parser_t*)state, out, capacity);
+}
 
-	char intermediate[8] = {'\0'};
-	char* end;
-	strncpy(intermediate, input, strlen(input) - 1);
-	float intermediateFloat = strtof(intermediate, &end);
-	intermediateFloat /= 100.0f;
-	sprintf(output, "%.4f", intermediateFloat);
+static int restoreZipPage(void* state, const char* data, size_t size) {
+	return zipPageParserRestore((zip_page_parser_t*)state, data, size);
 }
 
-static void allocateRecordField(char** field, size_t size, char initialValue[]) {
-	char nullStr[12] = {'\0'};
-	*field = (char*)malloc(size * sizeof(char));
-	strncpy(*field, nullStr, size);
-	if (initialValue != NULL) {
-		strcpy(*field, initialValue);
-	}
+static void exportZipPage(ZipCodeSink* sink, ZipCodeFetch* fetch, const zip_page_parser_t* parser) {
+	fetch->fetched = 1;
+
+	ZipCodeRecord* record = fetch->record;
+	logDebug("zip code = %s\n", fetch->zip->code);
+	logDebug("state = %s\n", countyDictState(sink->counties, fetch->zip->county_id));
+	record->code = (int32_t)strtol(fetch->zip->code, NULL, 10);
+	record->county_id = fetch->zip->county_id;
+	zipPageParserCopy(parser, record);
+	dbWriterPush(sink->writer, fetch);
 }
 
-static void allocateZipCodeRecords(int32_t recordCount, ZipCodeRecord records[]) {
-	for (int32_t i = 0; i < recordCount; ++i) {
-		allocateRecordField(&records[i].code, 8, NULL);
-		allocateRecordField(&records[i].state, 8, "");
-		allocateRecordField(&records[i].county, 64, "");
-		allocateRecordField(&records[i].population, 10, "0");
-		allocateRecordField(&records[i].population2010, 10, "0");
-		allocateRecordField(&records[i].population2000, 10, "0");
-		allocateRecordField(&records[i].medianHouseholdIncome, 12, "0");
-		allocateRecordField(&records[i].foreignBornPopulation, 10, "0.0");
-		allocateRecordField(&records[i].medianHomePrice, 12, "0");
-		allocateRecordField(&records[i].landArea, 10, "0");
-		allocateRecordField(&records[i].medianResidentAge, 8, "0.0");
-		allocateRecordField(&records[i].whitePopulation, 10, "0");
-		allocateRecordField(&records[i].hispanicLatinoPopulation, 10, "0");
-		allocateRecordField(&records[i].blackPopulation, 10, "0");
-		allocateRecordField(&records[i].asianPopulation, 10, "0");
-		allocateRecordField(&records[i].americanIndianPopulation, 10, "0");
-		allocateRecordField(&records[i].highSchool, 8, "0.0");
-		allocateRecordField(&records[i].bachelorsDegree, 8, "0.0");
-		allocateRecordField(&records[i].graduateDegree, 8, "0.0");
-		allocateRecordField(&records[i].malePercent, 8, "0.0");
-		allocateRecordField(&records[i].femalePercent, 8, "0.0");
-		allocateRecordField(&records[i].averageHouseholdSize, 8, "0.0");
+static void onZipCodeFetched(fetch_result_t* result, void* ctx) {
+	ZipCodeFetch* fetch = (ZipCodeFetch*)result->userdata;
+	if (!result->success) {
+		logError("Failed to fetch zip code %s, it will not be exported.\n", fetch->zip->code);
+		dbWriterPush(((ZipCodeSink*)ctx)->writer, fetch);
+		return;
 	}
+	exportZipPage((ZipCodeSink*)ctx, fetch, (const zip_page_parser_t*)result->stream_state);
 }
 
-static void freeZipCodeRecords(int32_t zip_code_count, ZipCodeRecord records[]) {
-	for (int32_t i = 0; i < zip_code_count; ++i) {
-		free(records[i].code);
-		free(records[i].state);
-		free(records[i].county);
-		free(records[i].population);
-		free(records[i].population2010);
-		free(records[i].population2000);
-		free(records[i].landArea);
-		free(records[i].foreignBornPopulation);
-		free(records[i].medianHouseholdIncome);
-		free(records[i].medianHomePrice);
-		free(records[i].medianResidentAge);
-		free(records[i].whitePopulation);
-		free(records[i].hispanicLatinoPopulation);
-		free(records[i].blackPopulation);
-		free(records[i].asianPopulation);
-		free(records[i].americanIndianPopulation);
-		free(records[i].highSchool);
-		free(records[i].bachelorsDegree);
-		free(records[i].graduateDegree);
-		free(records[i].malePercent);
-		free(records[i].femalePercent);
-		free(records[i].averageHouseholdSize);
+static void fetchZipPages(CURL* curl, const char* const* urls, ZipCodeFetch** fetches, int32_t count,
+		ZipCodeSink* sink) {
+	fetch_config_t fetch_config;
+	fetchConfigInit(&fetch_config);
+	fetch_config.max_in_flight = DEFAULT_MAX_IN_FLIGHT;
+	fetch_config.max_per_host = DEFAULT_MAX_PER_HOST;
+	fetch_config.max_requests_per_sec = DEFAULT_MAX_REQUESTS_PER_SEC;
+	fetch_config.start_requests_per_sec = DEFAULT_START_REQUESTS_PER_SEC;
+	fetch_config.state_dir = FETCH_STATE_DIR;
+	fetch_config.cache_dir = HTTP_CACHE_DIR;
+	fetchConfigFromEnv(&fetch_config);
+	fetch_engine_t* engine = fetchEngineCreate(&fetch_config, curl, onZipCodeFetched, sink);
+
+	/* Pages are parsed as they download and cut short once every field is found. */
+	fetch_stream_t page_stream;
+	page_stream.state_size = sizeof(zip_page_parser_t);
+	page_stream.begin = beginZipPage;
+	page_stream.feed = feedZipPage;
+	page_stream.end = endZipPage;
+	page_stream.save = saveZipPage;
+	page_stream.restore = restoreZipPage;
+	fetchEngineSetStream(engine, &page_stream);
+
+	for (int32_t i = 0; i < count; ++i) {
+		fetchEngineAdd(engine, urls[i], fetches[i]);
 	}
+	fetchEngineRun(engine);
+	fetchEngineDestroy(engine);
 }
 
-static void processLines(char* memory, char* code, char* state, char* county, ZipCodeRecord* record) {
-	char* token = strtok(memory, "\n");
-	char nullStr[24] = {'\0'};
-	printf("zip code = %s\n", code);
-	printf("state = %s\n", state);
-	strcpy(record->code, code);
-	strcpy(record->state, state);
-	strcpy(record->county, county);
-
-	while (token) {
-		char* zip_pop = strstr(token, "Estimated zip code population in 2016:");
-		char* zip_pop_2010 = strstr(token, "Zip code population in 2010:");
-		char* zip_pop_2000 = strstr(token, "Zip code population in 2000:");
-		char* zip_median_income = strstr(token, "Estimated median household income in 2016:");
-		char* foreign_born_pop = strstr(token, "Foreign born population:");
-		char* median_home_price = strstr(token, "Estimated median house or condo value in 2016:");
-		char* land_area_base = strstr(token, "Land area:");
-		char* median_age_base = strstr(token, "Median resident age:");
-		char* white_pop_base = strstr(token, "White population");
-		char* hispanic_pop_base = strstr(token, "Hispanic or Latino population");
-		char* black_pop_base = strstr(token, "Black population");
-		char* asian_pop_base = strstr(token, "Asian population");
-		char* american_indian_pop_base = strstr(token, "American Indian population");
-		char* high_school_base = strstr(token, "High school or higher:");
-		char* bachelors_degree_base = strstr(token, "Bachelor's degree or higher:");
-		char* graduate_degree_base = strstr(token, "Graduate or professional degree:");
-		char* male_base = strstr(token, "Males:");
-		char* female_base = strstr(token, "Females:");
-		char* avg_household_base = strstr(token, "Average household size:");
-
-		if (zip_pop != NULL) {
-			char* zip_pop_b = strstr(zip_pop, "</b>");
-			char* zip_pop_end = strstr(zip_pop_b, " ");
-			char zip_pop_end_copy[10] = {'\0'};
-			strncpy(zip_pop_end_copy, zip_pop_end, strlen(zip_pop_end) - 5);
-			sds sds_zip_pop = sdsnew(zip_pop_end_copy);
-			sdstrim(sds_zip_pop, " ");
-
-			char *noComma = (char*)malloc((strlen(sds_zip_pop) + 1) * sizeof(char));
-			strncpy(noComma, nullStr, strlen(sds_zip_pop) + 1);
-			removeCommasFromNumber(noComma, sds_zip_pop);
-
-			strcpy(record->population, noComma);
-			printf("zip population = %s\n", record->population);
-			sdsfree(sds_zip_pop);
-			free(noComma);
-		}
-
-		if (zip_pop_2010 != NULL) {
-			char* zp_2010_b = strstr(zip_pop_2010, "</b>");
-			char* zp_2010_b_end = strstr(&zp_2010_b[4], "<");
-			char zip_population_2010[10] = {'\0'};
-			strncpy(zip_population_2010, &zp_2010_b[4], strlen(&zp_2010_b[4]) - strlen(zp_2010_b_end));
-			sds sds_zp_2010 = sdsnew(zip_population_2010);
-			sdstrim(sds_zp_2010, " ");
-
-			char *noComma = (char*)malloc((strlen(sds_zp_2010) + 1) * sizeof(char));
-			strncpy(noComma, nullStr, strlen(sds_zp_2010) + 1);
-			removeCommasFromNumber(noComma, sds_zp_2010);
-
-			strcpy(record->population2010, noComma);
-			printf("zip population 2010 = %s\n", record->population2010);
-			sdsfree(sds_zp_2010);
-			free(noComma);
-		}
-
-		if (zip_pop_2000 != NULL) {
-			char* zp_2000_b = strstr(zip_pop_2000, "</b>");
-			char* zp_2000_b_end = strstr(&zp_2000_b[4], "<");
-			char zip_population_2000[10] = {'\0'};
-			strncpy(zip_population_2000, &zp_2000_b[4], strlen(&zp_2000_b[4]) - strlen(zp_2000_b_end));
-			sds sds_zp_2000 = sdsnew(zip_population_2000);
-			sdstrim(sds_zp_2000, " ");
-
-			char *noComma = (char*)malloc((strlen(sds_zp_2000) + 1) * sizeof(char));
-			strncpy(noComma, nullStr, strlen(sds_zp_2000) + 1);
-			removeCommasFromNumber(noComma, sds_zp_2000);
-
-			strcpy(record->population2000, noComma);
-			printf("zip population 2000 = %s\n", record->population2000);
-			sdsfree(sds_zp_2000);
-			free(noComma);
-		}
-		
-		if (zip_median_income != NULL) {
-			char* this_zip_code = strstr(zip_median_income, "This zip code:");
-			char* this_zip_code_p = strstr(this_zip_code, "</p>");
-			char* this_zip_code_p4 = &this_zip_code_p[4];
-			char* p4_td = strstr(this_zip_code_p4, "</td>");
-			char mhi[12] = {'\0'};
-			strncpy(mhi, this_zip_code_p4, strlen(this_zip_code_p4) - strlen(p4_td));
-			sds median_income_trim = sdsnew(mhi);
-			sdstrim(median_income_trim, "\r");
-
-			char *noComma = (char*)malloc((strlen(median_income_trim) + 1) * sizeof(char));
-			strncpy(noComma, nullStr, strlen(median_income_trim) + 1);
-			removeCommasFromNumber(noComma, &median_income_trim[1]);
-
-			strcpy(record->medianHouseholdIncome, noComma);
-			printf("median household income = %s\n", record->medianHouseholdIncome);
-			sdsfree(median_income_trim);
-			free(noComma);
-		}
-
-		if (foreign_born_pop != NULL) {
-			char* fb_b = strstr(foreign_born_pop, "</b>");
-			char* fb_b_open_parens = strstr(fb_b, "(");
-			char* fb_b_close_parens = strstr(fb_b_open_parens, ")");
-			char fb_out[10] = {'\0'};
-			strncpy(fb_out, fb_b_open_parens, strlen(fb_b_open_parens) - strlen(fb_b_close_parens));
-			char fb_fraction[10] = {'\0'};
-			percentToFraction(fb_fraction, &fb_out[1]);
-			strcpy(record->foreignBornPopulation, fb_fraction);
-			printf("foreign born population = %s\n", record->foreignBornPopulation);
-		}
-
-		if (median_home_price != NULL) {
-			char* med_home_price_b = strstr(median_home_price, "</b>");
-			sds med_home_price = sdsnew(&med_home_price_b[4]);
-			sdstrim(med_home_price, "\r");
-
-			char *noComma = (char*)malloc((strlen(med_home_price) + 1) * sizeof(char));
-			strncpy(noComma, nullStr, strlen(med_home_price) + 1);
-			removeCommasFromNumber(noComma, &med_home_price[1]);
-
-			strcpy(record->medianHomePrice, noComma);
-			printf("med home price = %s\n", record->medianHomePrice);
-			sdsfree(med_home_price);
-			free(noComma);
-		}
-
-		if (land_area_base != NULL) {
-			char* land_area_b = strstr(land_area_base, "</b>");
-			char* sqmi_start = &land_area_b[5];
-			char* sqmi_end = strstr(sqmi_start, " ");
-			char sqmi[10] = {'\0'};
-			strncpy(sqmi, sqmi_start, strlen(sqmi_start) - strlen(sqmi_end));
-
-			char *noComma = (char*)malloc((strlen(sqmi) + 1) * sizeof(char));
-			strncpy(noComma, nullStr, strlen(sqmi) + 1);
-			removeCommasFromNumber(noComma, sqmi);
-
-			strcpy(record->landArea, noComma);
-			printf("zip land area = %s\n", record->landArea);
-			free(noComma);
-		}
-
-		if (median_age_base != NULL) {
-			char* med_age_p = strstr(median_age_base, "</p>");
-			if (med_age_p) {
-				char* med_age_start = &med_age_p[4];
-				char* med_age_space = strstr(med_age_start, " ");
-				char median_age[8] = {'\0'};
-				strncpy(median_age, med_age_start, strlen(med_age_start) - strlen(med_age_space));
-				strcpy(record->medianResidentAge, median_age);
-				printf("median age = %s\n", record->medianResidentAge);
-			}
-		}
-
-		if (white_pop_base != NULL) {
-			char* white_pop_start_1 = strstr(token, "'badge'>");
-			if (white_pop_start_1) {
-				char* gt = strstr(white_pop_start_1, ">");
-				char* lt = strstr(white_pop_start_1, "<");
-				char white_population[10] = {'\0'};
-				strncpy(white_population, &gt[1], strlen(&gt[1]) - strlen(lt));
-
-				char *noComma = (char*)malloc((strlen(white_population) + 1) * sizeof(char));
-				strncpy(noComma, nullStr, strlen(white_population) + 1);
-				removeCommasFromNumber(noComma, white_population);
-
-				strcpy(record->whitePopulation, noComma);
-				printf("white population = %s\n", record->whitePopulation);
-				free(noComma);
-			}
-		}
-
-		if (hispanic_pop_base != NULL) {
-			char* h_pop_start_1 = strstr(token, "'badge'>");
-			if (h_pop_start_1) {
-				char* gt = strstr(h_pop_start_1, ">");
-				char* lt = strstr(h_pop_start_1, "<");
-				char hispanic_population[10] = {'\0'};
-				strncpy(hispanic_population, &gt[1], strlen(&gt[1]) - strlen(lt));
-
-				char *noComma = (char*)malloc((strlen(hispanic_population) + 1) * sizeof(char));
-				strncpy(noComma, nullStr, strlen(hispanic_population) + 1);
-				removeCommasFromNumber(noComma, hispanic_population);
-
-				strcpy(record->hispanicLatinoPopulation, noComma);
-				printf("hispanic/latino population = %s\n", record->hispanicLatinoPopulation);
-				free(noComma);
-			}
-		}
-
-		if (black_pop_base != NULL) {
-			char* b_pop_start = strstr(token, "'badge'>");
-			if (b_pop_start) {
-				char* gt = strstr(b_pop_start, ">");
-				char* lt = strstr(b_pop_start, "<");
-				char black_population[10] = {'\0'};
-				strncpy(black_population, &gt[1], strlen(&gt[1]) - strlen(lt));
-
-				char *noComma = (char*)malloc((strlen(black_population) + 1) * sizeof(char));
-				strncpy(noComma, nullStr, strlen(black_population) + 1);
-				removeCommasFromNumber(noComma, black_population);
-
-				strcpy(record->blackPopulation, noComma);
-				printf("black population = %s\n", record->blackPopulation);
-				free(noComma);
-			}
-		}
-
-		if (asian_pop_base != NULL) {
-			char* asian_pop_start = strstr(token, "'badge'>");
-			if (asian_pop_start) {
-				char* gt = strstr(asian_pop_start, ">");
-				char* lt = strstr(&gt[1], "<");
-				char asian_population[10] = {'\0'};
-				strncpy(asian_population, &gt[1], strlen(&gt[1]) - strlen(lt));
-
-				char *noComma = (char*)malloc((strlen(asian_population) + 1) * sizeof(char));
-				strncpy(noComma, nullStr, strlen(asian_population) + 1);
-				removeCommasFromNumber(noComma, asian_population);
-
-				strcpy(record->asianPopulation, noComma);
-				printf("asian population = %s\n", record->asianPopulation);
-				free(noComma);
-			}
-		}
-
-		if (american_indian_pop_base != NULL) {
-			char* american_indian_start = strstr(token, "'badge'>");
-			if (american_indian_start) {
-				char* gt = strstr(american_indian_start, ">");
-				char* lt = strstr(&gt[1], "<");
-				char americanIndianPop[10] = {'\0'};
-				strncpy(americanIndianPop, &gt[1], strlen(&gt[1]) - strlen(lt));
-
-				char *noComma = (char*)malloc((strlen(americanIndianPop) + 1) * sizeof(char));
-				strncpy(noComma, nullStr, strlen(americanIndianPop) + 1);
-				removeCommasFromNumber(noComma, americanIndianPop);
-
-				strcpy(record->americanIndianPopulation, noComma);
-				printf("american indian population = %s\n", record->americanIndianPopulation);
-				free(noComma);
-			}
-		}
-
-		if (high_school_base != NULL) {
-			char* hs_b = strstr(high_school_base, "</b>");
-			char* lt = strstr(&hs_b[5], "<");
-			char hs_val[8] = {'\0'};
-			strncpy(hs_val, &hs_b[5], strlen(&hs_b[5]) - strlen(lt));
-
-			char hs_fraction[8] = {'\0'};
-			percentToFraction(hs_fraction, hs_val);
-
-			strcpy(record->highSchool, hs_fraction);
-			printf("high school = %s\n", record->highSchool);
-		}
-
-		if (bachelors_degree_base != NULL) {
-			char* bs_degree_b = strstr(bachelors_degree_base, "</b>");
-			char* lt = strstr(&bs_degree_b[5], "<");
-			char bs_degree_val[8] = {'\0'};
-			strncpy(bs_degree_val, &bs_degree_b[5], strlen(&bs_degree_b[5]) - strlen(lt));
-
-			char bs_fraction[8] = {'\0'};
-			percentToFraction(bs_fraction, bs_degree_val);
-
-			strcpy(record->bachelorsDegree, bs_fraction);
-			printf("bachelors degree pct = %s\n", record->bachelorsDegree);
-		}
-
-		if (graduate_degree_base != NULL) {
-			char* graduate_degree_b = strstr(graduate_degree_base, "</b>");
-			char* lt = strstr(&graduate_degree_b[5], "<");
-			char graduate_degree_val[8] = {'\0'};
-			strncpy(graduate_degree_val, &graduate_degree_b[5], strlen(&graduate_degree_b[5]) - strlen(lt));
-
-			char graduate_degree_fraction[8] = {'\0'};
-			percentToFraction(graduate_degree_fraction, graduate_degree_val);
-
-			strcpy(record->graduateDegree, graduate_degree_fraction);
-			printf("graduate degree = %s\n", record->graduateDegree);
-		}
-
-		if (male_base != NULL) {
-			char* male_parens = strstr(male_base, "&nbsp;(");
-			char* close_parens = strstr(&male_parens[7], ")");
-			char male_val[8] = {'\0'};
-			strncpy(male_val, &male_parens[7], strlen(&male_parens[7]) -  strlen(close_parens));
-			
-			char male_fraction[8] = {'\0'};
-			percentToFraction(male_fraction, male_val);
-
-			strcpy(record->malePercent, male_fraction);
-			printf("male percent = %s\n", record->malePercent);
-		}
-
-		if (female_base != NULL) {
-			char* female_parens = strstr(female_base, "&nbsp;(");
-			char* close_parens = strstr(&female_parens[7], ")");
-			char female_val[8] = {'\0'};
-			strncpy(female_val, &female_parens[7], strlen(&female_parens[7]) -  strlen(close_parens));
-			
-			char female_fraction[8] = {'\0'};
-			percentToFraction(female_fraction, female_val);
-
-			strcpy(record->femalePercent, female_fraction);
-			printf("female percent = %s\n", record->malePercent);
-		}
-
-		if (avg_household_base != NULL) {
-			puts("trying to do avg_household");
-
-			char* avg_household_p = strstr(avg_household_base, "</p>");
-			if (avg_household_p != NULL) {
-				char* avg_household_peeps = strstr(&avg_household_p[4], " people");
-				char avg_household_size[8] = {'\0'};
-				strncpy(avg_household_size, &avg_household_p[4],
-					strlen(&avg_household_p[4]) - strlen(avg_household_peeps));
-				strcpy(record->averageHouseholdSize, avg_household_size);
-				printf("avg household size = %s\n", record->averageHouseholdSize);
-			}
-		}
+typedef struct ZipCodeReplay {
+	ZipCodeSink* sink;
+	ZipCodeFetch** fetches;
+} ZipCodeReplay;
+
+/* Runs on a replay thread; each index has its own fetch slot and record. */
+static void replayZipPage(void* ctx, long index, const char* data, size_t size) {
+	ZipCodeReplay* replay = (ZipCodeReplay*)ctx;
+	const double started = metricsClock();
+	const alloc_phase_t phase = allocPhaseEnter(ALLOC_PHASE_PARSE);
+	zip_page_parser_t parser;
+	zipPageParserInit(&parser);
+	if (!zipPageParserFeed(&parser, data, size)) {
+		zipPageParserFinish(&parser);
+	}
+	const double finished = metricsClock();
+	metricsRecordSeconds(METRIC_PARSE, finished - started);
+	traceSpan("parse", "parse", started, finished, replay->fetches[index]->zip->code);
+	exportZipPage(replay->sink, replay->fetches[index], &parser);
+	allocPhaseEnter(phase);
+}
 
-		token = strtok(NULL, "\n");
-		if (!token) {
-			break;
-		}
+static void replayZipPages(const char* path, const char* const* urls, ZipCodeFetch** fetches, int32_t count,
+		ZipCodeSink* sink) {
+	replay_corpus_t* corpus = replayCorpusOpen(path);
+	if (!corpus) {
+		exit(EXIT_FAILURE);
 	}
+	ZipCodeReplay replay;
+	replay.sink = sink;
+	replay.fetches = fetches;
+	replay_stats_t stats;
+	replayRun(corpus, urls, count, configLong("ZIP_REPLAY_THREADS", 0), replayZipPage, &replay, &stats);
+	replayStatsPrint(&stats);
+	replayCorpusClose(corpus);
 }
 
 int main(void) {
-	MemoryBuffer* chunk;
+	metricsStart("read_list", METRICS_PREFIX);
+	traceStart();
+	logStart();
 	CURL *curl = initCurl();
 	FILE* fp = openFile();
 
@@ -671,9 +283,20 @@ int main(void) {
 	openDb(&db);
 	initDb(&db);
 
+	db_bulk_load_config_t bulk_config;
+	db_durable_settings_t durable_settings;
+	dbBulkLoadConfigInit(&bulk_config);
+	dbBulkLoadConfigFromEnv(&bulk_config);
+	dbBeginBulkLoad(db, &bulk_config, "zip_codes", &durable_settings);
+
 	closeFile(fp);
 
-	ZipCode *list_head = loadLinkedListFromSqlite(db);
+	/* The zip code list, the records and the fetch slots all live until the CSV is written. */
+	allocPhaseEnter(ALLOC_PHASE_LIST_LOAD);
+	arena_t* run_arena = arenaCreate(ARENA_DEFAULT_BLOCK_SIZE);
+	county_dict_t* counties = countyDictCreate();
+	countyDictLoad(counties, db);
+	ZipCode *list_head = loadLinkedListFromSqlite(db, run_arena);
  	int32_t zip_code_count = 0;
 	for (ZipCode *prev = list_head; prev->next != NULL; prev = prev->next) {
 		zip_code_count++;
@@ -681,41 +304,69 @@ int main(void) {
 
 	printf("Loaded %d zip codes from sqlite3 db.\n", zip_code_count);
 
-	ZipCodeRecord zipCodeRecords[zip_code_count];
-	allocateZipCodeRecords(zip_code_count, zipCodeRecords);
-	
-	int32_t recordIndex = 0;
-	for (ZipCode *prev = list_head; prev->next != NULL; prev = prev->next) {
-		chunk = (MemoryBuffer*)malloc(sizeof(MemoryBuffer));
-		chunk->memory = malloc(1);
-		chunk->size = 0;
-
-		char url[64] = BASE_URL;
-		strcat(url, prev->code);
-		strcat(url, ".html");
-		printf("Fetching url %s \n", url);
-
-		curl_easy_setopt(curl, CURLOPT_URL, url);
-		curl_easy_setopt(curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)chunk);
-
-		CURLcode res = curl_easy_perform(curl);
+	ZipCodeRecord* zipCodeRecords = (ZipCodeRecord*)arenaCalloc(run_arena, (size_t)zip_code_count,
+		sizeof(ZipCodeRecord));
 
-		processLines(chunk->memory, prev->code, prev->state, prev->county,
-			&zipCodeRecords[recordIndex]);
+	/* ZIP_RESUME=0 forgets the progress of earlier runs and fetches every zip code again. */
+	progress_t* progress = progressOpen(db, "zip", configLong("ZIP_RESUME", DEFAULT_RESUME) != 0);
+	sqlite3_stmt* select_stmt = prepareZipCodeSelect(db);
 
-		if (res != CURLE_OK) {
-			fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+	const char* base_url = configString("ZIP_BASE_URL", BASE_URL);
+	ZipCodeFetch* fetches = (ZipCodeFetch*)arenaAlloc(run_arena, (size_t)zip_code_count * sizeof(ZipCodeFetch));
+	ZipCodeFetch** pending = (ZipCodeFetch**)arenaAlloc(run_arena, (size_t)zip_code_count * sizeof(ZipCodeFetch*));
+	const char** urls = (const char**)arenaAlloc(run_arena, (size_t)zip_code_count * sizeof(const char*));
+	int32_t pending_count = 0;
+	int32_t recordIndex = 0;
+	for (ZipCode *prev = list_head; prev->next != NULL; prev = prev->next) {
+		fetches[recordIndex].zip = prev;
+		fetches[recordIndex].record = &zipCodeRecords[recordIndex];
+		fetches[recordIndex].fetched = 0;
+
+		/* A zip code finished by an earlier run is read back for the CSV instead of fetched again. */
+		const int32_t code = (int32_t)strtol(prev->code, NULL, 10);
+		if (progressIsDone(progress, code) && selectZipCodeRecord(select_stmt, code, &zipCodeRecords[recordIndex])) {
+			fetches[recordIndex].fetched = 1;
+		} else {
+			char* url = (char*)arenaAlloc(run_arena, URL_SIZE);
+			snprintf(url, URL_SIZE, "%s%s.html", base_url, prev->code);
+			urls[pending_count] = url;
+			pending[pending_count] = &fetches[recordIndex];
+			pending_count++;
 		}
-
-		free(chunk->memory);
-		free(chunk);
-
-		usleep(1700000);
 		recordIndex++;
 	}
+	sqlite3_finalize(select_stmt);
+	if (pending_count < zip_code_count) {
+		fprintf(stderr, "Resuming: %d of %d zip codes were finished by an earlier run.\n",
+			zip_code_count - pending_count, zip_code_count);
+	}
 
+	/* Records are inserted as they are parsed; main keeps ownership until the CSV export. */
+	sqlite3_stmt* insert_stmt = prepareZipCodeInsert(db);
+	db_writer_config_t writer_config;
+	dbWriterConfigInit(&writer_config);
+	dbWriterConfigFromEnv(&writer_config);
+	ZipCodeSink sink;
+	sink.writer = dbWriterCreate(&writer_config, db, insert_stmt, writeFetchedZip, NULL, progress);
+	sink.counties = counties;
+
+	/* ZIP_REPLAY parses saved pages from a directory or tar instead of the site. */
+	allocPhaseEnter(ALLOC_PHASE_FETCH);
+	const char* replay_path = configString("ZIP_REPLAY", NULL);
+	if (replay_path) {
+		replayZipPages(replay_path, urls, pending, pending_count, &sink);
+		curl_easy_cleanup(curl);
+	} else {
+		fetchZipPages(curl, urls, pending, pending_count, &sink);
+	}
+	allocPhaseEnter(ALLOC_PHASE_INSERT);
+	dbWriterClose(sink.writer);
+	dbEndBulkLoad(db, &bulk_config, "zip_codes", &durable_settings);
+	sqlite3_finalize(insert_stmt);
+	progressClose(progress);
+	sqlite3_close(db);
+
+	allocPhaseEnter(ALLOC_PHASE_EXPORT);
 	FILE* outputFile = fopen(OUTPUT_FILE_NAME, "w");
 	fputs("\"Zip Code\",\"State\",\"County\",\"Population 2016\",\"Population 2010\",\"Population 2000\",\"Land Area\","
 		"\"Foreign Born Population\",\"Median Household Income\",\"Median Home Price\","
@@ -725,74 +376,76 @@ int main(void) {
 		"\"Female Percent\",\"Average Household Size\"\n", 
 		outputFile);
 
-	beginTransaction(db);
-	char insert_format[] = "INSERT INTO zip_codes VALUES ("
-		" %s, \"%s\", \"%s\", %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, "
-		"%s, %s, %s );";
-	char insert_stmt[256] = {'\0'};
-
+	const double csv_start = traceClock();
+	int32_t failedCount = 0;
 	for (recordIndex = 0; recordIndex < zip_code_count; ++recordIndex) {
+		if (!fetches[recordIndex].fetched) {
+			failedCount++;
+			continue;
+		}
+
+		const ZipCodeRecord* record = &zipCodeRecords[recordIndex];
+		char landArea[ZIP_CODE_NUMBER_TEXT_SIZE];
+		char foreignBornPopulation[ZIP_CODE_NUMBER_TEXT_SIZE];
+		char medianResidentAge[ZIP_CODE_NUMBER_TEXT_SIZE];
+		char highSchool[ZIP_CODE_NUMBER_TEXT_SIZE];
+		char bachelorsDegree[ZIP_CODE_NUMBER_TEXT_SIZE];
+		char graduateDegree[ZIP_CODE_NUMBER_TEXT_SIZE];
+		char malePercent[ZIP_CODE_NUMBER_TEXT_SIZE];
+		char femalePercent[ZIP_CODE_NUMBER_TEXT_SIZE];
+		char averageHouseholdSize[ZIP_CODE_NUMBER_TEXT_SIZE];
+		zipCodeFormatDecimal(landArea, record->landArea);
+		zipCodeFormatFraction(foreignBornPopulation, record->foreignBornPopulation);
+		zipCodeFormatDecimal(medianResidentAge, record->medianResidentAge);
+		zipCodeFormatFraction(highSchool, record->highSchool);
+		zipCodeFormatFraction(bachelorsDegree, record->bachelorsDegree);
+		zipCodeFormatFraction(graduateDegree, record->graduateDegree);
+		zipCodeFormatFraction(malePercent, record->malePercent);
+		zipCodeFormatFraction(femalePercent, record->femalePercent);
+		zipCodeFormatDecimal(averageHouseholdSize, record->averageHouseholdSize);
+
 		fprintf(outputFile,
-			"\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\""
-			",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\"\n",
-			zipCodeRecords[recordIndex].code,
-			zipCodeRecords[recordIndex].state,
-			zipCodeRecords[recordIndex].county,
-			zipCodeRecords[recordIndex].population,
-			zipCodeRecords[recordIndex].population2010,
-			zipCodeRecords[recordIndex].population2000,
-			zipCodeRecords[recordIndex].landArea,
-			zipCodeRecords[recordIndex].foreignBornPopulation,
-			zipCodeRecords[recordIndex].medianHouseholdIncome,
-			zipCodeRecords[recordIndex].medianHomePrice,
-			zipCodeRecords[recordIndex].medianResidentAge,
-			zipCodeRecords[recordIndex].whitePopulation,
-			zipCodeRecords[recordIndex].hispanicLatinoPopulation,
-			zipCodeRecords[recordIndex].blackPopulation,
-			zipCodeRecords[recordIndex].asianPopulation,
-			zipCodeRecords[recordIndex].americanIndianPopulation,
-			zipCodeRecords[recordIndex].highSchool,
-			zipCodeRecords[recordIndex].bachelorsDegree,
-			zipCodeRecords[recordIndex].graduateDegree,
-			zipCodeRecords[recordIndex].malePercent,
-			zipCodeRecords[recordIndex].femalePercent,
-			zipCodeRecords[recordIndex].averageHouseholdSize);
-
-		sprintf(insert_stmt, insert_format,
-			zipCodeRecords[recordIndex].code,
-			zipCodeRecords[recordIndex].state,
-			zipCodeRecords[recordIndex].county,
-			zipCodeRecords[recordIndex].population,
-			zipCodeRecords[recordIndex].population2010,
-			zipCodeRecords[recordIndex].population2000,
-			zipCodeRecords[recordIndex].landArea,
-			zipCodeRecords[recordIndex].foreignBornPopulation,
-			zipCodeRecords[recordIndex].medianHouseholdIncome,
-			zipCodeRecords[recordIndex].medianHomePrice,
-			zipCodeRecords[recordIndex].medianResidentAge,
-			zipCodeRecords[recordIndex].whitePopulation,
-			zipCodeRecords[recordIndex].hispanicLatinoPopulation,
-			zipCodeRecords[recordIndex].blackPopulation,
-			zipCodeRecords[recordIndex].asianPopulation,
-			zipCodeRecords[recordIndex].americanIndianPopulation,
-			zipCodeRecords[recordIndex].highSchool,
-			zipCodeRecords[recordIndex].bachelorsDegree,
-			zipCodeRecords[recordIndex].graduateDegree,
-			zipCodeRecords[recordIndex].malePercent,
-			zipCodeRecords[recordIndex].femalePercent,
-			zipCodeRecords[recordIndex].averageHouseholdSize);
-
-		doInsert(db, insert_stmt);
+			"\"%05d\",\"%s\",\"%s\",\"%d\",\"%d\",\"%d\",\"%s\",\"%s\",\"%d\",\"%d\",\"%s\""
+			",\"%d\",\"%d\",\"%d\",\"%d\",\"%d\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\"\n",
+			record->code,
+			countyDictState(counties, record->county_id),
+			countyDictCounty(counties, record->county_id),
+			record->population,
+			record->population2010,
+			record->population2000,
+			landArea,
+			foreignBornPopulation,
+			record->medianHouseholdIncome,
+			record->medianHomePrice,
+			medianResidentAge,
+			record->whitePopulation,
+			record->hispanicLatinoPopulation,
+			record->blackPopulation,
+			record->asianPopulation,
+			record->americanIndianPopulation,
+			highSchool,
+			bachelorsDegree,
+			graduateDegree,
+			malePercent,
+			femalePercent,
+			averageHouseholdSize);
 	}
 
-	commitTransaction(db);
-	sqlite3_close(db);
+	traceSpan("write csv", "csv", csv_start, traceClock(), OUTPUT_FILE_NAME);
 
-	fclose(outputFile);
-	freeZipCodeRecords(zip_code_count, zipCodeRecords);
-	freeLinkedList(list_head);
+	if (failedCount > 0) {
+		fprintf(stderr, "%d of %d zip codes could not be fetched and were skipped.\n",
+			failedCount, zip_code_count);
+	}
 
-	curl_easy_cleanup(curl);
+	fclose(outputFile);
+	allocPhaseEnter(ALLOC_PHASE_OTHER);
+	arenaStatsPrint("Zip code list", arenaStats(run_arena));
+	arenaDestroy(run_arena);
+	countyDictDestroy(counties);
+	metricsStop();
+	traceStop();
+	logStop();
 
 	return EXIT_SUCCESS;
 }
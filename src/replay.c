@@ -0,0 +1,308 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "alloc_stats.h"
+#include "log.h"
+#include "replay.h"
+#include "trace.h"
+
+#define TAR_BLOCK 512
+#define REPLAY_NAME_SIZE 256
+
+typedef struct ReplayMember {
+	char name[REPLAY_NAME_SIZE];
+	size_t offset;
+	size_t size;
+} replay_member_t;
+
+struct ReplayCorpus {
+	int dir_fd;                 /* a directory of pages, or -1 */
+	char* archive;              /* a mapped tar, or NULL */
+	size_t archive_size;
+	replay_member_t* members;   /* the tar's regular files, sorted by name */
+	size_t member_count;
+};
+
+typedef struct {
+	replay_corpus_t* corpus;
+	const char* const* urls;
+	long count;
+	atomic_long next;
+	replay_page_fn fn;
+	void* ctx;
+} replay_job_t;
+
+typedef struct {
+	replay_job_t* job;
+	long index;
+	pthread_t thread;
+	long pages;
+	long missing;
+	size_t bytes;
+} replay_worker_t;
+
+static double monotonicSeconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/* The last path segment of url without its query or fragment. */
+static void pageName(const char* url, char* name, size_t size) {
+	const char* slash = strrchr(url, '/');
+	const char* start = slash ? &slash[1] : url;
+	snprintf(name, size, "%.*s", (int)strcspn(start, "?#"), start);
+}
+
+static int compareMembers(const void* a, const void* b) {
+	return strcmp(((const replay_member_t*)a)->name, ((const replay_member_t*)b)->name);
+}
+
+static size_t octal(const char* field, size_t length) {
+	size_t value = 0;
+	for (size_t i = 0; i < length && field[i] >= '0' && field[i] <= '7'; ++i) {
+		value = value * 8 + (size_t)(field[i] - '0');
+	}
+	return value;
+}
+
+/* Indexes the regular files of a ustar or GNU tar by their base name. */
+static int indexArchive(replay_corpus_t* corpus) {
+	size_t capacity = 0;
+	char long_name[REPLAY_NAME_SIZE] = {'\0'};
+	for (size_t offset = 0; offset + TAR_BLOCK <= corpus->archive_size;) {
+		const char* header = &corpus->archive[offset];
+		if (header[0] == '\0') {
+			break;   /* the end-of-archive zero blocks */
+		}
+		const size_t size = octal(&header[124], 12);
+		const char type = header[156];
+		const size_t data = offset + TAR_BLOCK;
+		if (data + size > corpus->archive_size) {
+			fprintf(stderr, "Archive member at offset %zu runs past the end of the archive.\n", offset);
+			return 0;
+		}
+		offset = data + (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+
+		if (type == 'L') {
+			/* GNU long name: the data is the name of the member that follows. */
+			snprintf(long_name, sizeof long_name, "%.*s", (int)strnlen(&corpus->archive[data], size),
+				&corpus->archive[data]);
+			continue;
+		}
+		if (type != '0' && type != '\0') {
+			long_name[0] = '\0';
+			continue;
+		}
+
+		char path[REPLAY_NAME_SIZE * 2];
+		if (long_name[0]) {
+			snprintf(path, sizeof path, "%s", long_name);
+		} else if (memcmp(&header[257], "ustar", 5) == 0 && header[345]) {
+			snprintf(path, sizeof path, "%.155s/%.100s", &header[345], header);
+		} else {
+			snprintf(path, sizeof path, "%.100s", header);
+		}
+		long_name[0] = '\0';
+
+		if (corpus->member_count == capacity) {
+			capacity = capacity ? capacity * 2 : 1024;
+			replay_member_t* members = (replay_member_t*)realloc(corpus->members,
+				capacity * sizeof(replay_member_t));
+			if (!members) {
+				fprintf(stderr, "Failed to allocate the archive index.\n");
+				exit(EXIT_FAILURE);
+			}
+			corpus->members = members;
+		}
+		replay_member_t* member = &corpus->members[corpus->member_count++];
+		pageName(path, member->name, sizeof member->name);
+		member->offset = data;
+		member->size = size;
+	}
+	qsort(corpus->members, corpus->member_count, sizeof(replay_member_t), compareMembers);
+	return 1;
+}
+
+replay_corpus_t* replayCorpusOpen(const char* path) {
+	replay_corpus_t* corpus = (replay_corpus_t*)calloc(1, sizeof(replay_corpus_t));
+	if (!corpus) {
+		fprintf(stderr, "Failed to allocate the replay corpus.\n");
+		exit(EXIT_FAILURE);
+	}
+	corpus->dir_fd = -1;
+
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0) {
+		fprintf(stderr, "Failed to open replay corpus '%s': %s\n", path, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		free(corpus);
+		return NULL;
+	}
+	if (S_ISDIR(info.st_mode)) {
+		corpus->dir_fd = fd;
+		fprintf(stderr, "Replaying pages from directory %s.\n", path);
+		return corpus;
+	}
+
+	corpus->archive_size = (size_t)info.st_size;
+	corpus->archive = corpus->archive_size > 0
+		? (char*)mmap(NULL, corpus->archive_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+	close(fd);
+	if (corpus->archive == MAP_FAILED || !corpus->archive) {
+		fprintf(stderr, "Failed to map replay archive '%s'.\n", path);
+		free(corpus);
+		return NULL;
+	}
+	madvise(corpus->archive, corpus->archive_size, MADV_WILLNEED);
+	if (!indexArchive(corpus)) {
+		replayCorpusClose(corpus);
+		return NULL;
+	}
+	fprintf(stderr, "Replaying %zu pages from archive %s.\n", corpus->member_count, path);
+	return corpus;
+}
+
+void replayCorpusClose(replay_corpus_t* corpus) {
+	if (!corpus) {
+		return;
+	}
+	if (corpus->dir_fd >= 0) {
+		close(corpus->dir_fd);
+	}
+	if (corpus->archive) {
+		munmap(corpus->archive, corpus->archive_size);
+	}
+	free(corpus->members);
+	free(corpus);
+}
+
+/* Calls fn with the page for url; returns its size, or -1 when the corpus lacks it. */
+static long replayPage(replay_job_t* job, long index) {
+	replay_corpus_t* corpus = job->corpus;
+	replay_member_t key;
+	pageName(job->urls[index], key.name, sizeof key.name);
+
+	if (corpus->archive) {
+		const replay_member_t* member = (const replay_member_t*)bsearch(&key, corpus->members,
+			corpus->member_count, sizeof(replay_member_t), compareMembers);
+		if (!member) {
+			return -1;
+		}
+		job->fn(job->ctx, index, &corpus->archive[member->offset], member->size);
+		return (long)member->size;
+	}
+
+	const int fd = openat(corpus->dir_fd, key.name, O_RDONLY | O_CLOEXEC);
+	struct stat info;
+	if (fd < 0 || key.name[0] == '\0' || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	const size_t size = (size_t)info.st_size;
+	char* data = size > 0 ? (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+	close(fd);
+	if (data == MAP_FAILED) {
+		logError("Failed to map %s: %s\n", key.name, strerror(errno));
+		return -1;
+	}
+	if (data) {
+		madvise(data, size, MADV_SEQUENTIAL);
+	}
+	job->fn(job->ctx, index, data ? data : "", size);
+	if (data) {
+		munmap(data, size);
+	}
+	return (long)size;
+}
+
+static void* replayWorker(void* arg) {
+	replay_worker_t* worker = (replay_worker_t*)arg;
+	replay_job_t* job = worker->job;
+	char name[32];
+	snprintf(name, sizeof name, "replay %ld", worker->index);
+	traceThreadName(name);
+	/* Reading a saved page stands in for fetching it; the callback sets its own phase. */
+	allocPhaseEnter(ALLOC_PHASE_FETCH);
+	for (long index; (index = atomic_fetch_add(&job->next, 1)) < job->count;) {
+		const long size = replayPage(job, index);
+		if (size < 0) {
+			logWarn("No saved page for %s, it is skipped.\n", job->urls[index]);
+			worker->missing++;
+			continue;
+		}
+		worker->pages++;
+		worker->bytes += (size_t)size;
+	}
+	return NULL;
+}
+
+void replayRun(replay_corpus_t* corpus, const char* const* urls, long count, long threads,
+		replay_page_fn fn, void* ctx, replay_stats_t* stats) {
+	if (threads < 1) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+
+	replay_job_t job;
+	job.corpus = corpus;
+	job.urls = urls;
+	job.count = count;
+	atomic_init(&job.next, 0);
+	job.fn = fn;
+	job.ctx = ctx;
+
+	replay_worker_t* workers = (replay_worker_t*)calloc((size_t)threads, sizeof(replay_worker_t));
+	if (!workers) {
+		fprintf(stderr, "Failed to allocate %ld replay workers.\n", threads);
+		exit(EXIT_FAILURE);
+	}
+
+	const double start = monotonicSeconds();
+	for (long i = 0; i < threads; ++i) {
+		workers[i].job = &job;
+		workers[i].index = i;
+		if (pthread_create(&workers[i].thread, NULL, replayWorker, &workers[i]) != 0) {
+			fprintf(stderr, "Failed to start replay worker %ld.\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	memset(stats, 0, sizeof(replay_stats_t));
+	stats->threads = threads;
+	for (long i = 0; i < threads; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		stats->pages += workers[i].pages;
+		stats->missing += workers[i].missing;
+		stats->bytes += workers[i].bytes;
+	}
+	stats->seconds = monotonicSeconds() - start;
+	free(workers);
+}
+
+void replayStatsPrint(const replay_stats_t* stats) {
+	const double seconds = stats->seconds > 0 ? stats->seconds : 1e-9;
+	const double pages_per_sec = (double)stats->pages / seconds;
+	const double mb_per_sec = (double)stats->bytes / (1024.0 * 1024.0) / seconds;
+	fprintf(stderr, "Replayed %ld pages (%.1f MB, %ld missing) on %ld threads in %.3f s: %.0f pages/s, "
+		"%.1f MB/s, %.0f pages/s per thread.\n", stats->pages, (double)stats->bytes / (1024.0 * 1024.0),
+		stats->missing, stats->threads, stats->seconds, pages_per_sec, mb_per_sec,
+		pages_per_sec / (double)stats->threads);
+}
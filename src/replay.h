@@ -0,0 +1,47 @@
+#ifndef ZIP_CODES_REPLAY_H
+#define ZIP_CODES_REPLAY_H
+
+#include <stddef.h>
+
+typedef struct ReplayCorpus replay_corpus_t;
+
+typedef struct ReplayStats {
+	long threads;
+	long pages;      /* found in the corpus and handed to the callback */
+	long missing;
+	size_t bytes;
+	double seconds;
+} replay_stats_t;
+
+/*
+ * Called on a pool thread for each page that is in the corpus. data is the
+ * mapped file, read only and not NUL terminated; it stays valid only during
+ * the call. Calls run concurrently, so fn writes only to state of its own
+ * index or guards anything shared.
+ */
+typedef void (*replay_page_fn)(void* ctx, long index, const char* data, size_t size);
+
+/*
+ * Saved pages to parse instead of fetching them: a directory with one file
+ * per page, or an uncompressed tar archive of one. A page is found by the
+ * last path segment of its URL without the query, the name mock-server
+ * serves it under, so read_list looks for 82001.html and get-zip-codes for
+ * wy-albany.asp. Files are memory-mapped, never copied into the heap. A tar
+ * is mapped once; in a directory each page is mapped for its callback.
+ */
+replay_corpus_t* replayCorpusOpen(const char* path);
+void replayCorpusClose(replay_corpus_t* corpus);
+
+/*
+ * Runs fn over the pages of urls[0..count) on threads workers, each taking
+ * the next unclaimed index, and returns once all of them are done. Pages not
+ * in the corpus are reported on stderr and skipped. threads < 1 uses one per
+ * online CPU.
+ */
+void replayRun(replay_corpus_t* corpus, const char* const* urls, long count, long threads,
+	replay_page_fn fn, void* ctx, replay_stats_t* stats);
+
+/* One stderr line with pages and MB per second, overall and per thread. */
+void replayStatsPrint(const replay_stats_t* stats);
+
+#endif
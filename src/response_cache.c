@@ -0,0 +1,274 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "response_cache.h"
+
+#define RESPONSE_CACHE_MAGIC "zip-codes-cache 1"
+#define RESPONSE_CACHE_SUFFIX ".entry"
+
+struct ResponseCache {
+	char* dir;
+	long max_age;
+	long max_mb;
+	response_cache_stats_t stats;
+};
+
+typedef struct {
+	char name[64];
+	time_t mtime;
+	off_t size;
+} cache_file_t;
+
+response_cache_t* responseCacheCreate(const char* dir, long max_age, long max_mb) {
+	if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Failed to create cache directory '%s': %s\n", dir, strerror(errno));
+		return NULL;
+	}
+	response_cache_t* cache = (response_cache_t*)calloc(1, sizeof(response_cache_t));
+	if (!cache || !(cache->dir = strdup(dir))) {
+		fprintf(stderr, "Failed to allocate the response cache.\n");
+		exit(EXIT_FAILURE);
+	}
+	cache->max_age = max_age;
+	cache->max_mb = max_mb;
+	return cache;
+}
+
+/* Entries are named by a 64-bit FNV-1a hash of the URL, which the entry repeats to catch collisions. */
+static void entryPath(const response_cache_t* cache, const char* url, char* path, size_t size) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (const unsigned char* c = (const unsigned char*)url; *c; ++c) {
+		hash = (hash ^ *c) * 1099511628211ULL;
+	}
+	snprintf(path, size, "%s/%016llx" RESPONSE_CACHE_SUFFIX, cache->dir, (unsigned long long)hash);
+}
+
+static int expired(const response_cache_t* cache, time_t mtime, time_t now) {
+	return cache->max_age > 0 && now - mtime > cache->max_age;
+}
+
+/* Reads a header line without its newline; returns 0 at EOF or when it does not fit. */
+static int readLine(FILE* fp, char* line, size_t size) {
+	if (!fgets(line, (int)size, fp)) {
+		return 0;
+	}
+	const size_t length = strlen(line);
+	if (length == 0 || line[length - 1] != '\n') {
+		return 0;
+	}
+	line[length - 1] = '\0';
+	return 1;
+}
+
+/*
+ * Opens url's entry positioned at its payload. The layout is the magic line,
+ * the URL, the ETag, the Last-Modified value and the payload size, one per
+ * line, then the payload bytes.
+ */
+static FILE* openEntry(response_cache_t* cache, const char* url, response_cache_validators_t* validators,
+		size_t* payload_size) {
+	char path[1024];
+	entryPath(cache, url, path, sizeof path);
+	FILE* fp = fopen(path, "rb");
+	if (!fp) {
+		return NULL;
+	}
+
+	struct stat info;
+	if (fstat(fileno(fp), &info) != 0 || expired(cache, info.st_mtime, time(NULL))) {
+		fclose(fp);
+		if (unlink(path) == 0) {
+			cache->stats.evicted++;
+		}
+		return NULL;
+	}
+
+	char magic[64];
+	char* line = (char*)malloc(strlen(url) + 2);
+	char size_text[32];
+	const int ok = line && readLine(fp, magic, sizeof magic) && strcmp(magic, RESPONSE_CACHE_MAGIC) == 0
+		&& readLine(fp, line, strlen(url) + 2) && strcmp(line, url) == 0
+		&& readLine(fp, validators->etag, sizeof validators->etag)
+		&& readLine(fp, validators->last_modified, sizeof validators->last_modified)
+		&& readLine(fp, size_text, sizeof size_text);
+	free(line);
+	if (!ok) {
+		fclose(fp);
+		return NULL;
+	}
+	*payload_size = (size_t)strtoull(size_text, NULL, 10);
+	return fp;
+}
+
+int responseCacheLookup(response_cache_t* cache, const char* url, response_cache_validators_t* validators) {
+	cache->stats.lookups++;
+	size_t size = 0;
+	FILE* fp = openEntry(cache, url, validators, &size);
+	if (!fp) {
+		return 0;
+	}
+	fclose(fp);
+	cache->stats.found++;
+	return 1;
+}
+
+int responseCacheRead(response_cache_t* cache, const char* url, buffer_pool_t* pool, fetch_buffer_t* payload) {
+	response_cache_validators_t validators;
+	size_t size = 0;
+	FILE* fp = openEntry(cache, url, &validators, &size);
+	if (!fp) {
+		return 0;
+	}
+
+	bufferPoolAcquire(pool, payload, size);
+	char chunk[16384];
+	size_t remaining = size;
+	while (remaining > 0) {
+		const size_t read = fread(chunk, 1, remaining < sizeof chunk ? remaining : sizeof chunk, fp);
+		if (read == 0 || !bufferPoolAppend(pool, payload, chunk, read)) {
+			break;
+		}
+		remaining -= read;
+	}
+	fclose(fp);
+	if (remaining > 0) {
+		logWarn("Cached response for %s is truncated, dropping it.\n", url);
+		bufferPoolRelease(pool, payload);
+		responseCacheRemove(cache, url);
+		return 0;
+	}
+
+	/* The modification time is when the server last confirmed the entry. */
+	char path[1024];
+	entryPath(cache, url, path, sizeof path);
+	utimensat(AT_FDCWD, path, NULL, 0);
+	cache->stats.revalidated++;
+	cache->stats.bytes_served += size;
+	return 1;
+}
+
+void responseCacheStore(response_cache_t* cache, const char* url, const response_cache_validators_t* validators,
+		const char* payload, size_t size) {
+	if (validators->etag[0] == '\0' && validators->last_modified[0] == '\0') {
+		return;
+	}
+
+	char path[1024];
+	char temp_path[1040];
+	entryPath(cache, url, path, sizeof path);
+	snprintf(temp_path, sizeof temp_path, "%s.tmp", path);
+	FILE* fp = fopen(temp_path, "wb");
+	if (!fp) {
+		fprintf(stderr, "Failed to write cache entry '%s': %s\n", temp_path, strerror(errno));
+		return;
+	}
+	fprintf(fp, RESPONSE_CACHE_MAGIC "\n%s\n%s\n%s\n%zu\n", url, validators->etag, validators->last_modified,
+		size);
+	const int ok = fwrite(payload, 1, size, fp) == size;
+	if (fclose(fp) != 0 || !ok) {
+		fprintf(stderr, "Failed to write cache entry '%s'.\n", temp_path);
+		unlink(temp_path);
+		return;
+	}
+
+	/* Renaming over the old entry keeps a crash from leaving half of one behind. */
+	cache->stats.changed += access(path, F_OK) == 0;
+	if (rename(temp_path, path) != 0) {
+		fprintf(stderr, "Failed to replace cache entry '%s': %s\n", path, strerror(errno));
+		unlink(temp_path);
+		return;
+	}
+	cache->stats.stored++;
+}
+
+void responseCacheRemove(response_cache_t* cache, const char* url) {
+	char path[1024];
+	entryPath(cache, url, path, sizeof path);
+	unlink(path);
+}
+
+void responseCacheStats(const response_cache_t* cache, response_cache_stats_t* stats) {
+	*stats = cache->stats;
+}
+
+static int compareOldestFirst(const void* a, const void* b) {
+	const time_t x = ((const cache_file_t*)a)->mtime;
+	const time_t y = ((const cache_file_t*)b)->mtime;
+	return (x > y) - (x < y);
+}
+
+void responseCacheTrim(response_cache_t* cache) {
+	DIR* dir = opendir(cache->dir);
+	if (!dir) {
+		return;
+	}
+
+	cache_file_t* files = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	off_t total = 0;
+	const time_t now = time(NULL);
+	char path[1024];
+	for (struct dirent* entry; (entry = readdir(dir)) != NULL;) {
+		const size_t length = strlen(entry->d_name);
+		const size_t suffix_length = sizeof RESPONSE_CACHE_SUFFIX - 1;
+		if (length <= suffix_length || length >= sizeof files->name
+				|| strcmp(&entry->d_name[length - suffix_length], RESPONSE_CACHE_SUFFIX) != 0) {
+			continue;
+		}
+		struct stat info;
+		snprintf(path, sizeof path, "%s/%s", cache->dir, entry->d_name);
+		if (stat(path, &info) != 0) {
+			continue;
+		}
+		if (expired(cache, info.st_mtime, now)) {
+			cache->stats.evicted += unlink(path) == 0;
+			continue;
+		}
+		if (count == capacity) {
+			capacity = capacity ? capacity * 2 : 256;
+			cache_file_t* grown = (cache_file_t*)realloc(files, capacity * sizeof(cache_file_t));
+			if (!grown) {
+				break;
+			}
+			files = grown;
+		}
+		snprintf(files[count].name, sizeof files[count].name, "%s", entry->d_name);
+		files[count].mtime = info.st_mtime;
+		files[count].size = info.st_size;
+		total += info.st_size;
+		count++;
+	}
+	closedir(dir);
+
+	const off_t limit = (off_t)cache->max_mb * 1024 * 1024;
+	if (cache->max_mb > 0 && total > limit) {
+		qsort(files, count, sizeof(cache_file_t), compareOldestFirst);
+		for (size_t i = 0; i < count && total > limit; ++i) {
+			snprintf(path, sizeof path, "%s/%s", cache->dir, files[i].name);
+			if (unlink(path) == 0) {
+				total -= files[i].size;
+				cache->stats.evicted++;
+			}
+		}
+	}
+	free(files);
+}
+
+void responseCacheDestroy(response_cache_t* cache) {
+	if (!cache) {
+		return;
+	}
+	free(cache->dir);
+	free(cache);
+}
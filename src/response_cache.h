@@ -0,0 +1,58 @@
+#ifndef ZIP_CODES_RESPONSE_CACHE_H
+#define ZIP_CODES_RESPONSE_CACHE_H
+
+#include <stddef.h>
+#include "buffer_pool.h"
+
+#define RESPONSE_CACHE_DEFAULT_MAX_AGE (30L * 86400)   /* seconds since an entry was last confirmed */
+#define RESPONSE_CACHE_DEFAULT_MAX_MB 512
+#define RESPONSE_CACHE_VALIDATOR_SIZE 256
+
+/* The validators a response carried; "" for a header it lacked. */
+typedef struct ResponseCacheValidators {
+	char etag[RESPONSE_CACHE_VALIDATOR_SIZE];
+	char last_modified[RESPONSE_CACHE_VALIDATOR_SIZE];
+} response_cache_validators_t;
+
+typedef struct ResponseCacheStats {
+	long lookups;         /* requests that checked the cache */
+	long found;           /* lookups that had a usable entry and went out conditional */
+	long revalidated;     /* answered 304 and served from the cache */
+	long changed;         /* entries replaced because the server sent a new body */
+	long stored;
+	long evicted;         /* entries removed for age or to fit max_mb */
+	size_t bytes_served;  /* payload read back on revalidation */
+} response_cache_stats_t;
+
+typedef struct ResponseCache response_cache_t;
+
+/*
+ * On-disk cache of responses keyed by URL, one file per entry in dir. An
+ * entry holds the response's ETag and Last-Modified and a payload: the body,
+ * or whatever the caller stored in its place. A request with an entry is sent
+ * with If-None-Match/If-Modified-Since, and a 304 confirms the payload and
+ * refreshes the entry's age. Entries not confirmed for max_age seconds are
+ * ignored. Not thread safe.
+ */
+response_cache_t* responseCacheCreate(const char* dir, long max_age, long max_mb);
+void responseCacheDestroy(response_cache_t* cache);
+
+/* Fills validators from url's entry; returns 0 when there is no usable entry. */
+int responseCacheLookup(response_cache_t* cache, const char* url, response_cache_validators_t* validators);
+
+/* Reads url's payload into a buffer from pool and marks the entry confirmed; returns 0 on failure. */
+int responseCacheRead(response_cache_t* cache, const char* url, buffer_pool_t* pool, fetch_buffer_t* payload);
+
+/* Replaces url's entry; responses without either validator are not worth keeping and are dropped. */
+void responseCacheStore(response_cache_t* cache, const char* url, const response_cache_validators_t* validators,
+	const char* payload, size_t size);
+
+/* Removes url's entry, e.g. when its payload can no longer be used. */
+void responseCacheRemove(response_cache_t* cache, const char* url);
+
+/* Deletes expired entries, then the least recently confirmed ones until the rest fit in max_mb. */
+void responseCacheTrim(response_cache_t* cache);
+
+void responseCacheStats(const response_cache_t* cache, response_cache_stats_t* stats);
+
+#endif
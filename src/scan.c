@@ -0,0 +1,334 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "config.h"
+#include "scan.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SCAN_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct {
+	const char* name;
+	const char* (*find_byte)(const char*, const char*, char);
+	const char* (*find_any)(const char*, const char*, const scan_set_t*);
+	const char* (*find_string)(const char*, const char*, const char*, size_t);
+	void (*mask)(const char*, size_t, const scan_set_t*, uint64_t*);
+} scan_kernels_t;
+
+static const char* findByteScalar(const char* begin, const char* end, char byte) {
+	const char* found = (const char*)memchr(begin, byte, (size_t)(end - begin));
+	return found ? found : end;
+}
+
+static const char* findAnyScalar(const char* begin, const char* end, const scan_set_t* set) {
+	for (; begin < end; ++begin) {
+		if (set->member[(unsigned char)*begin]) {
+			return begin;
+		}
+	}
+	return end;
+}
+
+static const char* findStringScalar(const char* begin, const char* end, const char* needle,
+		size_t needle_length) {
+	const char* found = (const char*)memmem(begin, (size_t)(end - begin), needle, needle_length);
+	return found ? found : end;
+}
+
+/* Fills the mask words from byte from (a multiple of 64) to the end. */
+static void maskTail(const char* begin, size_t from, size_t length, const scan_set_t* set, uint64_t* bits) {
+	const unsigned char* bytes = (const unsigned char*)begin;
+	for (; from < length; from += 64) {
+		const size_t count = length - from < 64 ? length - from : 64;
+		/* Eight independent lanes, so the ORs do not form one long dependency chain. */
+		uint64_t lanes[8] = {0};
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			for (int lane = 0; lane < 8; ++lane) {
+				lanes[lane] |= (uint64_t)set->member[bytes[from + i + (size_t)lane]] << (i + (size_t)lane);
+			}
+		}
+		for (; i < count; ++i) {
+			lanes[0] |= (uint64_t)set->member[bytes[from + i]] << i;
+		}
+		bits[from / 64] = lanes[0] | lanes[1] | lanes[2] | lanes[3] | lanes[4] | lanes[5] | lanes[6] | lanes[7];
+	}
+}
+
+static void maskScalar(const char* begin, size_t length, const scan_set_t* set, uint64_t* bits) {
+	if (set->count != 1) {
+		maskTail(begin, 0, length, set, bits);
+		return;
+	}
+	/* A single byte is usually sparse, so let memchr() skip between hits. */
+	memset(bits, 0, (length + 63) / 64 * sizeof(uint64_t));
+	const char* end = &begin[length];
+	for (const char* hit = begin; (hit = findByteScalar(hit, end, (char)set->bytes[0])) < end; ++hit) {
+		const size_t i = (size_t)(hit - begin);
+		bits[i / 64] |= (uint64_t)1 << (i % 64);
+	}
+}
+
+#ifdef SCAN_HAVE_X86
+
+/*
+ * Each vector kernel compares a block against the wanted bytes, turns the
+ * result into a bit mask with movemask and takes the lowest set bit (or, for
+ * the mask kernels, keeps them all); the tail shorter than one block goes to
+ * the scalar code.
+ */
+
+static const char* findByteSse2(const char* begin, const char* end, char byte) {
+	const __m128i wanted = _mm_set1_epi8(byte);
+	for (; end - begin >= 16; begin += 16) {
+		const __m128i block = _mm_loadu_si128((const __m128i*)begin);
+		const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, wanted));
+		if (mask) {
+			return begin + __builtin_ctz((unsigned)mask);
+		}
+	}
+	return findByteScalar(begin, end, byte);
+}
+
+static const char* findAnySse2(const char* begin, const char* end, const scan_set_t* set) {
+	__m128i wanted[SCAN_SET_MAX];
+	for (int i = 0; i < set->count; ++i) {
+		wanted[i] = _mm_set1_epi8((char)set->bytes[i]);
+	}
+	for (; end - begin >= 16; begin += 16) {
+		const __m128i block = _mm_loadu_si128((const __m128i*)begin);
+		__m128i hits = _mm_setzero_si128();
+		for (int i = 0; i < set->count; ++i) {
+			hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, wanted[i]));
+		}
+		const int mask = _mm_movemask_epi8(hits);
+		if (mask) {
+			return begin + __builtin_ctz((unsigned)mask);
+		}
+	}
+	return findAnyScalar(begin, end, set);
+}
+
+/* Candidates must match the needle's first and last byte; only those are compared in full. */
+static const char* findStringSse2(const char* begin, const char* end, const char* needle,
+		size_t needle_length) {
+	if (needle_length < 2) {
+		return needle_length == 1 ? findByteSse2(begin, end, needle[0]) : begin;
+	}
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+	for (; end - begin >= (long)(16 + needle_length - 1); begin += 16) {
+		const __m128i block_first = _mm_loadu_si128((const __m128i*)begin);
+		const __m128i block_last = _mm_loadu_si128((const __m128i*)(begin + needle_length - 1));
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+			_mm_cmpeq_epi8(block_last, last)));
+		while (mask) {
+			const int offset = __builtin_ctz(mask);
+			if (memcmp(begin + offset + 1, needle + 1, needle_length - 2) == 0) {
+				return begin + offset;
+			}
+			mask &= mask - 1;
+		}
+	}
+	return findStringScalar(begin, end, needle, needle_length);
+}
+
+static void maskSse2(const char* begin, size_t length, const scan_set_t* set, uint64_t* bits) {
+	__m128i wanted[SCAN_SET_MAX];
+	for (int i = 0; i < set->count; ++i) {
+		wanted[i] = _mm_set1_epi8((char)set->bytes[i]);
+	}
+	size_t offset = 0;
+	for (; length - offset >= 64; offset += 64) {
+		uint64_t word = 0;
+		for (int part = 0; part < 4; ++part) {
+			const __m128i block = _mm_loadu_si128((const __m128i*)&begin[offset + (size_t)part * 16]);
+			__m128i hits = _mm_setzero_si128();
+			for (int i = 0; i < set->count; ++i) {
+				hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, wanted[i]));
+			}
+			word |= (uint64_t)(unsigned)_mm_movemask_epi8(hits) << (part * 16);
+		}
+		bits[offset / 64] = word;
+	}
+	maskTail(begin, offset, length, set, bits);
+}
+
+__attribute__((target("avx2")))
+static const char* findByteAvx2(const char* begin, const char* end, char byte) {
+	const __m256i wanted = _mm256_set1_epi8(byte);
+	for (; end - begin >= 32; begin += 32) {
+		const __m256i block = _mm256_loadu_si256((const __m256i*)begin);
+		const unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, wanted));
+		if (mask) {
+			return begin + __builtin_ctz(mask);
+		}
+	}
+	return findByteSse2(begin, end, byte);
+}
+
+__attribute__((target("avx2")))
+static const char* findAnyAvx2(const char* begin, const char* end, const scan_set_t* set) {
+	__m256i wanted[SCAN_SET_MAX];
+	for (int i = 0; i < set->count; ++i) {
+		wanted[i] = _mm256_set1_epi8((char)set->bytes[i]);
+	}
+	for (; end - begin >= 32; begin += 32) {
+		const __m256i block = _mm256_loadu_si256((const __m256i*)begin);
+		__m256i hits = _mm256_setzero_si256();
+		for (int i = 0; i < set->count; ++i) {
+			hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, wanted[i]));
+		}
+		const unsigned mask = (unsigned)_mm256_movemask_epi8(hits);
+		if (mask) {
+			return begin + __builtin_ctz(mask);
+		}
+	}
+	return findAnySse2(begin, end, set);
+}
+
+__attribute__((target("avx2")))
+static const char* findStringAvx2(const char* begin, const char* end, const char* needle,
+		size_t needle_length) {
+	if (needle_length < 2) {
+		return needle_length == 1 ? findByteAvx2(begin, end, needle[0]) : begin;
+	}
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+	for (; end - begin >= (long)(32 + needle_length - 1); begin += 32) {
+		const __m256i block_first = _mm256_loadu_si256((const __m256i*)begin);
+		const __m256i block_last = _mm256_loadu_si256((const __m256i*)(begin + needle_length - 1));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));
+		while (mask) {
+			const int offset = __builtin_ctz(mask);
+			if (memcmp(begin + offset + 1, needle + 1, needle_length - 2) == 0) {
+				return begin + offset;
+			}
+			mask &= mask - 1;
+		}
+	}
+	return findStringSse2(begin, end, needle, needle_length);
+}
+
+__attribute__((target("avx2")))
+static void maskAvx2(const char* begin, size_t length, const scan_set_t* set, uint64_t* bits) {
+	__m256i wanted[SCAN_SET_MAX];
+	for (int i = 0; i < set->count; ++i) {
+		wanted[i] = _mm256_set1_epi8((char)set->bytes[i]);
+	}
+	size_t offset = 0;
+	for (; length - offset >= 64; offset += 64) {
+		uint64_t word = 0;
+		for (int part = 0; part < 2; ++part) {
+			const __m256i block = _mm256_loadu_si256((const __m256i*)&begin[offset + (size_t)part * 32]);
+			__m256i hits = _mm256_setzero_si256();
+			for (int i = 0; i < set->count; ++i) {
+				hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, wanted[i]));
+			}
+			word |= (uint64_t)(unsigned)_mm256_movemask_epi8(hits) << (part * 32);
+		}
+		bits[offset / 64] = word;
+	}
+	maskTail(begin, offset, length, set, bits);
+}
+
+#endif
+
+static const scan_kernels_t KERNELS[] = {
+	{ "scalar", findByteScalar, findAnyScalar, findStringScalar, maskScalar },
+#ifdef SCAN_HAVE_X86
+	{ "sse2", findByteSse2, findAnySse2, findStringSse2, maskSse2 },
+	{ "avx2", findByteAvx2, findAnyAvx2, findStringAvx2, maskAvx2 },
+#endif
+};
+
+static const scan_kernels_t* kernels = &KERNELS[0];
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static int kernelSupported(const scan_kernels_t* candidate) {
+#ifdef SCAN_HAVE_X86
+	if (strcmp(candidate->name, "avx2") == 0) {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	}
+#endif
+	(void)candidate;
+	return 1;
+}
+
+static int selectByName(const char* name) {
+	const size_t count = sizeof KERNELS / sizeof KERNELS[0];
+	for (size_t i = 0; i < count; ++i) {
+		if (strcmp(KERNELS[i].name, name) == 0 && kernelSupported(&KERNELS[i])) {
+			kernels = &KERNELS[i];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void selectKernels(void) {
+	const size_t count = sizeof KERNELS / sizeof KERNELS[0];
+	for (size_t i = 0; i < count; ++i) {
+		if (kernelSupported(&KERNELS[i])) {
+			kernels = &KERNELS[i];
+		}
+	}
+
+	const char* forced = configString("ZIP_SCAN", NULL);
+	if (forced && !selectByName(forced)) {
+		fprintf(stderr, "Ignoring ZIP_SCAN=%s, not supported here; scanning with %s.\n", forced, kernels->name);
+	}
+}
+
+int scanSelect(const char* name) {
+	pthread_once(&kernels_once, selectKernels);
+	return selectByName(name);
+}
+
+const char* scanImplementation(void) {
+	pthread_once(&kernels_once, selectKernels);
+	return kernels->name;
+}
+
+int scanSetInit(scan_set_t* set, const unsigned char* bytes, size_t count) {
+	set->count = 0;
+	memset(set->member, 0, sizeof set->member);
+	for (size_t i = 0; i < count; ++i) {
+		if (memchr(set->bytes, bytes[i], (size_t)set->count)) {
+			continue;
+		}
+		if (set->count == SCAN_SET_MAX) {
+			return 0;
+		}
+		set->bytes[set->count++] = bytes[i];
+		set->member[bytes[i]] = 1;
+	}
+	return 1;
+}
+
+const char* scanFindByte(const char* begin, const char* end, char byte) {
+	pthread_once(&kernels_once, selectKernels);
+	return kernels->find_byte(begin, end, byte);
+}
+
+const char* scanFindAny(const char* begin, const char* end, const scan_set_t* set) {
+	pthread_once(&kernels_once, selectKernels);
+	return kernels->find_any(begin, end, set);
+}
+
+const char* scanFindString(const char* begin, const char* end, const char* needle, size_t needle_length) {
+	pthread_once(&kernels_once, selectKernels);
+	return kernels->find_string(begin, end, needle, needle_length);
+}
+
+void scanMask(const char* begin, size_t length, const scan_set_t* set, uint64_t* bits) {
+	pthread_once(&kernels_once, selectKernels);
+	kernels->mask(begin, length, set, bits);
+}
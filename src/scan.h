@@ -0,0 +1,40 @@
+#ifndef ZIP_CODES_SCAN_H
+#define ZIP_CODES_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCAN_SET_MAX 16
+
+/* Up to SCAN_SET_MAX bytes to look for at once, e.g. the first bytes of a set of labels. */
+typedef struct ScanSet {
+	unsigned char bytes[SCAN_SET_MAX];
+	int count;
+	unsigned char member[256];   /* lookup table for the scalar kernel */
+} scan_set_t;
+
+/*
+ * Byte scanning kernels shared by the page parsers. The implementation is
+ * picked once per process: AVX2 when the CPU has it, otherwise SSE2 on x86-64,
+ * otherwise portable scalar code. ZIP_SCAN=scalar|sse2|avx2 forces one.
+ * Every search covers [begin, end) and returns end when nothing matches.
+ */
+const char* scanFindByte(const char* begin, const char* end, char byte);
+const char* scanFindAny(const char* begin, const char* end, const scan_set_t* set);
+const char* scanFindString(const char* begin, const char* end, const char* needle, size_t needle_length);
+
+/*
+ * Classifies length bytes in one pass: bit i % 64 of bits[i / 64] is set when
+ * begin[i] is in set. bits needs (length + 63) / 64 words. Walking the mask
+ * with ctz is much cheaper than one search call per hit when hits are dense.
+ */
+void scanMask(const char* begin, size_t length, const scan_set_t* set, uint64_t* bits);
+
+/* Returns 0 when bytes holds more than SCAN_SET_MAX distinct values. */
+int scanSetInit(scan_set_t* set, const unsigned char* bytes, size_t count);
+
+/* Switches to the named implementation; returns 0 if this CPU or build lacks it. */
+int scanSelect(const char* name);
+const char* scanImplementation(void);
+
+#endif
@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "session_cache.h"
+
+#define ALTSVC_FILE_NAME "altsvc.txt"
+#define HSTS_FILE_NAME "hsts.txt"
+#define TLS_SESSION_FILE_NAME "tls-sessions.txt"
+
+static int ensureStateDir(const char* state_dir) {
+	if (mkdir(state_dir, 0700) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Failed to create state directory '%s': %s\n", state_dir, strerror(errno));
+		return 0;
+	}
+	return 1;
+}
+
+static void statePath(char* path, size_t size, const char* state_dir, const char* name) {
+	snprintf(path, size, "%s/%s", state_dir, name);
+}
+
+void sessionCacheAttach(CURL* handle, const char* state_dir) {
+	if (!state_dir || !ensureStateDir(state_dir)) {
+		return;
+	}
+
+	char path[1024];
+	statePath(path, sizeof path, state_dir, ALTSVC_FILE_NAME);
+	curl_easy_setopt(handle, CURLOPT_ALTSVC_CTRL, (long)(CURLALTSVC_H1 | CURLALTSVC_H2));
+	curl_easy_setopt(handle, CURLOPT_ALTSVC, path);
+
+	statePath(path, sizeof path, state_dir, HSTS_FILE_NAME);
+	curl_easy_setopt(handle, CURLOPT_HSTS_CTRL, (long)CURLHSTS_ENABLE);
+	curl_easy_setopt(handle, CURLOPT_HSTS, path);
+}
+
+#if LIBCURL_VERSION_NUM >= 0x080c00
+
+static void writeHex(FILE* fp, const unsigned char* data, size_t size) {
+	for (size_t i = 0; i < size; ++i) {
+		fprintf(fp, "%02x", data[i]);
+	}
+}
+
+static size_t readHex(const char* hex, unsigned char* out, size_t capacity) {
+	size_t size = 0;
+	for (; hex[0] && hex[1] && size < capacity; hex += 2) {
+		unsigned int byte = 0;
+		if (sscanf(hex, "%2x", &byte) != 1) {
+			break;
+		}
+		out[size++] = (unsigned char)byte;
+	}
+	return size;
+}
+
+typedef struct {
+	FILE* fp;
+	long saved;
+} session_export_t;
+
+static CURLcode exportSession(CURL* handle, void* userptr, const char* session_key,
+		const unsigned char* shmac, size_t shmac_len, const unsigned char* sdata, size_t sdata_len,
+		curl_off_t valid_until, int ietf_tls_id, const char* alpn, size_t earlydata_max) {
+	(void)handle;
+	(void)ietf_tls_id;
+	(void)alpn;
+	(void)earlydata_max;
+	session_export_t* out = (session_export_t*)userptr;
+
+	/* saved_at valid_until session_key shmac sdata, binary fields hex encoded */
+	fprintf(out->fp, "%ld %ld ", (long)time(NULL), (long)valid_until);
+	writeHex(out->fp, (const unsigned char*)session_key, strlen(session_key));
+	fputc(' ', out->fp);
+	writeHex(out->fp, shmac, shmac_len);
+	fputc(' ', out->fp);
+	writeHex(out->fp, sdata, sdata_len);
+	fputc('\n', out->fp);
+	out->saved++;
+	return CURLE_OK;
+}
+
+void sessionCacheLoad(CURL* handle, const char* state_dir, long ttl) {
+	if (!state_dir) {
+		return;
+	}
+
+	char path[1024];
+	statePath(path, sizeof path, state_dir, TLS_SESSION_FILE_NAME);
+	FILE* fp = fopen(path, "r");
+	if (!fp) {
+		return;
+	}
+
+	const long now = (long)time(NULL);
+	long loaded = 0;
+	char* line = NULL;
+	size_t line_size = 0;
+	while (getline(&line, &line_size, fp) > 0) {
+		long saved_at = 0;
+		long valid_until = 0;
+		int offset = 0;
+		if (sscanf(line, "%ld %ld %n", &saved_at, &valid_until, &offset) != 2) {
+			continue;
+		}
+		if ((ttl > 0 && now - saved_at > ttl) || (valid_until > 0 && now > valid_until)) {
+			continue;
+		}
+
+		char* key_hex = strtok(&line[offset], " \n");
+		char* shmac_hex = strtok(NULL, " \n");
+		char* sdata_hex = strtok(NULL, " \n");
+		if (!key_hex || !shmac_hex || !sdata_hex) {
+			continue;
+		}
+
+		const size_t key_capacity = strlen(key_hex) / 2 + 1;
+		const size_t shmac_capacity = strlen(shmac_hex) / 2;
+		const size_t sdata_capacity = strlen(sdata_hex) / 2;
+		char* key = (char*)calloc(key_capacity, 1);
+		unsigned char* shmac = (unsigned char*)malloc(shmac_capacity + 1);
+		unsigned char* sdata = (unsigned char*)malloc(sdata_capacity + 1);
+		if (!key || !shmac || !sdata) {
+			fprintf(stderr, "Failed to allocate a TLS session from %s, skipping it.\n", path);
+			free(key);
+			free(shmac);
+			free(sdata);
+			continue;
+		}
+
+		readHex(key_hex, (unsigned char*)key, key_capacity - 1);
+		const size_t shmac_len = readHex(shmac_hex, shmac, shmac_capacity);
+		const size_t sdata_len = readHex(sdata_hex, sdata, sdata_capacity);
+		if (curl_easy_ssls_import(handle, key, shmac, shmac_len, sdata, sdata_len) == CURLE_OK) {
+			loaded++;
+		}
+
+		free(key);
+		free(shmac);
+		free(sdata);
+	}
+	free(line);
+	fclose(fp);
+
+	fprintf(stderr, "Loaded %ld TLS sessions from %s.\n", loaded, path);
+}
+
+void sessionCacheSave(CURL* handle, const char* state_dir) {
+	if (!state_dir || !ensureStateDir(state_dir)) {
+		return;
+	}
+
+	char path[1024];
+	char tmp_path[1040];
+	statePath(path, sizeof path, state_dir, TLS_SESSION_FILE_NAME);
+	snprintf(tmp_path, sizeof tmp_path, "%s.tmp", path);
+
+	session_export_t out;
+	out.fp = fopen(tmp_path, "w");
+	out.saved = 0;
+	if (!out.fp) {
+		fprintf(stderr, "Failed to open %s for writing.\n", tmp_path);
+		return;
+	}
+
+	const CURLcode rc = curl_easy_ssls_export(handle, exportSession, &out);
+	fclose(out.fp);
+	if (rc != CURLE_OK) {
+		fprintf(stderr, "Failed to export TLS sessions: %s\n", curl_easy_strerror(rc));
+		remove(tmp_path);
+		return;
+	}
+
+	/* Replace atomically so a crash never leaves a truncated cache behind. */
+	if (rename(tmp_path, path) != 0) {
+		fprintf(stderr, "Failed to replace %s: %s\n", path, strerror(errno));
+		return;
+	}
+	fprintf(stderr, "Saved %ld TLS sessions to %s.\n", out.saved, path);
+}
+
+#else
+
+/* libcurl before 8.12 cannot export TLS sessions; only alt-svc and HSTS persist. */
+void sessionCacheLoad(CURL* handle, const char* state_dir, long ttl) {
+	(void)handle;
+	(void)state_dir;
+	(void)ttl;
+}
+
+void sessionCacheSave(CURL* handle, const char* state_dir) {
+	(void)handle;
+	(void)state_dir;
+}
+
+#endif
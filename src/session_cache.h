@@ -0,0 +1,18 @@
+#ifndef ZIP_CODES_SESSION_CACHE_H
+#define ZIP_CODES_SESSION_CACHE_H
+
+#include <curl/curl.h>
+
+#define SESSION_CACHE_DEFAULT_TTL 86400
+
+/*
+ * On-disk protocol state kept between runs in state_dir: curl's own alt-svc
+ * and HSTS caches, which carry a per-host expiry, and (with libcurl 8.12 or
+ * newer) exported TLS session tickets keyed by curl's per-host session key.
+ * Entries older than ttl seconds are ignored when loading.
+ */
+void sessionCacheAttach(CURL* handle, const char* state_dir);
+void sessionCacheLoad(CURL* handle, const char* state_dir, long ttl);
+void sessionCacheSave(CURL* handle, const char* state_dir);
+
+#endif
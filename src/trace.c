@@ -0,0 +1,263 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "config.h"
+#include "trace.h"
+
+#define THREAD_NAME_SIZE 32
+
+typedef struct TraceEvent {
+	const char* name;        /* static strings only */
+	const char* category;
+	uint64_t id;             /* async spans; 0 for a span on the thread's track */
+	double start;
+	double end;
+	char label[TRACE_LABEL_SIZE];
+} trace_event_t;
+
+typedef struct TraceChunk {
+	trace_event_t events[TRACE_CHUNK_EVENTS];
+	atomic_int count;        /* published with release so a reader sees whole events */
+	struct TraceChunk* next;
+} trace_chunk_t;
+
+typedef struct TraceBuffer {
+	int tid;
+	char name[THREAD_NAME_SIZE];
+	trace_chunk_t* first;
+	trace_chunk_t* last;
+	long events;
+	long dropped;
+	struct TraceBuffer* next;
+} trace_buffer_t;
+
+static int tracing;
+static const char* trace_path;
+static long max_events;
+static double trace_started;
+static _Atomic(trace_buffer_t*) buffers;
+static atomic_int next_tid;
+static _Thread_local trace_buffer_t* thread_buffer;
+
+static double monotonicSeconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+double traceClock(void) {
+	return monotonicSeconds();
+}
+
+int traceEnabled(void) {
+	return tracing;
+}
+
+void traceStart(void) {
+	trace_path = configString("ZIP_TRACE", NULL);
+	max_events = configLong("ZIP_TRACE_MAX_EVENTS", TRACE_DEFAULT_MAX_EVENTS);
+	trace_started = monotonicSeconds();
+	tracing = trace_path != NULL;
+	traceThreadName("main");
+}
+
+static trace_chunk_t* newChunk(void) {
+	trace_chunk_t* chunk = (trace_chunk_t*)malloc(sizeof(trace_chunk_t));
+	if (!chunk) {
+		return NULL;
+	}
+	atomic_init(&chunk->count, 0);
+	chunk->next = NULL;
+	return chunk;
+}
+
+/* The calling thread's buffer, registered on first use. */
+static trace_buffer_t* threadBuffer(void) {
+	if (thread_buffer) {
+		return thread_buffer;
+	}
+	trace_buffer_t* buffer = (trace_buffer_t*)calloc(1, sizeof(trace_buffer_t));
+	if (!buffer || !(buffer->first = newChunk())) {
+		free(buffer);
+		return NULL;
+	}
+	buffer->last = buffer->first;
+	buffer->tid = atomic_fetch_add(&next_tid, 1) + 1;
+	buffer->next = atomic_load(&buffers);
+	while (!atomic_compare_exchange_weak(&buffers, &buffer->next, buffer)) {
+	}
+	thread_buffer = buffer;
+	return buffer;
+}
+
+void traceThreadName(const char* name) {
+	trace_buffer_t* buffer = tracing ? threadBuffer() : NULL;
+	if (buffer) {
+		snprintf(buffer->name, sizeof buffer->name, "%s", name);
+	}
+}
+
+static void copyLabel(char* label, const char* text) {
+	if (!text) {
+		label[0] = '\0';
+		return;
+	}
+	const char* slash = strrchr(text, '/');
+	snprintf(label, TRACE_LABEL_SIZE, "%s", slash && slash[1] ? &slash[1] : text);
+}
+
+static void record(const char* name, const char* category, uint64_t id, double start, double end,
+		const char* label) {
+	trace_buffer_t* buffer = threadBuffer();
+	if (!buffer) {
+		return;
+	}
+	if (buffer->events >= max_events) {
+		buffer->dropped++;
+		return;
+	}
+	trace_chunk_t* chunk = buffer->last;
+	int count = atomic_load_explicit(&chunk->count, memory_order_relaxed);
+	if (count == TRACE_CHUNK_EVENTS) {
+		if (!(chunk->next = newChunk())) {
+			buffer->dropped++;
+			return;
+		}
+		chunk = buffer->last = chunk->next;
+		count = 0;
+	}
+	trace_event_t* event = &chunk->events[count];
+	event->name = name;
+	event->category = category;
+	event->id = id;
+	event->start = start;
+	event->end = end;
+	copyLabel(event->label, label);
+	atomic_store_explicit(&chunk->count, count + 1, memory_order_release);
+	buffer->events++;
+}
+
+void traceSpan(const char* name, const char* category, double start, double end, const char* label) {
+	if (tracing) {
+		record(name, category, 0, start, end, label);
+	}
+}
+
+void traceAsyncSpan(const char* name, const char* category, uint64_t id, double start, double end,
+		const char* label) {
+	if (tracing) {
+		record(name, category, id, start, end, label);
+	}
+}
+
+static void writeString(FILE* fp, const char* text) {
+	fputc('"', fp);
+	for (const char* c = text; *c; ++c) {
+		if (*c == '"' || *c == '\\') {
+			fputc('\\', fp);
+		}
+		if ((unsigned char)*c >= 0x20) {
+			fputc(*c, fp);
+		}
+	}
+	fputc('"', fp);
+}
+
+static void writeEvent(FILE* fp, const trace_buffer_t* buffer, const trace_event_t* event, int* first) {
+	const double start_us = (event->start - trace_started) * 1e6;
+	const double end_us = (event->end - trace_started) * 1e6;
+	if (event->id == 0) {
+		fprintf(fp, "%s\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":", *first ? "" : ",",
+			buffer->tid, start_us, end_us > start_us ? end_us - start_us : 0.0);
+		writeString(fp, event->name);
+		fprintf(fp, ",\"cat\":");
+		writeString(fp, event->category);
+		fprintf(fp, ",\"args\":{\"page\":");
+		writeString(fp, event->label);
+		fprintf(fp, "}}");
+		*first = 0;
+		return;
+	}
+
+	/* Async spans are a begin and an end event sharing an id. */
+	for (int end = 0; end < 2; ++end) {
+		fprintf(fp, "%s\n{\"ph\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"id\":\"0x%llx\",\"name\":",
+			*first ? "" : ",", end ? "e" : "b", buffer->tid, end ? end_us : start_us,
+			(unsigned long long)event->id);
+		writeString(fp, event->name);
+		fprintf(fp, ",\"cat\":");
+		writeString(fp, event->category);
+		if (!end) {
+			fprintf(fp, ",\"args\":{\"page\":");
+			writeString(fp, event->label);
+			fprintf(fp, "}");
+		}
+		fprintf(fp, "}");
+		*first = 0;
+	}
+}
+
+static void freeBuffers(void) {
+	trace_buffer_t* buffer = atomic_exchange(&buffers, NULL);
+	while (buffer) {
+		trace_buffer_t* next = buffer->next;
+		while (buffer->first) {
+			trace_chunk_t* chunk = buffer->first->next;
+			free(buffer->first);
+			buffer->first = chunk;
+		}
+		free(buffer);
+		buffer = next;
+	}
+	thread_buffer = NULL;
+}
+
+void traceStop(void) {
+	if (!tracing) {
+		return;
+	}
+	tracing = 0;
+
+	FILE* fp = fopen(trace_path, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed to write trace %s: %s\n", trace_path, strerror(errno));
+		return;
+	}
+	long events = 0;
+	long dropped = 0;
+	int first = 1;
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	for (trace_buffer_t* buffer = atomic_load(&buffers); buffer; buffer = buffer->next) {
+		if (buffer->name[0]) {
+			fprintf(fp, "%s\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":",
+				first ? "" : ",", buffer->tid);
+			writeString(fp, buffer->name);
+			fprintf(fp, "}}");
+			first = 0;
+		}
+		for (trace_chunk_t* chunk = buffer->first; chunk; chunk = chunk->next) {
+			const int count = atomic_load_explicit(&chunk->count, memory_order_acquire);
+			for (int i = 0; i < count; ++i) {
+				writeEvent(fp, buffer, &chunk->events[i], &first);
+			}
+			events += count;
+		}
+		dropped += buffer->dropped;
+	}
+	fprintf(fp, "\n]}\n");
+	freeBuffers();
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "Failed to write trace %s: %s\n", trace_path, strerror(errno));
+		return;
+	}
+	fprintf(stderr, "Trace of %ld spans written to %s", events, trace_path);
+	if (dropped > 0) {
+		fprintf(stderr, " (%ld dropped over ZIP_TRACE_MAX_EVENTS)", dropped);
+	}
+	fprintf(stderr, ".\n");
+}
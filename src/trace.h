@@ -0,0 +1,42 @@
+#ifndef ZIP_CODES_TRACE_H
+#define ZIP_CODES_TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_CHUNK_EVENTS 4096
+#define TRACE_DEFAULT_MAX_EVENTS 1000000   /* per thread; later spans are counted as dropped */
+#define TRACE_LABEL_SIZE 32
+
+/*
+ * Opt-in span tracing in the Chrome trace-event format, for chrome://tracing
+ * or Perfetto. Set ZIP_TRACE to the output path to turn it on; otherwise
+ * every call below returns at once.
+ *
+ * Each thread appends to a buffer of its own, registered once with a
+ * compare-and-swap, so recording never takes a lock. The buffers are written
+ * out by traceStop() after the worker threads are joined.
+ *
+ * Times are CLOCK_MONOTONIC seconds (traceClock()). A label is shown as the
+ * span's "page" argument; a URL is shortened to its last path segment.
+ */
+void traceStart(void);
+int traceEnabled(void);
+double traceClock(void);
+
+/* Names the calling thread's track. */
+void traceThreadName(const char* name);
+
+/* A span on the calling thread's track; spans on one thread must nest. */
+void traceSpan(const char* name, const char* category, double start, double end, const char* label);
+
+/*
+ * A span on a track of its own, for work that overlaps on one thread, like
+ * transfers in flight on the fetch loop. id tells concurrent spans apart.
+ */
+void traceAsyncSpan(const char* name, const char* category, uint64_t id, double start, double end,
+	const char* label);
+
+/* Writes the trace file; call once every traced thread has finished. */
+void traceStop(void);
+
+#endif
@@ -0,0 +1,337 @@
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "config.h"
+#include "log.h"
+#include "zip_code_db.h"
+
+static sqlite3_stmt* prepareStatement(sqlite3* db, const char* sql) {
+	sqlite3_stmt* stmt = NULL;
+	const int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare '%s' with error: %s\n", sql, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		exit(EXIT_FAILURE);
+	}
+	return stmt;
+}
+
+static int stepAndReset(sqlite3_stmt* stmt) {
+	const int rc = sqlite3_step(stmt);
+	if (rc != SQLITE_DONE) {
+		logError("Failed to execute insert stmt with error: %s\n",
+			sqlite3_errmsg(sqlite3_db_handle(stmt)));
+	}
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+static void bindInteger(sqlite3_stmt* stmt, int index, int64_t value) {
+	sqlite3_bind_int64(stmt, index, value);
+}
+
+/* Fixed point value with decimals places, e.g. 1540 with 4 is bound as 0.154. */
+static void bindFixed(sqlite3_stmt* stmt, int index, int32_t value, int decimals) {
+	double scale = 1.0;
+	for (int i = 0; i < decimals; ++i) {
+		scale *= 10.0;
+	}
+	sqlite3_bind_double(stmt, index, (double)value / scale);
+}
+
+static void bindFraction(sqlite3_stmt* stmt, int index, int32_t value) {
+	bindFixed(stmt, index, value, ZIP_CODE_FRACTION_DECIMALS);
+}
+
+static void bindDecimal(sqlite3_stmt* stmt, int index, int32_t value) {
+	bindFixed(stmt, index, value, ZIP_CODE_DECIMAL_DECIMALS);
+}
+
+sqlite3_stmt* prepareZipCodeInsert(sqlite3* db) {
+	return prepareStatement(db, "INSERT OR REPLACE INTO zip_codes VALUES ( "
+		"?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ? );");
+}
+
+int insertZipCodeRecord(sqlite3_stmt* stmt, const ZipCodeRecord* record) {
+	bindInteger(stmt, 1, record->code);
+	bindInteger(stmt, 2, record->county_id);
+	bindInteger(stmt, 3, record->population);
+	bindInteger(stmt, 4, record->population2010);
+	bindInteger(stmt, 5, record->population2000);
+	bindDecimal(stmt, 6, record->landArea);
+	bindFraction(stmt, 7, record->foreignBornPopulation);
+	bindInteger(stmt, 8, record->medianHouseholdIncome);
+	bindInteger(stmt, 9, record->medianHomePrice);
+	bindDecimal(stmt, 10, record->medianResidentAge);
+	bindInteger(stmt, 11, record->whitePopulation);
+	bindInteger(stmt, 12, record->hispanicLatinoPopulation);
+	bindInteger(stmt, 13, record->blackPopulation);
+	bindInteger(stmt, 14, record->asianPopulation);
+	bindInteger(stmt, 15, record->americanIndianPopulation);
+	bindFraction(stmt, 16, record->highSchool);
+	bindFraction(stmt, 17, record->bachelorsDegree);
+	bindFraction(stmt, 18, record->graduateDegree);
+	bindFraction(stmt, 19, record->malePercent);
+	bindFraction(stmt, 20, record->femalePercent);
+	bindDecimal(stmt, 21, record->averageHouseholdSize);
+	return stepAndReset(stmt);
+}
+
+sqlite3_stmt* prepareCountyZipInsert(sqlite3* db) {
+	return prepareStatement(db, "INSERT OR REPLACE INTO zip_codes_by_county VALUES ( ?, ? );");
+}
+
+int insertCountyZip(sqlite3_stmt* stmt, const char* code, county_id_t county_id) {
+	bindInteger(stmt, 1, strtoll(code, NULL, 10));
+	bindInteger(stmt, 2, county_id);
+	return stepAndReset(stmt);
+}
+
+sqlite3_stmt* prepareZipCodeSelect(sqlite3* db) {
+	return prepareStatement(db, "SELECT * FROM zip_codes WHERE zip_code = ?;");
+}
+
+static int32_t columnFixed(sqlite3_stmt* stmt, int index, int decimals) {
+	double scale = 1.0;
+	for (int i = 0; i < decimals; ++i) {
+		scale *= 10.0;
+	}
+	return (int32_t)llround(sqlite3_column_double(stmt, index) * scale);
+}
+
+static int32_t columnFraction(sqlite3_stmt* stmt, int index) {
+	return columnFixed(stmt, index, ZIP_CODE_FRACTION_DECIMALS);
+}
+
+static int32_t columnDecimal(sqlite3_stmt* stmt, int index) {
+	return columnFixed(stmt, index, ZIP_CODE_DECIMAL_DECIMALS);
+}
+
+int selectZipCodeRecord(sqlite3_stmt* stmt, int32_t code, ZipCodeRecord* record) {
+	sqlite3_bind_int64(stmt, 1, code);
+	const int found = sqlite3_step(stmt) == SQLITE_ROW;
+	if (found) {
+		/* Column i is bind index i + 1 in insertZipCodeRecord(). */
+		record->code = sqlite3_column_int(stmt, 0);
+		record->county_id = (county_id_t)sqlite3_column_int(stmt, 1);
+		record->population = sqlite3_column_int(stmt, 2);
+		record->population2010 = sqlite3_column_int(stmt, 3);
+		record->population2000 = sqlite3_column_int(stmt, 4);
+		record->landArea = columnDecimal(stmt, 5);
+		record->foreignBornPopulation = columnFraction(stmt, 6);
+		record->medianHouseholdIncome = sqlite3_column_int(stmt, 7);
+		record->medianHomePrice = sqlite3_column_int(stmt, 8);
+		record->medianResidentAge = columnDecimal(stmt, 9);
+		record->whitePopulation = sqlite3_column_int(stmt, 10);
+		record->hispanicLatinoPopulation = sqlite3_column_int(stmt, 11);
+		record->blackPopulation = sqlite3_column_int(stmt, 12);
+		record->asianPopulation = sqlite3_column_int(stmt, 13);
+		record->americanIndianPopulation = sqlite3_column_int(stmt, 14);
+		record->highSchool = columnFraction(stmt, 15);
+		record->bachelorsDegree = columnFraction(stmt, 16);
+		record->graduateDegree = columnFraction(stmt, 17);
+		record->malePercent = columnFraction(stmt, 18);
+		record->femalePercent = columnFraction(stmt, 19);
+		record->averageHouseholdSize = columnDecimal(stmt, 20);
+	}
+	sqlite3_reset(stmt);
+	return found;
+}
+
+sqlite3_stmt* prepareCountyZipSelect(sqlite3* db) {
+	return prepareStatement(db, "SELECT zip_code FROM zip_codes_by_county WHERE county_id = ? ORDER BY zip_code;");
+}
+
+static double monotonicMs(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1e6;
+}
+
+static int execPragma(sqlite3* db, const char* sql) {
+	char* err = NULL;
+	if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+		fprintf(stderr, "Failed to execute '%s' with error: %s\n", sql, err);
+		sqlite3_free(err);
+		return 0;
+	}
+	return 1;
+}
+
+/* Reads the first column of a pragma into text, returns it as an integer. */
+static long queryPragma(sqlite3* db, const char* sql, char* text, size_t text_size) {
+	sqlite3_stmt* stmt = NULL;
+	long value = 0;
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare '%s' with error: %s\n", sql, sqlite3_errmsg(db));
+		return value;
+	}
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		value = (long)sqlite3_column_int64(stmt, 0);
+		if (text) {
+			const unsigned char* column = sqlite3_column_text(stmt, 0);
+			snprintf(text, text_size, "%s", column ? (const char*)column : "");
+		}
+	}
+	sqlite3_finalize(stmt);
+	return value;
+}
+
+static void indexName(char* name, size_t size, const char* table) {
+	snprintf(name, size, "%s_county_idx", table);
+}
+
+static void createCountyIndex(sqlite3* db, const char* table) {
+	char name[128];
+	char sql[256];
+	indexName(name, sizeof name, table);
+	snprintf(sql, sizeof sql, "CREATE INDEX IF NOT EXISTS %s ON %s ( county_id );", name, table);
+
+	const double start = monotonicMs();
+	execPragma(db, sql);
+	fprintf(stderr, "Index %s ready in %.1f ms.\n", name, monotonicMs() - start);
+}
+
+/*
+ * Lists table's columns other than zip_code, state and county as "o.name, ..."
+ * into rest. Returns whether it has a state column, so 0 for a missing table.
+ */
+static int textCountyColumns(sqlite3* db, const char* table, char* rest, size_t rest_size) {
+	char sql[128];
+	snprintf(sql, sizeof sql, "PRAGMA table_info ( %s );", table);
+	sqlite3_stmt* stmt = NULL;
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare '%s' with error: %s\n", sql, sqlite3_errmsg(db));
+		return 0;
+	}
+
+	int has_state = 0;
+	size_t used = 0;
+	rest[0] = '\0';
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		const char* name = (const char*)sqlite3_column_text(stmt, 1);
+		if (!name || strcmp(name, "zip_code") == 0 || strcmp(name, "county") == 0) {
+			continue;
+		}
+		if (strcmp(name, "state") == 0) {
+			has_state = 1;
+			continue;
+		}
+		used += (size_t)snprintf(&rest[used], used < rest_size ? rest_size - used : 0, ", o.%s", name);
+	}
+	sqlite3_finalize(stmt);
+	if (used >= rest_size) {
+		fprintf(stderr, "Too many columns in %s to migrate it.\n", table);
+		return 0;
+	}
+	return has_state;
+}
+
+void dbMigrateCountyColumns(sqlite3* db, const char* table, const char* create_stmt) {
+	char rest[1024];
+	if (!textCountyColumns(db, table, rest, sizeof rest)) {
+		return;
+	}
+
+	const double start = monotonicMs();
+	char steps[4][2048];
+	snprintf(steps[0], sizeof steps[0], "INSERT OR IGNORE INTO counties ( state, county ) "
+		"SELECT DISTINCT state, county FROM %s WHERE state IS NOT NULL AND county IS NOT NULL;", table);
+	snprintf(steps[1], sizeof steps[1], "ALTER TABLE %s RENAME TO %s_text_counties;", table, table);
+	snprintf(steps[2], sizeof steps[2], "INSERT INTO %s SELECT o.zip_code, c.county_id%s FROM %s_text_counties o "
+		"LEFT JOIN counties c ON c.state = o.state AND c.county = o.county;", table, rest, table);
+	/* The old (state, county) index goes with the old table. */
+	snprintf(steps[3], sizeof steps[3], "DROP TABLE %s_text_counties;", table);
+
+	int ok = execPragma(db, "BEGIN TRANSACTION;");
+	ok = ok && execPragma(db, steps[0]) && execPragma(db, steps[1]) && execPragma(db, create_stmt)
+		&& execPragma(db, steps[2]) && execPragma(db, steps[3]);
+	if (!ok) {
+		execPragma(db, "ROLLBACK;");
+		fprintf(stderr, "Failed to move %s to county ids, it keeps its state and county columns.\n", table);
+		sqlite3_close(db);
+		exit(EXIT_FAILURE);
+	}
+	execPragma(db, "COMMIT;");
+	fprintf(stderr, "Moved %s to county ids in %.1f ms.\n", table, monotonicMs() - start);
+}
+
+void dbBulkLoadConfigInit(db_bulk_load_config_t* config) {
+	config->enabled = 0;
+	config->synchronous = DB_BULK_DEFAULT_SYNCHRONOUS;
+	config->cache_mb = DB_BULK_DEFAULT_CACHE_MB;
+	config->mmap_mb = DB_BULK_DEFAULT_MMAP_MB;
+}
+
+void dbBulkLoadConfigFromEnv(db_bulk_load_config_t* config) {
+	config->enabled = configLong("ZIP_DB_BULK", config->enabled);
+	config->synchronous = configString("ZIP_DB_BULK_SYNC", config->synchronous);
+	config->cache_mb = configLong("ZIP_DB_BULK_CACHE_MB", config->cache_mb);
+	config->mmap_mb = configLong("ZIP_DB_BULK_MMAP_MB", config->mmap_mb);
+
+	if (strcasecmp(config->synchronous, "NORMAL") != 0 && strcasecmp(config->synchronous, "OFF") != 0) {
+		fprintf(stderr, "Ignoring ZIP_DB_BULK_SYNC=%s, expected NORMAL or OFF.\n", config->synchronous);
+		config->synchronous = DB_BULK_DEFAULT_SYNCHRONOUS;
+	}
+}
+
+void dbBeginBulkLoad(sqlite3* db, const db_bulk_load_config_t* config, const char* table,
+		db_durable_settings_t* saved) {
+	if (!config->enabled) {
+		createCountyIndex(db, table);
+		return;
+	}
+
+	queryPragma(db, "PRAGMA journal_mode;", saved->journal_mode, sizeof saved->journal_mode);
+	saved->synchronous = queryPragma(db, "PRAGMA synchronous;", NULL, 0);
+	saved->cache_size = queryPragma(db, "PRAGMA cache_size;", NULL, 0);
+	saved->mmap_size = queryPragma(db, "PRAGMA mmap_size;", NULL, 0);
+
+	char sql[256];
+	char journal_mode[16] = {'\0'};
+	queryPragma(db, "PRAGMA journal_mode = WAL;", journal_mode, sizeof journal_mode);
+	snprintf(sql, sizeof sql, "PRAGMA synchronous = %s;", config->synchronous);
+	execPragma(db, sql);
+	/* A negative cache_size is in KiB rather than pages. */
+	snprintf(sql, sizeof sql, "PRAGMA cache_size = %ld;", -config->cache_mb * 1024);
+	execPragma(db, sql);
+	snprintf(sql, sizeof sql, "PRAGMA mmap_size = %ld;", config->mmap_mb * 1024 * 1024);
+	execPragma(db, sql);
+
+	char name[128];
+	indexName(name, sizeof name, table);
+	snprintf(sql, sizeof sql, "DROP INDEX IF EXISTS %s;", name);
+	execPragma(db, sql);
+
+	fprintf(stderr, "Bulk load into %s: journal_mode=%s synchronous=%s cache=%ld MB mmap=%ld MB, "
+		"index deferred.\n", table, journal_mode, config->synchronous, config->cache_mb, config->mmap_mb);
+}
+
+void dbEndBulkLoad(sqlite3* db, const db_bulk_load_config_t* config, const char* table,
+		const db_durable_settings_t* saved) {
+	if (!config->enabled) {
+		return;
+	}
+
+	createCountyIndex(db, table);
+
+	char sql[128];
+	snprintf(sql, sizeof sql, "PRAGMA cache_size = %ld;", saved->cache_size);
+	execPragma(db, sql);
+	snprintf(sql, sizeof sql, "PRAGMA mmap_size = %ld;", saved->mmap_size);
+	execPragma(db, sql);
+	snprintf(sql, sizeof sql, "PRAGMA synchronous = %ld;", saved->synchronous);
+	execPragma(db, sql);
+	/* Leaving WAL checkpoints the log back into the database file. */
+	snprintf(sql, sizeof sql, "PRAGMA journal_mode = %s;", saved->journal_mode);
+	char journal_mode[16] = {'\0'};
+	queryPragma(db, sql, journal_mode, sizeof journal_mode);
+	fprintf(stderr, "Restored journal_mode=%s synchronous=%ld after bulk load.\n", journal_mode,
+		saved->synchronous);
+}
@@ -0,0 +1,105 @@
+#ifndef ZIP_CODES_ZIP_CODE_DB_H
+#define ZIP_CODES_ZIP_CODE_DB_H
+
+#include <sqlite3.h>
+#include "zip_code_record.h"
+
+#define COUNTIES_CREATE_STMT "CREATE TABLE IF NOT EXISTS counties ( " \
+	"county_id INTEGER PRIMARY KEY, " \
+	"state TEXT NOT NULL, " \
+	"county TEXT NOT NULL, " \
+	"UNIQUE ( state, county ) );"
+
+#define ZIP_CODES_CREATE_STMT "CREATE TABLE IF NOT EXISTS zip_codes ( " \
+	"zip_code INTEGER PRIMARY KEY, " \
+	"county_id INTEGER REFERENCES counties ( county_id ), " \
+	"population INTEGER, " \
+	"population_2010 INTEGER, " \
+	"population_2000 INTEGER, " \
+	"land_area REAL, " \
+	"foreign_born_population REAL, " \
+	"median_household_income INTEGER, " \
+	"median_home_price INTEGER, " \
+	"median_resident_age REAL, " \
+	"white_population INTEGER, " \
+	"hispanic_population INTEGER, " \
+	"black_population INTEGER, " \
+	"asian_population INTEGER, " \
+	"american_indian_population INTEGER, " \
+	"high_school REAL, " \
+	"bachelors_degree REAL, " \
+	"graduate_degree REAL, " \
+	"male_percent REAL, " \
+	"female_percent REAL, " \
+	"average_household_size REAL );"
+
+#define ZIP_CODES_BY_COUNTY_CREATE_STMT "CREATE TABLE IF NOT EXISTS zip_codes_by_county ( " \
+	"zip_code INTEGER PRIMARY KEY, " \
+	"county_id INTEGER REFERENCES counties ( county_id ) );"
+
+#define DB_BULK_DEFAULT_SYNCHRONOUS "NORMAL"
+#define DB_BULK_DEFAULT_CACHE_MB 64
+#define DB_BULK_DEFAULT_MMAP_MB 256
+
+typedef struct DbBulkLoadConfig {
+	long enabled;              /* rebuild profile; off keeps the durable settings throughout */
+	const char* synchronous;   /* NORMAL or OFF while loading */
+	long cache_mb;             /* page cache while loading */
+	long mmap_mb;              /* memory-mapped I/O while loading */
+} db_bulk_load_config_t;
+
+/* Connection settings in force before dbBeginBulkLoad(), restored by dbEndBulkLoad(). */
+typedef struct DbDurableSettings {
+	char journal_mode[16];
+	long synchronous;
+	long cache_size;
+	long mmap_size;
+} db_durable_settings_t;
+
+void dbBulkLoadConfigInit(db_bulk_load_config_t* config);
+
+/* Applies the ZIP_DB_BULK* environment overrides on top of the caller's defaults. */
+void dbBulkLoadConfigFromEnv(db_bulk_load_config_t* config);
+
+/*
+ * Moves a table created before the counties table existed, with state and
+ * county TEXT columns, to the county_id schema of create_stmt: the distinct
+ * pairs are added to counties and the rows copied over in one transaction.
+ * Does nothing when table is missing or already has county_id. The counties
+ * table must exist.
+ */
+void dbMigrateCountyColumns(sqlite3* db, const char* table, const char* create_stmt);
+
+/*
+ * Brackets a load into table. With the bulk profile enabled the journal moves
+ * to WAL, synchronous, cache_size and mmap_size are relaxed and the table's
+ * county_id index is dropped; dbEndBulkLoad() builds the index once and
+ * restores the saved settings. Otherwise the index is created up front and
+ * maintained row by row. Call both while no other thread uses db.
+ */
+void dbBeginBulkLoad(sqlite3* db, const db_bulk_load_config_t* config, const char* table,
+	db_durable_settings_t* saved);
+void dbEndBulkLoad(sqlite3* db, const db_bulk_load_config_t* config, const char* table,
+	const db_durable_settings_t* saved);
+
+/*
+ * Insert statements are prepared once per run and reused for every row:
+ * values are bound with their column types, then the statement is stepped
+ * and reset. A row for a zip code already stored replaces it, so a run can
+ * fetch again what an interrupted one wrote. Finalize with sqlite3_finalize()
+ * before closing the database.
+ */
+sqlite3_stmt* prepareZipCodeInsert(sqlite3* db);
+int insertZipCodeRecord(sqlite3_stmt* stmt, const ZipCodeRecord* record);
+
+sqlite3_stmt* prepareCountyZipInsert(sqlite3* db);
+int insertCountyZip(sqlite3_stmt* stmt, const char* code, county_id_t county_id);
+
+/* Reads a stored zip_codes row back into record; returns 0 when code has none. */
+sqlite3_stmt* prepareZipCodeSelect(sqlite3* db);
+int selectZipCodeRecord(sqlite3_stmt* stmt, int32_t code, ZipCodeRecord* record);
+
+/* Steps through a county's stored zip codes, smallest first, as column 0. */
+sqlite3_stmt* prepareCountyZipSelect(sqlite3* db);
+
+#endif
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "zip_code_record.h"
+
+const char* zipCodeParseNumber(const char* text, const char* end, int decimals, int32_t* value) {
+	while (text < end && (*text == ' ' || *text == '$')) {
+		text++;
+	}
+
+	int64_t scaled = 0;
+	int digits = 0;
+	for (; text < end && ((*text >= '0' && *text <= '9') || *text == ','); ++text) {
+		if (*text == ',') {
+			continue;
+		}
+		scaled = scaled * 10 + (*text - '0');
+		if (scaled > INT32_MAX) {
+			return NULL;
+		}
+		digits++;
+	}
+
+	int places = 0;
+	int round_up = 0;
+	if (text < end && *text == '.') {
+		for (++text; text < end && *text >= '0' && *text <= '9'; ++text) {
+			if (places < decimals) {
+				scaled = scaled * 10 + (*text - '0');
+				places++;
+			} else if (places == decimals) {
+				round_up = *text >= '5';
+				places++;
+			}
+			digits++;
+		}
+	}
+	if (!digits) {
+		return NULL;
+	}
+
+	for (; places < decimals; ++places) {
+		scaled *= 10;
+	}
+	scaled += round_up;
+	if (scaled > INT32_MAX) {
+		return NULL;
+	}
+	*value = (int32_t)scaled;
+	return text;
+}
+
+static void formatFixed(char text[ZIP_CODE_NUMBER_TEXT_SIZE], int32_t value, int decimals, int min_decimals) {
+	int32_t scale = 1;
+	for (int i = 0; i < decimals; ++i) {
+		scale *= 10;
+	}
+	const int64_t magnitude = llabs((int64_t)value);
+	int64_t fraction = magnitude % scale;
+	while (decimals > min_decimals && fraction % 10 == 0) {
+		fraction /= 10;
+		decimals--;
+	}
+	snprintf(text, ZIP_CODE_NUMBER_TEXT_SIZE, "%s%lld.%0*lld", value < 0 ? "-" : "",
+		(long long)(magnitude / scale), decimals, (long long)fraction);
+}
+
+void zipCodeFormatFraction(char text[ZIP_CODE_NUMBER_TEXT_SIZE], int32_t value) {
+	formatFixed(text, value, ZIP_CODE_FRACTION_DECIMALS, ZIP_CODE_FRACTION_DECIMALS);
+}
+
+void zipCodeFormatDecimal(char text[ZIP_CODE_NUMBER_TEXT_SIZE], int32_t value) {
+	formatFixed(text, value, ZIP_CODE_DECIMAL_DECIMALS, 1);
+}
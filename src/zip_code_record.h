@@ -0,0 +1,64 @@
+#ifndef ZIP_CODES_ZIP_CODE_RECORD_H
+#define ZIP_CODES_ZIP_CODE_RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ZIP_CODE_STATE_SIZE 8      /* longest state and county names read, with their NUL */
+#define ZIP_CODE_COUNTY_SIZE 64
+#define ZIP_CODE_NUMBER_TEXT_SIZE 16   /* longest formatted field, with its NUL */
+
+/* Fixed point scales for the REAL columns. */
+#define ZIP_CODE_FRACTION_DECIMALS 4   /* percentages as fractions of 1, 0.1540 is 1540 */
+#define ZIP_CODE_DECIMAL_DECIMALS 2    /* land area, ages and household sizes, 70.4 is 7040 */
+
+/* Key of a (state, county) pair in the counties table, see county_dict.h; 0 is none. */
+typedef uint16_t county_id_t;
+
+/*
+ * One row of the zip_codes table as extracted from a city-data.com page.
+ * Counts and dollar amounts are integers and fractional columns are fixed
+ * point, and the state and county are a county_id_t, so a record is a single
+ * flat struct with no heap allocations. Fields a page lacks stay 0.
+ */
+typedef struct ZipCodeRecord {
+	int32_t code;
+	county_id_t county_id;
+	int32_t population;
+	int32_t population2010;
+	int32_t population2000;
+	int32_t medianHouseholdIncome;
+	int32_t foreignBornPopulation;     /* fraction */
+	int32_t medianHomePrice;
+	int32_t landArea;                  /* decimal, square miles */
+	int32_t medianResidentAge;         /* decimal */
+	int32_t malePercent;               /* fraction */
+	int32_t femalePercent;             /* fraction */
+	int32_t whitePopulation;
+	int32_t hispanicLatinoPopulation;
+	int32_t blackPopulation;
+	int32_t asianPopulation;
+	int32_t americanIndianPopulation;
+	int32_t highSchool;                /* fraction */
+	int32_t bachelorsDegree;           /* fraction */
+	int32_t graduateDegree;            /* fraction */
+	int32_t averageHouseholdSize;      /* decimal */
+} ZipCodeRecord;
+
+/*
+ * Reads the number at the start of [text, end) as fixed point with decimals
+ * places, rounding any further digits. Leading spaces and a '$' are skipped
+ * and thousands separators dropped, so "$1,234.5" with 2 decimals is 123450;
+ * a percentage read with 2 decimals is its fraction with 4, so "15.4%" gives
+ * 1540. Stops at the first other byte and returns it, or NULL when there is
+ * no digit or the value does not fit in 32 bits.
+ */
+const char* zipCodeParseNumber(const char* text, const char* end, int decimals, int32_t* value);
+
+/* "0.1540" for 1540: always ZIP_CODE_FRACTION_DECIMALS places. */
+void zipCodeFormatFraction(char text[ZIP_CODE_NUMBER_TEXT_SIZE], int32_t value);
+
+/* "70.4" for 7040: trailing zeros dropped, keeping at least one decimal. */
+void zipCodeFormatDecimal(char text[ZIP_CODE_NUMBER_TEXT_SIZE], int32_t value);
+
+#endif
@@ -0,0 +1,432 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "log.h"
+#include "scan.h"
+#include "zip_page_parser.h"
+
+#define LABEL_AUTOMATON_MAX_STATES 1024
+#define LABEL_AUTOMATON_MAX_CLASSES 64
+#define ZIP_PAGE_SCAN_BLOCK 8192   /* bytes classified per scanMask() pass */
+
+typedef enum {
+	ZIP_VALUE_NUMBER,    /* an integer after the markers, commas and a leading '$' dropped */
+	ZIP_VALUE_DECIMAL,   /* a number after the markers, in ZIP_CODE_DECIMAL_DECIMALS fixed point */
+	ZIP_VALUE_PERCENT,   /* a percentage after the markers, stored as a fraction */
+	ZIP_VALUE_BADGE      /* the integer in the line's first 'badge' span */
+} zip_value_kind_t;
+
+typedef struct {
+	const char* label;
+	const char* name;
+	zip_value_kind_t kind;
+	const char* markers[2];   /* skipped in order after the label */
+	size_t offset;            /* ZipCodeRecord field */
+} zip_field_spec_t;
+
+static const zip_field_spec_t FIELDS[ZIP_FIELD_COUNT] = {
+	{ "Estimated zip code population in 2016:", "zip population", ZIP_VALUE_NUMBER,
+		{ "</b>", NULL }, offsetof(ZipCodeRecord, population) },
+	{ "Zip code population in 2010:", "zip population 2010", ZIP_VALUE_NUMBER,
+		{ "</b>", NULL }, offsetof(ZipCodeRecord, population2010) },
+	{ "Zip code population in 2000:", "zip population 2000", ZIP_VALUE_NUMBER,
+		{ "</b>", NULL }, offsetof(ZipCodeRecord, population2000) },
+	{ "Estimated median household income in 2016:", "median household income", ZIP_VALUE_NUMBER,
+		{ "This zip code:", "</p>" }, offsetof(ZipCodeRecord, medianHouseholdIncome) },
+	{ "Foreign born population:", "foreign born population", ZIP_VALUE_PERCENT,
+		{ "</b>", "(" }, offsetof(ZipCodeRecord, foreignBornPopulation) },
+	{ "Estimated median house or condo value in 2016:", "med home price", ZIP_VALUE_NUMBER,
+		{ "</b>", NULL }, offsetof(ZipCodeRecord, medianHomePrice) },
+	{ "Land area:", "zip land area", ZIP_VALUE_DECIMAL,
+		{ "</b>", NULL }, offsetof(ZipCodeRecord, landArea) },
+	{ "Median resident age:", "median age", ZIP_VALUE_DECIMAL,
+		{ "</p>", NULL }, offsetof(ZipCodeRecord, medianResidentAge) },
+	{ "White population", "white population", ZIP_VALUE_BADGE,
+		{ NULL, NULL }, offsetof(ZipCodeRecord, whitePopulation) },
+	{ "Hispanic or Latino population", "hispanic/latino population", ZIP_VALUE_BADGE,
+		{ NULL, NULL }, offsetof(ZipCodeRecord, hispanicLatinoPopulation) },
+	{ "Black population", "black population", ZIP_VALUE_BADGE,
+		{ NULL, NULL }, offsetof(ZipCodeRecord, blackPopulation) },
+	{ "Asian population", "asian population", ZIP_VALUE_BADGE,
+		{ NULL, NULL }, offsetof(ZipCodeRecord, asianPopulation) },
+	{ "American Indian population", "american indian population", ZIP_VALUE_BADGE,
+		{ NULL, NULL }, offsetof(ZipCodeRecord, americanIndianPopulation) },
+	{ "High school or higher:", "high school", ZIP_VALUE_PERCENT,
+		{ "</b>", NULL }, offsetof(ZipCodeRecord, highSchool) },
+	{ "Bachelor's degree or higher:", "bachelors degree pct", ZIP_VALUE_PERCENT,
+		{ "</b>", NULL }, offsetof(ZipCodeRecord, bachelorsDegree) },
+	{ "Graduate or professional degree:", "graduate degree", ZIP_VALUE_PERCENT,
+		{ "</b>", NULL }, offsetof(ZipCodeRecord, graduateDegree) },
+	{ "Males:", "male percent", ZIP_VALUE_PERCENT,
+		{ "&nbsp;(", NULL }, offsetof(ZipCodeRecord, malePercent) },
+	{ "Females:", "female percent", ZIP_VALUE_PERCENT,
+		{ "&nbsp;(", NULL }, offsetof(ZipCodeRecord, femalePercent) },
+	{ "Average household size:", "avg household size", ZIP_VALUE_DECIMAL,
+		{ "</p>", NULL }, offsetof(ZipCodeRecord, averageHouseholdSize) },
+};
+
+/*
+ * Aho-Corasick automaton over the field labels with every failure transition
+ * resolved into a dense table, so scanning costs one lookup per byte. Bytes
+ * are first mapped to classes (one per character used in a label, 0 for the
+ * rest) to keep the table small enough to stay in L1/L2.
+ */
+typedef struct {
+	unsigned char classes[256];
+	unsigned char starts[256];   /* bytes that leave the root state */
+	scan_set_t start_set;        /* the same bytes for the vector scan, if they fit */
+	int use_start_set;
+	scan_set_t newline_set;
+	int class_count;
+	int state_count;
+	unsigned short next[LABEL_AUTOMATON_MAX_STATES * LABEL_AUTOMATON_MAX_CLASSES];
+	unsigned long output[LABEL_AUTOMATON_MAX_STATES];   /* fields whose label ends in this state */
+	size_t label_length[ZIP_FIELD_COUNT];
+} label_automaton_t;
+
+static label_automaton_t automaton;
+static pthread_once_t automaton_once = PTHREAD_ONCE_INIT;
+
+static void buildLabelAutomaton(void) {
+	label_automaton_t* a = &automaton;
+	a->class_count = 1;
+	for (int field = 0; field < ZIP_FIELD_COUNT; ++field) {
+		a->label_length[field] = strlen(FIELDS[field].label);
+		for (const unsigned char* c = (const unsigned char*)FIELDS[field].label; *c; ++c) {
+			if (!a->classes[*c]) {
+				if (a->class_count == LABEL_AUTOMATON_MAX_CLASSES) {
+					fputs("Too many distinct characters in the field labels.\n", stderr);
+					exit(EXIT_FAILURE);
+				}
+				a->classes[*c] = (unsigned char)a->class_count++;
+			}
+		}
+	}
+
+	/* Trie of the labels; 0 marks a missing edge until the failure links fill it in. */
+	a->state_count = 1;
+	for (int field = 0; field < ZIP_FIELD_COUNT; ++field) {
+		int state = 0;
+		for (const unsigned char* c = (const unsigned char*)FIELDS[field].label; *c; ++c) {
+			unsigned short* edge = &a->next[state * a->class_count + a->classes[*c]];
+			if (!*edge) {
+				if (a->state_count == LABEL_AUTOMATON_MAX_STATES) {
+					fputs("Too many states for the field label automaton.\n", stderr);
+					exit(EXIT_FAILURE);
+				}
+				*edge = (unsigned short)a->state_count++;
+			}
+			state = *edge;
+		}
+		a->output[state] |= 1UL << field;
+	}
+
+	/* Breadth first, so each state's failure target is complete before its children need it. */
+	int queue[LABEL_AUTOMATON_MAX_STATES];
+	int fail[LABEL_AUTOMATON_MAX_STATES] = {0};
+	int head = 0;
+	int tail = 0;
+	for (int c = 0; c < a->class_count; ++c) {
+		if (a->next[c]) {
+			queue[tail++] = a->next[c];
+		}
+	}
+	while (head < tail) {
+		const int state = queue[head++];
+		a->output[state] |= a->output[fail[state]];
+		for (int c = 0; c < a->class_count; ++c) {
+			unsigned short* edge = &a->next[state * a->class_count + c];
+			const unsigned short fallback = a->next[fail[state] * a->class_count + c];
+			if (*edge) {
+				fail[*edge] = fallback;
+				queue[tail++] = *edge;
+			} else {
+				*edge = fallback;
+			}
+		}
+	}
+
+	unsigned char start_bytes[256];
+	size_t start_count = 0;
+	for (int b = 0; b < 256; ++b) {
+		a->starts[b] = a->classes[b] && a->next[a->classes[b]] != 0;
+		if (a->starts[b]) {
+			start_bytes[start_count++] = (unsigned char)b;
+		}
+	}
+	a->use_start_set = scanSetInit(&a->start_set, start_bytes, start_count);
+	scanSetInit(&a->newline_set, (const unsigned char*)"\n", 1);
+}
+
+void zipPageParserInit(zip_page_parser_t* parser) {
+	pthread_once(&automaton_once, buildLabelAutomaton);
+	parser->used = 0;
+	parser->found = 0;
+	parser->bytes = 0;
+	parser->window[0] = '\0';
+	parser->matcher = ZIP_MATCH_AUTOMATON;
+}
+
+/* Fixed point places each kind is read with; a percentage's hundredths are its fraction's ten-thousandths. */
+static int kindDecimals(zip_value_kind_t kind) {
+	switch (kind) {
+	case ZIP_VALUE_DECIMAL: return ZIP_CODE_DECIMAL_DECIMALS;
+	case ZIP_VALUE_PERCENT: return ZIP_CODE_FRACTION_DECIMALS - 2;
+	default: return 0;
+	}
+}
+
+/*
+ * Reads the number at text straight from the page. Fails when there is no
+ * digit, or when the number runs into the end of a line that is still
+ * incomplete and may continue in the next window.
+ */
+static int readNumber(const char* text, const char* end, zip_value_kind_t kind, int complete, int32_t* value) {
+	const char* after = zipCodeParseNumber(text, end, kindDecimals(kind), value);
+	return after && (after < end || complete);
+}
+
+static int extractField(const zip_field_spec_t* spec, const char* line, const char* end, const char* label,
+		int complete, int32_t* value) {
+	static const char badge[] = "'badge'>";
+	const char* text = &label[strlen(spec->label)];
+	if (spec->kind == ZIP_VALUE_BADGE) {
+		text = scanFindString(line, end, badge, sizeof badge - 1);
+		if (text == end) {
+			return 0;
+		}
+		text += sizeof badge - 1;
+	}
+	for (int i = 0; i < 2 && spec->markers[i]; ++i) {
+		const size_t marker_length = strlen(spec->markers[i]);
+		text = scanFindString(text, end, spec->markers[i], marker_length);
+		if (text == end) {
+			return 0;
+		}
+		text += marker_length;
+	}
+
+	return readNumber(text, end, spec->kind, complete, value);
+}
+
+/* Runs the automaton from a byte that can start a label until it falls back to the root. */
+static const unsigned char* matchFrom(zip_page_parser_t* parser, const char* line, const char* end,
+		const unsigned char* text, int complete) {
+	const label_automaton_t* a = &automaton;
+	int state = 0;
+	do {
+		state = a->next[state * a->class_count + a->classes[*text++]];
+
+		unsigned long hits = a->output[state] & ~parser->found;
+		while (hits) {
+			const int field = __builtin_ctzl(hits);
+			hits &= hits - 1;
+			const char* label = (const char*)text - a->label_length[field];
+			if (extractField(&FIELDS[field], line, end, label, complete, &parser->values[field])) {
+				parser->found |= 1UL << field;
+			}
+		}
+	} while (state != 0 && text < (const unsigned char*)end);
+	return text;
+}
+
+static void matchLabels(zip_page_parser_t* parser, const char* line, size_t length, int complete) {
+	const label_automaton_t* a = &automaton;
+	const unsigned char* text = (const unsigned char*)line;
+	const unsigned char* end = &text[length];
+
+	while (text < end) {
+		/* Most bytes cannot start a label; skip them without touching the table. */
+		if (a->use_start_set) {
+			text = (const unsigned char*)scanFindAny((const char*)text, (const char*)end, &a->start_set);
+		} else {
+			while (text < end && !a->starts[*text]) {
+				text++;
+			}
+		}
+		if (text == end) {
+			break;
+		}
+		text = matchFrom(parser, line, (const char*)end, text, complete);
+	}
+}
+
+/* Index of the first set bit at or after from, or limit when there is none before it. */
+static size_t nextBit(const uint64_t* bits, size_t from, size_t limit) {
+	size_t word = from / 64;
+	uint64_t mask = bits[word] & (~(uint64_t)0 << (from % 64));
+	while (!mask) {
+		if (++word * 64 >= limit) {
+			return limit;
+		}
+		mask = bits[word];
+	}
+	const size_t bit = word * 64 + (size_t)__builtin_ctzll(mask);
+	return bit < limit ? bit : limit;
+}
+
+/*
+ * Parses the complete lines of block in place and returns the bytes consumed,
+ * up to and including the last newline. Newlines and label start bytes are
+ * classified for the whole block in two vector passes, so each line costs a
+ * few ctz steps rather than a search call per line and per candidate.
+ */
+static size_t parseBlock(zip_page_parser_t* parser, const char* block, size_t length) {
+	const label_automaton_t* a = &automaton;
+	uint64_t newlines[ZIP_PAGE_SCAN_BLOCK / 64];
+	uint64_t starts[ZIP_PAGE_SCAN_BLOCK / 64];
+	scanMask(block, length, &a->newline_set, newlines);
+	scanMask(block, length, &a->start_set, starts);
+
+	size_t line = 0;
+	const size_t words = (length + 63) / 64;
+	for (size_t word = 0; word < words; ++word) {
+		for (uint64_t mask = newlines[word]; mask; mask &= mask - 1) {
+			const size_t newline = word * 64 + (size_t)__builtin_ctzll(mask);
+			for (size_t next = nextBit(starts, line, newline); next < newline; next = nextBit(starts, next, newline)) {
+				const unsigned char* text = matchFrom(parser, &block[line], &block[newline],
+					(const unsigned char*)&block[next], 1);
+				next = (size_t)((const char*)text - block);
+			}
+			line = newline + 1;
+			if (parser->found == ZIP_PAGE_ALL_FIELDS) {
+				return line;
+			}
+		}
+	}
+	return line;
+}
+
+/* Scans one NUL-terminated line, or a window of a longer one, for the fields still missing. */
+static void parseLine(zip_page_parser_t* parser, const char* line, size_t length, int complete) {
+	if (parser->matcher == ZIP_MATCH_AUTOMATON) {
+		matchLabels(parser, line, length, complete);
+		return;
+	}
+	for (int field = 0; field < ZIP_FIELD_COUNT; ++field) {
+		if (parser->found & (1UL << field)) {
+			continue;
+		}
+		const char* label = strstr(line, FIELDS[field].label);
+		if (label && extractField(&FIELDS[field], line, &line[length], label, complete, &parser->values[field])) {
+			parser->found |= 1UL << field;
+		}
+	}
+}
+
+int zipPageParserFeed(zip_page_parser_t* parser, const char* data, size_t size) {
+	parser->bytes += size;
+	const int in_place = parser->matcher == ZIP_MATCH_AUTOMATON && automaton.use_start_set;
+	while (size > 0 && parser->found != ZIP_PAGE_ALL_FIELDS) {
+		if (in_place && parser->used == 0) {
+			/* Lines that end inside this chunk need no copy; only a trailing partial line is buffered. */
+			const size_t consumed = parseBlock(parser, data, size < ZIP_PAGE_SCAN_BLOCK ? size : ZIP_PAGE_SCAN_BLOCK);
+			if (consumed > 0) {
+				data += consumed;
+				size -= consumed;
+				continue;
+			}
+		}
+
+		const char* newline = scanFindByte(data, &data[size], '\n');
+		const size_t line_length = (size_t)(newline - data);
+		const size_t room = ZIP_PAGE_WINDOW - parser->used;
+		const size_t take = line_length < room ? line_length : room;
+
+		memcpy(&parser->window[parser->used], data, take);
+		parser->used += take;
+		parser->window[parser->used] = '\0';
+
+		if (take == line_length && line_length < size) {
+			parseLine(parser, parser->window, parser->used, 1);
+			parser->used = 0;
+			data += take + 1;
+			size -= take + 1;
+		} else {
+			data += take;
+			size -= take;
+			if (parser->used == ZIP_PAGE_WINDOW) {
+				/* Overlong line: parse this window, keep its tail for labels cut at the edge. */
+				parseLine(parser, parser->window, parser->used, 0);
+				memmove(parser->window, &parser->window[ZIP_PAGE_WINDOW - ZIP_PAGE_WINDOW_OVERLAP],
+					ZIP_PAGE_WINDOW_OVERLAP);
+				parser->used = ZIP_PAGE_WINDOW_OVERLAP;
+			}
+		}
+	}
+	return parser->found == ZIP_PAGE_ALL_FIELDS;
+}
+
+void zipPageParserFinish(zip_page_parser_t* parser) {
+	if (parser->used > 0) {
+		parser->window[parser->used] = '\0';
+		parseLine(parser, parser->window, parser->used, 1);
+		parser->used = 0;
+	}
+}
+
+const char* zipPageFieldLabel(zip_page_field_t field) {
+	return FIELDS[field].label;
+}
+
+typedef struct ZipPageSnapshot {
+	uint32_t version;
+	uint32_t field_count;
+	uint64_t found;
+	int32_t values[ZIP_FIELD_COUNT];
+} zip_page_snapshot_t;
+
+size_t zipPageParserSave(const zip_page_parser_t* parser, char* out, size_t capacity) {
+	zip_page_snapshot_t snapshot;
+	if (capacity < sizeof snapshot) {
+		return 0;
+	}
+	memset(&snapshot, 0, sizeof snapshot);
+	snapshot.version = ZIP_PAGE_SNAPSHOT_VERSION;
+	snapshot.field_count = ZIP_FIELD_COUNT;
+	snapshot.found = parser->found;
+	memcpy(snapshot.values, parser->values, sizeof snapshot.values);
+	memcpy(out, &snapshot, sizeof snapshot);
+	return sizeof snapshot;
+}
+
+int zipPageParserRestore(zip_page_parser_t* parser, const char* data, size_t size) {
+	zip_page_snapshot_t snapshot;
+	if (size != sizeof snapshot) {
+		return 0;
+	}
+	memcpy(&snapshot, data, sizeof snapshot);
+	if (snapshot.version != ZIP_PAGE_SNAPSHOT_VERSION || snapshot.field_count != ZIP_FIELD_COUNT
+			|| (snapshot.found & ~(uint64_t)ZIP_PAGE_ALL_FIELDS) != 0) {
+		return 0;
+	}
+	parser->found = (unsigned long)snapshot.found;
+	memcpy(parser->values, snapshot.values, sizeof parser->values);
+	return 1;
+}
+
+void zipPageParserCopy(const zip_page_parser_t* parser, ZipCodeRecord* record) {
+	for (int field = 0; field < ZIP_FIELD_COUNT; ++field) {
+		if (!(parser->found & (1UL << field))) {
+			continue;
+		}
+		const int32_t value = parser->values[field];
+		*(int32_t*)((char*)record + FIELDS[field].offset) = value;
+		if (LOG_DEBUG > LOG_COMPILE_LEVEL || !logEnabled(LOG_DEBUG)) {
+			continue;
+		}
+
+		char text[ZIP_CODE_NUMBER_TEXT_SIZE];
+		if (FIELDS[field].kind == ZIP_VALUE_PERCENT) {
+			zipCodeFormatFraction(text, value);
+		} else if (FIELDS[field].kind == ZIP_VALUE_DECIMAL) {
+			zipCodeFormatDecimal(text, value);
+		} else {
+			snprintf(text, sizeof text, "%d", value);
+		}
+		logDebug("%s = %s\n", FIELDS[field].name, text);
+	}
+}
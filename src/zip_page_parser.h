@@ -0,0 +1,80 @@
+#ifndef ZIP_CODES_ZIP_PAGE_PARSER_H
+#define ZIP_CODES_ZIP_PAGE_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "zip_code_record.h"
+
+#define ZIP_PAGE_WINDOW 16384       /* longest line parsed in one piece */
+#define ZIP_PAGE_WINDOW_OVERLAP 1024 /* kept when a longer line is split, so a field is never cut */
+#define ZIP_PAGE_SNAPSHOT_VERSION 1  /* bump when a parser change alters the values found */
+
+typedef enum ZipPageField {
+	ZIP_FIELD_POPULATION,
+	ZIP_FIELD_POPULATION_2010,
+	ZIP_FIELD_POPULATION_2000,
+	ZIP_FIELD_MEDIAN_HOUSEHOLD_INCOME,
+	ZIP_FIELD_FOREIGN_BORN_POPULATION,
+	ZIP_FIELD_MEDIAN_HOME_PRICE,
+	ZIP_FIELD_LAND_AREA,
+	ZIP_FIELD_MEDIAN_RESIDENT_AGE,
+	ZIP_FIELD_WHITE_POPULATION,
+	ZIP_FIELD_HISPANIC_LATINO_POPULATION,
+	ZIP_FIELD_BLACK_POPULATION,
+	ZIP_FIELD_ASIAN_POPULATION,
+	ZIP_FIELD_AMERICAN_INDIAN_POPULATION,
+	ZIP_FIELD_HIGH_SCHOOL,
+	ZIP_FIELD_BACHELORS_DEGREE,
+	ZIP_FIELD_GRADUATE_DEGREE,
+	ZIP_FIELD_MALE_PERCENT,
+	ZIP_FIELD_FEMALE_PERCENT,
+	ZIP_FIELD_AVERAGE_HOUSEHOLD_SIZE,
+	ZIP_FIELD_COUNT
+} zip_page_field_t;
+
+#define ZIP_PAGE_ALL_FIELDS ((1UL << ZIP_FIELD_COUNT) - 1)
+
+typedef enum ZipPageMatcher {
+	ZIP_MATCH_AUTOMATON,   /* one Aho-Corasick pass per line finds every label */
+	ZIP_MATCH_STRSTR       /* one strstr() per missing label per line, kept for comparison */
+} zip_page_matcher_t;
+
+/*
+ * Resumable extractor for city-data.com zip code pages. Bytes are fed in
+ * whatever chunks the network delivers; complete lines are scanned for the
+ * field labels as they arrive, so only the current line is buffered. The first
+ * occurrence of each field wins.
+ */
+typedef struct ZipPageParser {
+	char window[ZIP_PAGE_WINDOW + 1];
+	size_t used;
+	unsigned long found;   /* bit per zip_page_field_t */
+	int32_t values[ZIP_FIELD_COUNT];   /* as stored in ZipCodeRecord */
+	size_t bytes;
+	zip_page_matcher_t matcher;
+} zip_page_parser_t;
+
+/* Builds the shared label automaton on first use; safe to call from any thread. */
+void zipPageParserInit(zip_page_parser_t* parser);
+
+/* Consumes the next chunk of the page; returns 1 once every field has been found. */
+int zipPageParserFeed(zip_page_parser_t* parser, const char* data, size_t size);
+
+/* Parses a final line that was not terminated by a newline. */
+void zipPageParserFinish(zip_page_parser_t* parser);
+
+const char* zipPageFieldLabel(zip_page_field_t field);
+
+/*
+ * Writes the fields found so far to out for the response cache and returns
+ * the bytes used, 0 if capacity is too small. zipPageParserRestore() loads
+ * them into an initialized parser and returns 0 for a snapshot written with
+ * another ZIP_PAGE_SNAPSHOT_VERSION, so stale parses are fetched again.
+ */
+size_t zipPageParserSave(const zip_page_parser_t* parser, char* out, size_t capacity);
+int zipPageParserRestore(zip_page_parser_t* parser, const char* data, size_t size);
+
+/* Copies the fields found into record; fields the page lacked keep their current value. */
+void zipPageParserCopy(const zip_page_parser_t* parser, ZipCodeRecord* record);
+
+#endif